@@ -0,0 +1,52 @@
+#include "alloc_counter.h"
+
+#include <atomic>
+#include <cstddef>
+
+namespace {
+// Plain atomics are zero initialized before any constructor runs, malloc can be called that early
+std::atomic<bool> counting(false);
+std::atomic<uint64_t> allocations(0);
+}
+
+#if defined(__GLIBC__)
+extern "C" {
+void * __libc_malloc(size_t size);
+void * __libc_calloc(size_t count, size_t size);
+void * __libc_realloc(void * ptr, size_t size);
+
+// The executable's definitions win over libc's, and everything still comes from the glibc heap
+void * malloc(size_t size) noexcept {
+    if(counting.load(std::memory_order_relaxed)) allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void * calloc(size_t count, size_t size) noexcept {
+    if(counting.load(std::memory_order_relaxed)) allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void * realloc(void * ptr, size_t size) noexcept {
+    if(counting.load(std::memory_order_relaxed)) allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+
+bool NanoAllocCounter::is_available() {
+    return true;
+}
+#else
+bool NanoAllocCounter::is_available() {
+    return false;
+}
+#endif
+
+void NanoAllocCounter::start() {
+    allocations = 0;
+    counting = true;
+}
+
+uint64_t NanoAllocCounter::stop() {
+    counting = false;
+    return allocations.load();
+}
\ No newline at end of file
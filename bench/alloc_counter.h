@@ -0,0 +1,15 @@
+#ifndef NANO_ALLOC_COUNTER_H_
+#define NANO_ALLOC_COUNTER_H_
+
+#include <stdint.h>
+
+// Counts heap allocations made by any thread while it is running. Every memnew, memalloc, String and
+// PoolVector allocation ends in malloc, which is replaced in bench builds on glibc. Elsewhere it is not available.
+namespace NanoAllocCounter {
+    bool is_available();
+    void start();
+    // Allocations since start
+    uint64_t stop();
+}
+
+#endif
\ No newline at end of file
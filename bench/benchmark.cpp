@@ -0,0 +1,204 @@
+#include "benchmark.h"
+
+#include "alloc_counter.h"
+#include "nano/account.h"
+#include "nano/amount.h"
+#include "nano/block.h"
+#include "nano/receiver.h"
+#include "nano/requester.h"
+#include "nano/sender.h"
+
+#include "core/io/json.h"
+#include "core/message_queue.h"
+#include "core/os/os.h"
+
+namespace {
+struct ProcessBody {
+    Ref<NanoBlock> block;
+};
+
+struct BatchBody {
+    Vector<String> addresses;
+};
+
+PoolByteArray print_utf8(const Dictionary & data) {
+    // What NanoRequest sent before NanoJsonWriter
+    CharString text = JSON::print(data).utf8();
+    PoolByteArray raw;
+    raw.resize(text.length());
+    memcpy(raw.write().ptr(), text.get_data(), text.length());
+    return raw;
+}
+
+const char * const bench_seed = "0000000000000000000000000000000000000000000000000000000000000001";
+const char * const bench_frontier = "991CF190094C00F0B68E2E5F75F6BEE95A2E0BD93CEAA4A6734DB9F19B728948";
+const char * const bench_link = "E89208DD038FBB269987689621D52292AE9C35941A7484756ECCED92A65093BA";
+
+// Answers the request the state machine is waiting on, as if the node had replied. The process step waits for the
+// signature made on NanoJobPool, so messages are flushed until the next request goes out.
+template <class T>
+bool answer(T * owner, void (T::*completed)(int, String, int, int, const PoolByteArray &), const String & action, const String & reply) {
+    NanoRequest * requester = Object::cast_to<NanoRequest>(owner->get_child(0));
+    int id = requester->get_last_request_id();
+    CharString text = reply.utf8();
+    PoolByteArray data;
+    data.resize(text.length());
+    memcpy(data.write().ptr(), text.get_data(), text.length());
+    (owner->*completed)(id, action, 0, 200, data);
+
+    uint64_t deadline = OS::get_singleton()->get_ticks_msec() + 5000;
+    while(!owner->is_ready() && requester->get_last_request_id() == id) {
+        if(OS::get_singleton()->get_ticks_msec() > deadline) return false;
+        MessageQueue::get_singleton()->flush();
+        OS::get_singleton()->delay_usec(100);
+    }
+    return true;
+}
+
+template <class T>
+bool run_steps(T * owner, void (T::*completed)(int, String, int, int, const PoolByteArray &), const String & account_info) {
+    return answer(owner, completed, "account_info", account_info) &&
+        answer(owner, completed, "work_generate", "{\"work\":\"2bf29ef00786a6bc\"}") &&
+        answer(owner, completed, "process", "{\"hash\":\"" + String(bench_link) + "\"}") &&
+        owner->is_ready();
+}
+}
+
+void NanoBenchmark::measure(Dictionary & results, const String & name, int iterations, void (*body)(NanoBenchmark *, void *), void * data) {
+    body(this, data); // Warm up, the writer's buffer grows once
+
+    uint64_t start = OS::get_singleton()->get_ticks_usec();
+    for(int i = 0; i < iterations; i++) body(this, data);
+    results[name + "_usec"] = double(OS::get_singleton()->get_ticks_usec() - start) / iterations;
+
+    if(!NanoAllocCounter::is_available()) {
+        results[name + "_allocations"] = -1;
+        return;
+    }
+    NanoAllocCounter::start();
+    for(int i = 0; i < iterations; i++) body(this, data);
+    results[name + "_allocations"] = double(NanoAllocCounter::stop()) / iterations;
+}
+
+Dictionary NanoBenchmark::json_bodies(int iterations, int batch_size) {
+    ERR_FAIL_COND_V(iterations < 1 || batch_size < 1, Dictionary());
+
+    Ref<NanoAccount> account(memnew(NanoAccount));
+    account->set_seed(bench_seed);
+    nano::uint256_union previous;
+    previous.decode_hex(bench_frontier);
+    nano::uint128_union balance;
+    balance.decode_dec("1000000000000000000000000000000");
+    nano::uint256_union link;
+    link.decode_hex(bench_link);
+    ProcessBody process;
+    process.block.instance();
+    process.block->set_fields(account->get_public_key_bytes(), previous, account->get_public_key_bytes(), balance, link);
+    process.block->sign(account);
+    process.block->set_work("2bf29ef00786a6bc");
+
+    BatchBody batch;
+    std::array<uint8_t, 32> key;
+    for(int i = 0; i < batch_size; i++) {
+        key.fill(uint8_t(i));
+        batch.addresses.push_back(NanoAccount::encode_address(key));
+    }
+
+    Dictionary results;
+    results["iterations"] = iterations;
+    results["batch_size"] = batch_size;
+
+    // Same fields and key order as NanoRequest::process_block and a batch chunk, before and after
+    measure(results, "process_dictionary", iterations, [](NanoBenchmark *, void * data) {
+        const ProcessBody & p = *(const ProcessBody *)data;
+        Dictionary body;
+        body["action"] = "process";
+        body["json_block"] = true;
+        body["subtype"] = "send";
+        body["block"] = p.block->to_json();
+        print_utf8(body);
+    }, &process);
+    measure(results, "process_writer", iterations, [](NanoBenchmark * bench, void * data) {
+        const ProcessBody & p = *(const ProcessBody *)data;
+        NanoJsonWriter & writer = bench->writer;
+        writer.clear();
+        writer.begin_object();
+        writer.string("action", "process");
+        p.block->write_json(writer, "block");
+        writer.boolean("json_block", true);
+        writer.string("subtype", "send");
+        writer.end_object();
+        writer.to_pool();
+    }, &process);
+    measure(results, "batch_dictionary", iterations, [](NanoBenchmark *, void * data) {
+        const BatchBody & b = *(const BatchBody *)data;
+        Dictionary body;
+        Array accounts;
+        for(int i = 0; i < b.addresses.size(); i++) accounts.push_back(b.addresses[i]);
+        body["action"] = "accounts_balances";
+        body["accounts"] = accounts;
+        print_utf8(body);
+    }, &batch);
+    measure(results, "batch_writer", iterations, [](NanoBenchmark * bench, void * data) {
+        const BatchBody & b = *(const BatchBody *)data;
+        NanoJsonWriter & writer = bench->writer;
+        writer.clear();
+        writer.begin_object();
+        writer.begin_array("accounts");
+        for(int i = 0; i < b.addresses.size(); i++) writer.string(b.addresses[i]);
+        writer.end_array();
+        writer.string("action", "accounts_balances");
+        writer.end_object();
+        writer.to_pool();
+    }, &batch);
+    return results;
+}
+
+Dictionary NanoBenchmark::send_receive_allocations() {
+    Dictionary results;
+    // Nothing is sent, the requests only have to be accepted. Everything set up here is outside the count
+    String url = "http://127.0.0.1:7076";
+    Ref<NanoAccount> account(memnew(NanoAccount));
+    account->set_seed(bench_seed);
+    Ref<NanoAmount> amount(memnew(NanoAmount));
+    amount->set_amount("1000000000000000000000000");
+    nano::uint128_union raw_amount = amount->get_amount();
+    String account_info = "{\"balance\":\"1000000000000000000000000000000\",\"frontier\":\"" + String(bench_frontier) + "\",\"representative\":\"" + account->get_address() + "\"}";
+    String linked_send = bench_link;
+
+    NanoSender * sender = memnew(NanoSender);
+    sender->set_connection_parameters(url, "", false);
+    NanoReceiver * receiver = memnew(NanoReceiver);
+    receiver->set_connection_parameters(url, account, "", false);
+    MessageQueue::get_singleton()->flush();
+
+    NanoAllocCounter::start();
+    uint64_t start = OS::get_singleton()->get_ticks_usec();
+    sender->send(account, account, amount);
+    bool sent = run_steps(sender, &NanoSender::_nano_send_completed, account_info);
+    uint64_t send_usec = OS::get_singleton()->get_ticks_usec() - start;
+    uint64_t send_allocations = NanoAllocCounter::stop();
+
+    NanoAllocCounter::start();
+    start = OS::get_singleton()->get_ticks_usec();
+    receiver->receive_raw(account, linked_send, raw_amount);
+    bool received = run_steps(receiver, &NanoReceiver::_nano_request_completed, account_info);
+    uint64_t receive_usec = OS::get_singleton()->get_ticks_usec() - start;
+    uint64_t receive_allocations = NanoAllocCounter::stop();
+
+    memdelete(sender);
+    memdelete(receiver);
+    ERR_FAIL_COND_V_MSG(!sent || !received, results, "The send or receive did not complete");
+
+    bool counted = NanoAllocCounter::is_available();
+    results["send_allocations"] = counted ? int64_t(send_allocations) : -1;
+    results["send_usec"] = int64_t(send_usec);
+    results["receive_allocations"] = counted ? int64_t(receive_allocations) : -1;
+    results["receive_usec"] = int64_t(receive_usec);
+    return results;
+}
+
+void NanoBenchmark::_bind_methods() {
+    ClassDB::bind_method(D_METHOD("json_bodies", "iterations", "batch_size"), &NanoBenchmark::json_bodies, DEFVAL(10000), DEFVAL(100));
+    ClassDB::bind_method(D_METHOD("send_receive_allocations"), &NanoBenchmark::send_receive_allocations);
+}
\ No newline at end of file
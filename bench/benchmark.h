@@ -0,0 +1,26 @@
+#ifndef NANO_BENCHMARK_H_
+#define NANO_BENCHMARK_H_
+
+#include "nano/json_writer.h"
+
+#include "core/reference.h"
+
+// Only in builds made with nano_bench=yes, see demo/benchmark.gd for running it from the editor
+class NanoBenchmark : public Reference {
+    GDCLASS(NanoBenchmark, Reference);
+
+    private:
+        NanoJsonWriter writer; // Reused like NanoRequest's, so the numbers are for a warm buffer
+
+        void measure(Dictionary & results, const String & name, int iterations, void (*body)(NanoBenchmark *, void *), void * data);
+
+    protected:
+        static void _bind_methods();
+    public:
+        // Dictionary + JSON::print against NanoJsonWriter, for a process body and an accounts_balances batch chunk
+        Dictionary json_bodies(int iterations = 10000, int batch_size = 100);
+        // Heap allocations over one NanoSender send and one NanoReceiver receive, with the node's replies fed in directly
+        Dictionary send_receive_allocations();
+};
+
+#endif
\ No newline at end of file
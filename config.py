@@ -1,18 +1,38 @@
 def can_build(env, platform):
     return True
 
+def get_opts(platform):
+    from SCons.Variables import BoolVariable
+
+    return [
+        BoolVariable("nano_bench", "Build NanoBenchmark, see demo/benchmark.gd", False),
+    ]
+
+# NanoBenchmark is only registered in nano_bench builds, so only then does it have docs
+bench_enabled = False
+
 def configure(env):
-    pass
+    global bench_enabled
+    bench_enabled = env["nano_bench"]
 
 def get_doc_path():
     return "doc_classes"
 
 def get_doc_classes():
-    return [
+    classes = [
         "NanoAccount",
         "NanoAmount",
+        "NanoBlock",
+        "NanoLedger",
         "NanoReceiver",
         "NanoRequest",
         "NanoSender",
-        "NanoWatcher"
-    ]
\ No newline at end of file
+        "NanoSweeper",
+        "NanoWallet",
+        "NanoWatcher",
+        "NanoWorkDispatcher",
+        "NanoWorkSocket"
+    ]
+    if bench_enabled:
+        classes.append("NanoBenchmark")
+    return classes
\ No newline at end of file
@@ -0,0 +1,19 @@
+tool
+extends EditorScript
+
+# Needs an editor built with nano_bench=yes. Open this script and run it with File > Run.
+
+func _run():
+	if not ClassDB.class_exists("NanoBenchmark"):
+		printerr("NanoBenchmark is not in this build, rebuild with scons nano_bench=yes")
+		return
+	var bench = ClassDB.instance("NanoBenchmark")
+
+	var bodies = bench.json_bodies()
+	print("RPC bodies, %d iterations, %d accounts per batch chunk" % [bodies.iterations, bodies.batch_size])
+	for name in ["process_dictionary", "process_writer", "batch_dictionary", "batch_writer"]:
+		print("  %-20s %8.2f usec %8.2f allocations" % [name, bodies[name + "_usec"], bodies[name + "_allocations"]])
+
+	var steps = bench.send_receive_allocations()
+	print("One send: %d allocations, %d usec" % [steps.send_allocations, steps.send_usec])
+	print("One receive: %d allocations, %d usec" % [steps.receive_allocations, steps.receive_usec])
@@ -1,5 +1,7 @@
 #include "account.h"
 
+#include "address_cache.h"
+#include "job_pool.h"
 #include "numbers.h"
 #include "../blake2/blake2.h"
 #include "../duthomhas/csprng.hpp"
@@ -7,6 +9,8 @@
 #include "../qrcode/QrCode.hpp"
 
 #include "core/io/file_access_encrypted.h"
+#include "core/message_queue.h"
+#include "core/os/os.h"
 
 #include <boost/multiprecision/cpp_int.hpp>
 #include <vector>
@@ -46,7 +50,7 @@ String bytes_to_key_string(Iter first, Iter last) {
     return out;
 }
 
-String encode_base32(uint8_t* bytes, size_t length) {
+String encode_base32(const uint8_t* bytes, size_t length) {
     int leftover = (length * 8) % 5;
     int offset = leftover == 0 ? 0 : 5 - leftover;
 
@@ -70,9 +74,10 @@ String encode_base32(uint8_t* bytes, size_t length) {
     return output;
 }
 
-uint8_t account_decode (char value)
+uint8_t account_decode (CharType value)
 {
-    ERR_FAIL_COND_V_MSG(value < '0' || value >= '~', '~', "Invalid address: checksum value out of bounds with " + itos(value));
+    // Silent, a batch of addresses reports bad rows through its error array
+    if(value < '0' || value >= '~') return '~';
 	auto result (account_reverse[value - 0x30]);
 	if (result != '~')
 	{
@@ -82,76 +87,228 @@ uint8_t account_decode (char value)
 }
 
 int NanoAccount::set_address(String const & a) {
-    if(this->address.empty()){
-        this->address = a;
-
-        String encoded_val = "";
-        if(address.begins_with("nano_")){
-            ERR_FAIL_COND_V_MSG(address.length() != 65, 1, "Invalid nano address");
-            encoded_val = address.substr(5);
-        } else if(address.begins_with("xrb_")){
-            ERR_FAIL_COND_V_MSG(address.length() != 64, 1, "Invalid xrb address");
-            encoded_val = address.substr(4);
-        } else ERR_FAIL_V_MSG(1, "Address is invalid.");
-
-        ERR_FAIL_COND_V_MSG(encoded_val[0] != '1' && encoded_val[0] != '3', 1, "Invalid address");
-
-        boost::multiprecision::uint512_t decoded;
-        for(int i = 0; i < encoded_val.length(); i++){
-            uint8_t byte = account_decode(encoded_val[i]);
-            ERR_FAIL_COND_V_MSG(byte == '~', 1, "Invalid address");
-            decoded <<= 5;
-            decoded += byte;
-        }
-
-        boost::multiprecision::uint256_t a = (decoded >> 40).convert_to<boost::multiprecision::uint256_t>();
-        boost::multiprecision::export_bits(a, public_key.rbegin(), 8, false);
-        uint64_t checksum (decoded & static_cast<uint64_t>(0xffffffffff));
+    // Accounts from a seed already have their address
+    if(!has_seed && !address_valid){
+        address = a;
+        address_valid = true;
+        int error = decode_address(a, public_key);
+        public_key_valid = !error;
+        return error;
+    }
+    return 0;
+}
 
-        uint64_t validation (0);
-        blake2b_state hash;
-        blake2b_init (&hash, 5);
-        blake2b_update (&hash, public_key.data(), public_key.size());
-        blake2b_final (&hash, reinterpret_cast<uint8_t *> (&validation), 5);
-        ERR_FAIL_COND_V_MSG(checksum != validation, 1, "Checksum does not match");
+int NanoAccount::decode_address(const String & address, std::array<uint8_t, 32> & r_public_key) {
+    NanoAddressCache * cache = NanoAddressCache::get_singleton();
+    if(cache && cache->lookup_key(address, r_public_key)) return 0;
+
+    std::array<uint8_t, 32> key;
+    switch(parse_address(address, key)) {
+        case ADDRESS_OK: break;
+        case ADDRESS_INVALID_PREFIX: ERR_FAIL_V_MSG(1, "Address is invalid.");
+        case ADDRESS_INVALID_LENGTH: ERR_FAIL_V_MSG(1, "Invalid " + address.get_slice("_", 0) + " address");
+        case ADDRESS_INVALID_CHARACTER: ERR_FAIL_V_MSG(1, "Invalid address");
+        case ADDRESS_INVALID_CHECKSUM: ERR_FAIL_V_MSG(1, "Checksum does not match");
     }
+    r_public_key = key;
+    if(cache) cache->insert(address, key);
     return 0;
 }
 
-NanoAccount::NanoAccount() {
-    boost::multiprecision::uint256_t preamble_num(6);
+NanoAccount::AddressError NanoAccount::parse_address(const String & address, std::array<uint8_t, 32> & r_public_key) {
+    int prefix;
+    if(address.begins_with("nano_")) prefix = 5;
+    else if(address.begins_with("xrb_")) prefix = 4;
+    else return ADDRESS_INVALID_PREFIX;
+    if(address.length() != prefix + 60) return ADDRESS_INVALID_LENGTH;
+    if(address[prefix] != '1' && address[prefix] != '3') return ADDRESS_INVALID_CHARACTER;
+
+    boost::multiprecision::uint512_t decoded;
+    for(int i = prefix; i < address.length(); i++){
+        uint8_t byte = account_decode(address[i]);
+        if(byte == '~') return ADDRESS_INVALID_CHARACTER;
+        decoded <<= 5;
+        decoded += byte;
+    }
 
-    for (auto i (preamble.rbegin ()), n (preamble.rend ()); i != n; ++i)
-	{
-		*i = static_cast<uint8_t> (preamble_num & static_cast<uint8_t> (0xff));
-		preamble_num >>= 8;
-	}
-}
+    std::array<uint8_t, 32> key = {};
+    boost::multiprecision::uint256_t a = (decoded >> 40).convert_to<boost::multiprecision::uint256_t>();
+    boost::multiprecision::export_bits(a, key.rbegin(), 8, false);
+    uint64_t checksum (decoded & static_cast<uint64_t>(0xffffffffff));
 
-void NanoAccount::generate_keys_and_address() {
+    uint64_t validation (0);
     blake2b_state hash;
-    blake2b_init(&hash, private_key.size());
-    blake2b_update(&hash, seed.data(), seed.size());
-    blake2b_update(&hash, reinterpret_cast<uint8_t *> (&index), sizeof(uint32_t));
-    blake2b_final(&hash, private_key.data(), private_key.size());
-    
+    blake2b_init (&hash, 5);
+    blake2b_update (&hash, key.data(), key.size());
+    blake2b_final (&hash, reinterpret_cast<uint8_t *> (&validation), 5);
+    if(checksum != validation) return ADDRESS_INVALID_CHECKSUM;
+    r_public_key = key;
+    return ADDRESS_OK;
+}
 
-    // Create public key from private key
-    ed25519_publickey(private_key.data(), public_key.data());
+namespace {
+const int address_rows_per_slice = 4096; // Below this, handing rows to a worker costs more than it saves
+const int signature_rows_per_slice = 64; // A curve operation per row, far slower than an address
 
-    // Create address from public key
+// Splits rows [0, count) over NanoJobPool, the calling thread works on them too
+void run_batch(int count, int min_rows, void (*work)(void *, int, int), void * data) {
+    NanoJobPool * pool = NanoJobPool::get_singleton();
+    if(pool) pool->parallel_for(count, min_rows, work, data);
+    else work(data, 0, count);
+}
+
+struct DecodeRows {
+    const String * addresses;
+    uint8_t * keys;
+    int * errors;
+};
+
+void decode_rows(void * p_data, int from, int to) {
+    DecodeRows * rows = static_cast<DecodeRows *>(p_data);
+    std::array<uint8_t, 32> key;
+    for(int i = from; i < to; i++) {
+        // The shared cache is skipped, a large import would only flush it
+        rows->errors[i] = NanoAccount::parse_address(rows->addresses[i], key);
+        if(rows->errors[i] == NanoAccount::ADDRESS_OK) memcpy(rows->keys + i * 32, key.data(), 32);
+        else memset(rows->keys + i * 32, 0, 32);
+    }
+}
+
+struct EncodeRows {
+    const uint8_t * keys;
+    String * addresses;
+};
+
+void encode_rows(void * p_data, int from, int to) {
+    EncodeRows * rows = static_cast<EncodeRows *>(p_data);
+    std::array<uint8_t, 32> key;
+    for(int i = from; i < to; i++) {
+        memcpy(key.data(), rows->keys + i * 32, 32);
+        rows->addresses[i] = NanoAccount::format_address(key);
+    }
+}
+}
+
+Dictionary NanoAccount::decode_addresses(PoolStringArray addresses) {
+    int count = addresses.size();
+    PoolByteArray keys;
+    PoolIntArray errors;
+    keys.resize(count * 32);
+    errors.resize(count);
+    int invalid = 0;
+    if(count) {
+        PoolStringArray::Read r = addresses.read();
+        PoolByteArray::Write k = keys.write();
+        PoolIntArray::Write e = errors.write();
+        DecodeRows rows = { r.ptr(), k.ptr(), e.ptr() };
+        run_batch(count, address_rows_per_slice, decode_rows, &rows);
+        for(int i = 0; i < count; i++)
+            if(e[i] != ADDRESS_OK) invalid++;
+    }
+
+    Dictionary result;
+    result["keys"] = keys;
+    result["errors"] = errors;
+    result["invalid"] = invalid;
+    return result;
+}
+
+PoolStringArray NanoAccount::encode_addresses(PoolByteArray keys) {
+    PoolStringArray addresses;
+    ERR_FAIL_COND_V_MSG(keys.size() % 32, addresses, "Keys must be a multiple of 32 bytes");
+    int count = keys.size() / 32;
+    addresses.resize(count);
+    if(count) {
+        PoolByteArray::Read r = keys.read();
+        PoolStringArray::Write w = addresses.write();
+        EncodeRows rows = { r.ptr(), w.ptr() };
+        run_batch(count, address_rows_per_slice, encode_rows, &rows);
+    }
+    return addresses;
+}
+
+String NanoAccount::encode_address(const std::array<uint8_t, 32> & public_key) {
+    NanoAddressCache * cache = NanoAddressCache::get_singleton();
+    String address;
+    if(cache && cache->lookup_address(public_key, address)) return address;
+
+    address = format_address(public_key);
+    if(cache) cache->insert(address, public_key);
+    return address;
+}
+
+String NanoAccount::format_address(const std::array<uint8_t, 32> & public_key) {
     std::array<uint8_t, 5> checksum;
     blake2b(checksum.data(), 5, public_key.data(), 32, NULL, 0);
     std::reverse(checksum.begin(), checksum.end());
 
-    address = "nano_" + encode_base32(public_key.data(), 32) + encode_base32(checksum.data(), 5);
+    return "nano_" + encode_base32(public_key.data(), 32) + encode_base32(checksum.data(), 5);
+}
+
+NanoAccount::NanoAccount() {
+    seed.fill(0);
+    private_key.fill(0);
+    public_key.fill(0);
+}
+
+void NanoAccount::derive_private_key(const std::array<uint8_t, 32> & seed, uint32_t index, std::array<uint8_t, 32> & r_private_key) {
+    blake2b_state hash;
+    blake2b_init(&hash, r_private_key.size());
+    blake2b_update(&hash, seed.data(), seed.size());
+    blake2b_update(&hash, reinterpret_cast<uint8_t *> (&index), sizeof(uint32_t));
+    blake2b_final(&hash, r_private_key.data(), r_private_key.size());
+}
+
+void NanoAccount::derive_public_key(const std::array<uint8_t, 32> & private_key, std::array<uint8_t, 32> & r_public_key) {
+    ed25519_publickey(private_key.data(), r_public_key.data());
+}
+
+void NanoAccount::reset_derived_keys() {
+    private_key_valid = false;
+    public_key_valid = false;
+    address_valid = false;
+    address = String();
+}
+
+const std::array<uint8_t, 32> & NanoAccount::get_private_key_bytes() const {
+    if(!private_key_valid && has_seed) {
+        derive_private_key(seed, index, private_key);
+        private_key_valid = true;
+    }
+    return private_key;
+}
+
+const std::array<uint8_t, 32> & NanoAccount::get_public_key_bytes() const {
+    if(!public_key_valid && has_seed) {
+        derive_public_key(get_private_key_bytes(), public_key);
+        public_key_valid = true;
+    }
+    return public_key;
+}
+
+String NanoAccount::get_address() {
+    if(!address_valid && has_seed) {
+        address = encode_address(get_public_key_bytes());
+        address_valid = true;
+    }
+    return address;
+}
+
+void NanoAccount::set_seed_index_and_public_key(const std::array<uint8_t, 32> & p_seed, uint32_t p_index, const std::array<uint8_t, 32> & p_public_key) {
+    seed = p_seed;
+    index = p_index;
+    has_seed = true;
+    reset_derived_keys();
+    public_key = p_public_key;
+    public_key_valid = true;
 }
 
 void NanoAccount::initialize_with_new_seed() {
     duthomhas::csprng rng;
     rng(seed);
-
-    generate_keys_and_address();
+    index = 0;
+    has_seed = true;
+    reset_derived_keys();
 }
 
 int NanoAccount::set_seed(String const & s) {
@@ -161,14 +318,16 @@ int NanoAccount::set_seed(String const & s) {
 int NanoAccount::set_seed_and_index(String const & s, uint32_t index) {
     if(key_string_to_bytes(s, seed)) return 1;
     this->index = index;
-
-    generate_keys_and_address();
+    has_seed = true;
+    reset_derived_keys();
     return 0;
 }
 
-Ref<ImageTexture> get_qr_code_for_text(String text) {
-    const char * c_text = text.utf8().ptr();
-    qrcodegen::QrCode qr = qrcodegen::QrCode::encodeText(c_text, qrcodegen::QrCode::Ecc::MEDIUM);
+namespace {
+// The encoding and the pixels, no texture, so it can run on a NanoJobPool worker
+Ref<Image> render_qr_code(const String & text) {
+    CharString utf8 = text.utf8();
+    qrcodegen::QrCode qr = qrcodegen::QrCode::encodeText(utf8.get_data(), qrcodegen::QrCode::Ecc::MEDIUM);
 
     int size = qr.getSize();
 
@@ -185,20 +344,64 @@ Ref<ImageTexture> get_qr_code_for_text(String text) {
         }
     }
     image->unlock();
+    return image;
+}
 
+Ref<ImageTexture> make_qr_texture(const Ref<Image> & image) {
     Ref<ImageTexture> texture(memnew(ImageTexture));
     texture->create_from_image(image, 0); // 0 means no flags: no mipmap, filter, or repeat (none of which we would want on a qr code)
     return texture;
 }
 
+class QrCodeJob : public NanoJob {
+    private:
+        ObjectID account;
+        String text;
+
+    public:
+        void run() {
+            MessageQueue::get_singleton()->push_call(account, "_qr_code_rendered", render_qr_code(text));
+        }
+
+        QrCodeJob(ObjectID p_account, const String & p_text) : account(p_account), text(p_text) {}
+};
+}
+
+String NanoAccount::get_payment_uri(Ref<NanoAmount> amount) {
+    String text = "nano:" + get_address();
+    if(amount.is_valid()) text += "?amount=" + amount->get_raw_amount();
+    return text;
+}
+
 Ref<ImageTexture> NanoAccount::get_qr_code() {
-    return get_qr_code_for_text("nano:" + address);
+    return make_qr_texture(render_qr_code(get_payment_uri(Ref<NanoAmount>())));
 }
 
 Ref<ImageTexture> NanoAccount::get_qr_code_with_amount(Ref<NanoAmount> amount) {
-    String text = "nano:" + address;
-    text += "?amount=" + amount->get_raw_amount();
-    return get_qr_code_for_text(text);
+    ERR_FAIL_COND_V(amount.is_null(), Ref<ImageTexture>());
+    return make_qr_texture(render_qr_code(get_payment_uri(amount)));
+}
+
+void NanoAccount::generate_qr_code(Ref<NanoAmount> amount) {
+    // Textures are only made on the main thread, the job hands back the image
+    NanoJobPool::get_singleton()->submit(memnew(QrCodeJob(get_instance_id(), get_payment_uri(amount))));
+}
+
+void NanoAccount::_qr_code_rendered(Ref<Image> image) {
+    emit_signal("qr_code_generated", make_qr_texture(image));
+}
+
+void NanoAccount::hash_state_block(const uint8_t * account, const uint8_t * previous, const uint8_t * representative, const uint8_t * balance, const uint8_t * link, uint8_t * r_hash) {
+    static const nano::uint256_union preamble (6); // Built once, not per hash
+	blake2b_state hash_l;
+	blake2b_init (&hash_l, 32);
+	blake2b_update (&hash_l, preamble.bytes.data (), preamble.bytes.size ());
+	blake2b_update (&hash_l, account, 32);
+	blake2b_update (&hash_l, previous, 32);
+	blake2b_update (&hash_l, representative, 32);
+	blake2b_update (&hash_l, balance, 16);
+	blake2b_update (&hash_l, link, 32);
+	blake2b_final (&hash_l, r_hash, 32);
 }
 
 uint256_union NanoAccount::internal_block_hash(String previous, Ref<NanoAccount> representative, Ref<NanoAmount> balance, String link) {
@@ -206,17 +409,7 @@ uint256_union NanoAccount::internal_block_hash(String previous, Ref<NanoAccount>
     nano::uint256_union link_u(link);
     
     nano::uint256_union result;
-	blake2b_state hash_l;
-	auto status (blake2b_init (&hash_l, sizeof (result.bytes)));
-    nano::uint256_union preamble (6);
-	blake2b_update (&hash_l, preamble.bytes.data (), preamble.bytes.size ());
-    blake2b_update (&hash_l, public_key.data (), sizeof (public_key));
-	blake2b_update (&hash_l, prev_u.bytes.data (), sizeof (prev_u.bytes));
-	blake2b_update (&hash_l, representative->public_key.data (), sizeof (representative->public_key));
-	blake2b_update (&hash_l, balance->get_amount().bytes.data (), sizeof (balance->get_amount().bytes));
-	blake2b_update (&hash_l, link_u.bytes.data (), sizeof (link_u.bytes));
-    status = blake2b_final (&hash_l, result.bytes.data (), sizeof (result.bytes));
-    ERR_FAIL_COND_V_MSG(status, uint256_union(), "Block hashing failed");
+    hash_state_block(get_public_key_bytes().data(), prev_u.bytes.data(), representative->get_public_key_bytes().data(), balance->get_amount().bytes.data(), link_u.bytes.data(), result.bytes.data());
 	return result;
 }
 
@@ -228,20 +421,215 @@ String NanoAccount::sign(String previous, Ref<NanoAccount> representative, Ref<N
     uint256_union message = internal_block_hash(previous, representative, balance, link);
 
     uint512_union result;
-	ed25519_sign (message.bytes.data (), sizeof (message.bytes), private_key.data (), public_key.data (), result.bytes.data ());
+	ed25519_sign (message.bytes.data (), sizeof (message.bytes), get_private_key_bytes().data (), get_public_key_bytes().data (), result.bytes.data ());
 	return result.to_string();
 }
 
+void NanoAccount::sign_hash(const std::array<uint8_t, 32> & hash, std::array<uint8_t, 64> & r_signature) const {
+    ed25519_sign(hash.data(), hash.size(), get_private_key_bytes().data(), get_public_key_bytes().data(), r_signature.data());
+}
+
+PoolByteArray NanoAccount::block_hash_bytes(PoolByteArray previous, PoolByteArray representative, PoolByteArray balance, PoolByteArray link) {
+    PoolByteArray hash;
+    ERR_FAIL_COND_V_MSG(previous.size() != 32 || representative.size() != 32 || link.size() != 32, hash, "previous, representative and link must be 32 bytes");
+    ERR_FAIL_COND_V_MSG(balance.size() != 16, hash, "balance must be 16 bytes, big endian");
+    hash.resize(32);
+    hash_state_block(get_public_key_bytes().data(), previous.read().ptr(), representative.read().ptr(), balance.read().ptr(), link.read().ptr(), hash.write().ptr());
+    return hash;
+}
+
+PoolByteArray NanoAccount::sign_bytes(PoolByteArray hash) {
+    PoolByteArray signature;
+    ERR_FAIL_COND_V_MSG(!has_seed, signature, "Account has no private key");
+    ERR_FAIL_COND_V_MSG(hash.size() != 32, signature, "hash must be 32 bytes");
+    signature.resize(64);
+    ed25519_sign(hash.read().ptr(), 32, get_private_key_bytes().data(), get_public_key_bytes().data(), signature.write().ptr());
+    return signature;
+}
+
+namespace {
+struct SignRows {
+    const uint8_t * hashes;
+    uint8_t * signatures;
+    const uint8_t * private_key;
+    const uint8_t * public_key;
+};
+
+void sign_rows(void * p_data, int from, int to) {
+    SignRows * rows = static_cast<SignRows *>(p_data);
+    for(int i = from; i < to; i++)
+        ed25519_sign(rows->hashes + i * 32, 32, rows->private_key, rows->public_key, rows->signatures + i * 64);
+}
+}
+
+PoolByteArray NanoAccount::sign_blocks(PoolByteArray hashes) {
+    PoolByteArray signatures;
+    ERR_FAIL_COND_V_MSG(!has_seed, signatures, "Account has no private key");
+    ERR_FAIL_COND_V_MSG(hashes.size() % 32, signatures, "hashes must be a multiple of 32 bytes");
+    int count = hashes.size() / 32;
+    signatures.resize(count * 64);
+    if(count) {
+        PoolByteArray::Read r = hashes.read();
+        PoolByteArray::Write w = signatures.write();
+        // Keys are derived here, the worker threads only read them
+        SignRows rows = { r.ptr(), w.ptr(), get_private_key_bytes().data(), get_public_key_bytes().data() };
+        run_batch(count, signature_rows_per_slice, sign_rows, &rows);
+    }
+    return signatures;
+}
+
+namespace {
+struct VerifyRows {
+    const uint8_t * hashes;
+    const uint8_t * signatures;
+    const uint8_t * public_keys;
+    int key_stride; // 0 when every row is checked against the same key
+    uint8_t * results;
+};
+
+void verify_rows(void * p_data, int from, int to) {
+    VerifyRows * rows = static_cast<VerifyRows *>(p_data);
+    int count = to - from;
+    std::vector<const unsigned char *> m(count), pk(count), rs(count);
+    std::vector<size_t> mlen(count, 32);
+    std::vector<int> valid(count);
+    for(int i = 0; i < count; i++) {
+        m[i] = rows->hashes + (from + i) * 32;
+        pk[i] = rows->public_keys + (from + i) * rows->key_stride;
+        rs[i] = rows->signatures + (from + i) * 64;
+    }
+    // The batch check shares work between rows and still reports each one
+    nano::validate_message_batch(m.data(), mlen.data(), pk.data(), rs.data(), count, valid.data());
+    for(int i = 0; i < count; i++)
+        rows->results[from + i] = valid[i] ? 1 : 0;
+}
+}
+
+PoolByteArray NanoAccount::verify_signatures(PoolByteArray hashes, PoolByteArray signatures, PoolByteArray public_keys) {
+    PoolByteArray results;
+    ERR_FAIL_COND_V_MSG(hashes.size() % 32, results, "hashes must be a multiple of 32 bytes");
+    int count = hashes.size() / 32;
+    ERR_FAIL_COND_V_MSG(signatures.size() != count * 64, results, "signatures must be 64 bytes per hash");
+    ERR_FAIL_COND_V_MSG(!public_keys.empty() && public_keys.size() != 32 && public_keys.size() != count * 32, results, "public_keys must be empty, one 32 byte key, or one per hash");
+    results.resize(count);
+    if(count) {
+        PoolByteArray::Read h = hashes.read();
+        PoolByteArray::Read s = signatures.read();
+        PoolByteArray::Read k = public_keys.read();
+        PoolByteArray::Write w = results.write();
+        const uint8_t * keys = public_keys.empty() ? get_public_key_bytes().data() : k.ptr();
+        VerifyRows rows = { h.ptr(), s.ptr(), keys, public_keys.size() == count * 32 ? 32 : 0, w.ptr() };
+        run_batch(count, signature_rows_per_slice, verify_rows, &rows);
+    }
+    return results;
+}
+
+namespace {
+class SignJob : public NanoJob {
+    private:
+        ObjectID target;
+        StringName method;
+        int tag;
+        PoolByteArray hashes;
+        std::array<uint8_t, 32> private_key;
+        std::array<uint8_t, 32> public_key;
+
+    public:
+        void run() {
+            int count = hashes.size() / 32;
+            PoolByteArray signatures;
+            signatures.resize(count * 64);
+            {
+                PoolByteArray::Read r = hashes.read();
+                PoolByteArray::Write w = signatures.write();
+                SignRows rows = { r.ptr(), w.ptr(), private_key.data(), public_key.data() };
+                run_batch(count, signature_rows_per_slice, sign_rows, &rows);
+            }
+            MessageQueue::get_singleton()->push_call(target, method, tag, signatures);
+        }
+
+        SignJob(ObjectID p_target, const StringName & p_method, int p_tag, const PoolByteArray & p_hashes, const std::array<uint8_t, 32> & p_private_key, const std::array<uint8_t, 32> & p_public_key) :
+            target(p_target), method(p_method), tag(p_tag), hashes(p_hashes), private_key(p_private_key), public_key(p_public_key) {}
+        ~SignJob() { private_key.fill(0); }
+};
+
+class VerifyJob : public NanoJob {
+    private:
+        ObjectID target;
+        int tag;
+        PoolByteArray hashes;
+        PoolByteArray signatures;
+        PoolByteArray public_keys; // One key for every row, or one per row
+
+    public:
+        void run() {
+            int count = hashes.size() / 32;
+            PoolByteArray results;
+            results.resize(count);
+            {
+                PoolByteArray::Read h = hashes.read();
+                PoolByteArray::Read s = signatures.read();
+                PoolByteArray::Read k = public_keys.read();
+                PoolByteArray::Write w = results.write();
+                VerifyRows rows = { h.ptr(), s.ptr(), k.ptr(), public_keys.size() == count * 32 ? 32 : 0, w.ptr() };
+                run_batch(count, signature_rows_per_slice, verify_rows, &rows);
+            }
+            MessageQueue::get_singleton()->push_call(target, "_signatures_verified", tag, results);
+        }
+
+        VerifyJob(ObjectID p_target, int p_tag, const PoolByteArray & p_hashes, const PoolByteArray & p_signatures, const PoolByteArray & p_public_keys) :
+            target(p_target), tag(p_tag), hashes(p_hashes), signatures(p_signatures), public_keys(p_public_keys) {}
+};
+}
+
+Error NanoAccount::sign_hashes_async(const PoolByteArray & hashes, ObjectID target, const StringName & method, int tag) const {
+    ERR_FAIL_COND_V_MSG(!has_seed, ERR_UNCONFIGURED, "Account has no private key");
+    // Keys are derived here, the job gets copies
+    NanoJobPool::get_singleton()->submit(memnew(SignJob(target, method, tag, hashes, get_private_key_bytes(), get_public_key_bytes())));
+    return OK;
+}
+
+int NanoAccount::sign_blocks_async(PoolByteArray hashes) {
+    ERR_FAIL_COND_V_MSG(hashes.empty() || hashes.size() % 32, 0, "hashes must be a non-empty multiple of 32 bytes");
+    int task_id = next_task_id++;
+    if(sign_hashes_async(hashes, get_instance_id(), "_blocks_signed", task_id)) return 0;
+    return task_id;
+}
+
+void NanoAccount::_blocks_signed(int task_id, const PoolByteArray & signatures) {
+    emit_signal("blocks_signed", task_id, signatures);
+}
+
+int NanoAccount::verify_signatures_async(PoolByteArray hashes, PoolByteArray signatures, PoolByteArray public_keys) {
+    ERR_FAIL_COND_V_MSG(hashes.empty() || hashes.size() % 32, 0, "hashes must be a non-empty multiple of 32 bytes");
+    int count = hashes.size() / 32;
+    ERR_FAIL_COND_V_MSG(signatures.size() != count * 64, 0, "signatures must be 64 bytes per hash");
+    ERR_FAIL_COND_V_MSG(!public_keys.empty() && public_keys.size() != 32 && public_keys.size() != count * 32, 0, "public_keys must be empty, one 32 byte key, or one per hash");
+    if(public_keys.empty()) {
+        public_keys.resize(32);
+        memcpy(public_keys.write().ptr(), get_public_key_bytes().data(), 32);
+    }
+    int task_id = next_task_id++;
+    NanoJobPool::get_singleton()->submit(memnew(VerifyJob(get_instance_id(), task_id, hashes, signatures, public_keys)));
+    return task_id;
+}
+
+void NanoAccount::_signatures_verified(int task_id, const PoolByteArray & results) {
+    emit_signal("signatures_verified", task_id, results);
+}
+
 String NanoAccount::get_seed() {
     return bytes_to_key_string(seed.begin(), seed.end());
 }
 
 String NanoAccount::get_private_key() {
-    return bytes_to_key_string(private_key.begin(), private_key.end());
+    const std::array<uint8_t, 32> & key = get_private_key_bytes();
+    return bytes_to_key_string(key.begin(), key.end());
 }
 
 String NanoAccount::get_public_key() {
-    return bytes_to_key_string(public_key.begin(), public_key.end());
+    const std::array<uint8_t, 32> & key = get_public_key_bytes();
+    return bytes_to_key_string(key.begin(), key.end());
 }
 
 void NanoAccount::_bind_methods() {
@@ -261,7 +649,31 @@ void NanoAccount::_bind_methods() {
 
     ClassDB::bind_method(D_METHOD("get_qr_code"), &NanoAccount::get_qr_code);
     ClassDB::bind_method(D_METHOD("get_qr_code_with_amount", "amount"), &NanoAccount::get_qr_code_with_amount);
+    ClassDB::bind_method(D_METHOD("get_payment_uri", "amount"), &NanoAccount::get_payment_uri, DEFVAL(Variant()));
+    ClassDB::bind_method(D_METHOD("generate_qr_code", "amount"), &NanoAccount::generate_qr_code, DEFVAL(Variant()));
+    ClassDB::bind_method(D_METHOD("_qr_code_rendered", "image"), &NanoAccount::_qr_code_rendered);
 
     ClassDB::bind_method(D_METHOD("block_hash", "previous", "representative", "balance", "link"), &NanoAccount::block_hash);
     ClassDB::bind_method(D_METHOD("sign", "previous", "representative", "balance", "link"), &NanoAccount::sign);
+    ClassDB::bind_method(D_METHOD("block_hash_bytes", "previous", "representative", "balance", "link"), &NanoAccount::block_hash_bytes);
+    ClassDB::bind_method(D_METHOD("sign_bytes", "hash"), &NanoAccount::sign_bytes);
+    ClassDB::bind_method(D_METHOD("sign_blocks", "hashes"), &NanoAccount::sign_blocks);
+    ClassDB::bind_method(D_METHOD("verify_signatures", "hashes", "signatures", "public_keys"), &NanoAccount::verify_signatures, DEFVAL(PoolByteArray()));
+    ClassDB::bind_method(D_METHOD("sign_blocks_async", "hashes"), &NanoAccount::sign_blocks_async);
+    ClassDB::bind_method(D_METHOD("verify_signatures_async", "hashes", "signatures", "public_keys"), &NanoAccount::verify_signatures_async, DEFVAL(PoolByteArray()));
+    ClassDB::bind_method(D_METHOD("_blocks_signed", "task_id", "signatures"), &NanoAccount::_blocks_signed);
+    ClassDB::bind_method(D_METHOD("_signatures_verified", "task_id", "results"), &NanoAccount::_signatures_verified);
+
+    ClassDB::bind_method(D_METHOD("decode_addresses", "addresses"), &NanoAccount::decode_addresses);
+    ClassDB::bind_method(D_METHOD("encode_addresses", "keys"), &NanoAccount::encode_addresses);
+
+    ADD_SIGNAL(MethodInfo("qr_code_generated", PropertyInfo(Variant::OBJECT, "texture", PROPERTY_HINT_RESOURCE_TYPE, "ImageTexture")));
+    ADD_SIGNAL(MethodInfo("blocks_signed", PropertyInfo(Variant::INT, "task_id"), PropertyInfo(Variant::POOL_BYTE_ARRAY, "signatures")));
+    ADD_SIGNAL(MethodInfo("signatures_verified", PropertyInfo(Variant::INT, "task_id"), PropertyInfo(Variant::POOL_BYTE_ARRAY, "results")));
+
+    BIND_ENUM_CONSTANT(ADDRESS_OK);
+    BIND_ENUM_CONSTANT(ADDRESS_INVALID_PREFIX);
+    BIND_ENUM_CONSTANT(ADDRESS_INVALID_LENGTH);
+    BIND_ENUM_CONSTANT(ADDRESS_INVALID_CHARACTER);
+    BIND_ENUM_CONSTANT(ADDRESS_INVALID_CHECKSUM);
 }
\ No newline at end of file
@@ -14,17 +14,34 @@
 class NanoAccount : public Reference {
     GDCLASS(NanoAccount, Reference);
 
+    public:
+        enum AddressError {
+            ADDRESS_OK,
+            ADDRESS_INVALID_PREFIX,
+            ADDRESS_INVALID_LENGTH,
+            ADDRESS_INVALID_CHARACTER,
+            ADDRESS_INVALID_CHECKSUM
+        };
+
     private:
         std::array<uint8_t, 32> seed;
-        std::array<uint8_t, 32> private_key;
-        std::array<uint8_t, 32> public_key;
-        String address;
-        uint32_t index;
+        uint32_t index = 0;
+        bool has_seed = false;
+
+        // Derived on first use and kept, so an account that only ever shows its address never runs the curve operation
+        mutable std::array<uint8_t, 32> private_key;
+        mutable std::array<uint8_t, 32> public_key;
+        mutable String address;
+        mutable bool private_key_valid = false;
+        mutable bool public_key_valid = false;
+        mutable bool address_valid = false;
+
+        int next_task_id = 1; // For sign_blocks_async and verify_signatures_async
 
-        std::array<uint8_t, 32> preamble;
         uint256_union internal_block_hash(String previous, Ref<NanoAccount> representative, Ref<NanoAmount> balance, String link);
 
-        void generate_keys_and_address();
+        void reset_derived_keys();
+        const std::array<uint8_t, 32> & get_private_key_bytes() const;
     protected:
         static void _bind_methods();
     public:
@@ -38,13 +55,53 @@ class NanoAccount : public Reference {
         String get_public_key();
         int get_index() { return index; }
         int set_address(String const & a);
-        String get_address() { return address; }
+        String get_address();
 
         Ref<ImageTexture> get_qr_code();
         Ref<ImageTexture> get_qr_code_with_amount(Ref<NanoAmount> amount);
+        String get_payment_uri(Ref<NanoAmount> amount = Ref<NanoAmount>());
+        // Renders on NanoJobPool and emits qr_code_generated
+        void generate_qr_code(Ref<NanoAmount> amount = Ref<NanoAmount>());
+        void _qr_code_rendered(Ref<Image> image);
+
+        static int decode_address(const String & address, std::array<uint8_t, 32> & r_public_key);
+        // Same without the shared cache and without printing errors, safe to call from any thread
+        static AddressError parse_address(const String & address, std::array<uint8_t, 32> & r_public_key);
+        static String encode_address(const std::array<uint8_t, 32> & public_key);
+        static String format_address(const std::array<uint8_t, 32> & public_key); // Uncached, for any thread
+        static void derive_private_key(const std::array<uint8_t, 32> & seed, uint32_t index, std::array<uint8_t, 32> & r_private_key);
+        static void derive_public_key(const std::array<uint8_t, 32> & private_key, std::array<uint8_t, 32> & r_public_key); // The curve operation
+        // For NanoWallet, which already stored the public key of this index
+        void set_seed_index_and_public_key(const std::array<uint8_t, 32> & seed, uint32_t index, const std::array<uint8_t, 32> & public_key);
+        const std::array<uint8_t, 32> & get_public_key_bytes() const;
+        bool has_private_key() const { return has_seed; } // False for accounts made from an address
+        void sign_hash(const std::array<uint8_t, 32> & hash, std::array<uint8_t, 64> & r_signature) const;
+        // blake2b of the state block preamble and fields, balance is 16 bytes big endian, everything else 32
+        static void hash_state_block(const uint8_t * account, const uint8_t * previous, const uint8_t * representative, const uint8_t * balance, const uint8_t * link, uint8_t * r_hash);
 
         String block_hash(String previous, Ref<NanoAccount> representative, Ref<NanoAmount> balance, String link);    
         String sign(String previous, Ref<NanoAccount> representative, Ref<NanoAmount> balance, String link);
+
+        // Binary versions of the above, for callers that never had hex
+        PoolByteArray block_hash_bytes(PoolByteArray previous, PoolByteArray representative, PoolByteArray balance, PoolByteArray link);
+        PoolByteArray sign_bytes(PoolByteArray hash);
+        PoolByteArray sign_blocks(PoolByteArray hashes); // Packed 32 byte hashes in, packed 64 byte signatures out
+        // One byte per hash, 1 when its signature is valid. public_keys is one key per row, one for all rows, or empty for this account
+        PoolByteArray verify_signatures(PoolByteArray hashes, PoolByteArray signatures, PoolByteArray public_keys = PoolByteArray());
+
+        // Same on NanoJobPool, the results come back on the main thread through blocks_signed and signatures_verified
+        int sign_blocks_async(PoolByteArray hashes);
+        int verify_signatures_async(PoolByteArray hashes, PoolByteArray signatures, PoolByteArray public_keys = PoolByteArray());
+        void _blocks_signed(int task_id, const PoolByteArray & signatures);
+        void _signatures_verified(int task_id, const PoolByteArray & results);
+        // For NanoSender and NanoReceiver: signs on NanoJobPool, then calls method(tag, signatures) on target on the main thread
+        Error sign_hashes_async(const PoolByteArray & hashes, ObjectID target, const StringName & method, int tag) const;
+
+        // Bulk conversion for address books and payout lists, large inputs are split over NanoJobPool
+        Dictionary decode_addresses(PoolStringArray addresses);
+        PoolStringArray encode_addresses(PoolByteArray keys);
 };
 
+VARIANT_ENUM_CAST(NanoAccount::AddressError);
+
 #endif
\ No newline at end of file
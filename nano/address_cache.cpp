@@ -0,0 +1,67 @@
+#include "address_cache.h"
+
+NanoAddressCache * NanoAddressCache::singleton = NULL;
+
+NanoAddressCache::NanoAddressCache() {
+    singleton = this;
+}
+
+NanoAddressCache::~NanoAddressCache() {
+    if(singleton == this) singleton = NULL;
+}
+
+bool NanoAddressCache::lookup_key(const String & address, std::array<uint8_t, 32> & r_key) {
+    MutexLock lock(mutex);
+    List<Entry>::Element ** e = by_address.getptr(address);
+    if(!e) return false;
+    entries.move_to_front(*e);
+    r_key = (*e)->get().key.bytes;
+    return true;
+}
+
+bool NanoAddressCache::lookup_address(const std::array<uint8_t, 32> & key, String & r_address) {
+    nano::uint256_union k;
+    k.bytes = key;
+    MutexLock lock(mutex);
+    List<Entry>::Element ** e = by_key.getptr(k);
+    if(!e) return false;
+    entries.move_to_front(*e);
+    r_address = (*e)->get().address;
+    return true;
+}
+
+void NanoAddressCache::insert(const String & address, const std::array<uint8_t, 32> & key) {
+    MutexLock lock(mutex);
+    if(by_address.has(address)) return;
+    Entry entry;
+    entry.address = address;
+    entry.key.bytes = key;
+    List<Entry>::Element * e = entries.push_front(entry);
+    by_address[address] = e;
+    // Only the canonical form is handed out when encoding, an xrb_ address just resolves to its key
+    if(address.begins_with("nano_") && !by_key.has(entry.key)) by_key[entry.key] = e;
+    evict();
+}
+
+void NanoAddressCache::evict() {
+    while(entries.size() > capacity) {
+        List<Entry>::Element * last = entries.back();
+        by_address.erase(last->get().address);
+        List<Entry>::Element ** e = by_key.getptr(last->get().key);
+        if(e && *e == last) by_key.erase(last->get().key);
+        entries.erase(last);
+    }
+}
+
+void NanoAddressCache::set_capacity(int p_capacity) {
+    MutexLock lock(mutex);
+    capacity = MAX(p_capacity, 0);
+    evict();
+}
+
+void NanoAddressCache::clear() {
+    MutexLock lock(mutex);
+    entries.clear();
+    by_address.clear();
+    by_key.clear();
+}
\ No newline at end of file
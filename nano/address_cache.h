@@ -0,0 +1,50 @@
+#ifndef NANO_ADDRESS_CACHE_H_
+#define NANO_ADDRESS_CACHE_H_
+
+#include "numbers.h"
+
+#include "core/hash_map.h"
+#include "core/list.h"
+#include "core/os/mutex.h"
+#include "core/ustring.h"
+
+#include <array>
+
+// Addresses seen recently and their public keys, so decoding the same representative or counterparty again
+// costs one hash lookup instead of a base32 decode and a blake2b checksum. Encoding a key goes through it as well.
+// Bounded, the least recently used entry makes room. Used by NanoAccount::decode_address and encode_address, from any thread.
+class NanoAddressCache {
+    private:
+        struct Entry {
+            String address;
+            nano::uint256_union key;
+        };
+        struct KeyHasher {
+            static _FORCE_INLINE_ uint32_t hash(const nano::uint256_union & key) { return key.dwords[0]; } // Keys are already uniformly distributed
+        };
+
+        static NanoAddressCache * singleton;
+        Mutex mutex;
+        List<Entry> entries; // Most recently used first
+        HashMap<String, List<Entry>::Element *> by_address;
+        HashMap<nano::uint256_union, List<Entry>::Element *, KeyHasher> by_key;
+        int capacity = 4096;
+
+        void evict();
+
+    public:
+        static NanoAddressCache * get_singleton() { return singleton; }
+
+        bool lookup_key(const String & address, std::array<uint8_t, 32> & r_key);
+        bool lookup_address(const std::array<uint8_t, 32> & key, String & r_address);
+        void insert(const String & address, const std::array<uint8_t, 32> & key);
+
+        void set_capacity(int p_capacity);
+        int get_capacity() const { return capacity; }
+        void clear();
+
+        NanoAddressCache();
+        ~NanoAddressCache();
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,253 @@
+#include "block.h"
+
+#include "work.h"
+
+namespace {
+void write_bytes(uint8_t *& out, const uint8_t * data, size_t size) {
+    memcpy(out, data, size);
+    out += size;
+}
+
+void read_bytes(const uint8_t *& in, uint8_t * data, size_t size) {
+    memcpy(data, in, size);
+    in += size;
+}
+}
+
+NanoBlock::NanoBlock() {
+    account.clear();
+    previous.clear();
+    representative.clear();
+    balance.clear();
+    link.clear();
+    signature.clear();
+}
+
+void NanoBlock::set_fields(const std::array<uint8_t, 32> & p_account, const nano::uint256_union & p_previous, const std::array<uint8_t, 32> & p_representative, const nano::uint128_union & p_balance, const nano::uint256_union & p_link) {
+    account.bytes = p_account;
+    previous = p_previous;
+    representative.bytes = p_representative;
+    balance = p_balance;
+    link = p_link;
+    hash_valid = false;
+}
+
+const nano::uint256_union & NanoBlock::get_hash_bytes() const {
+    if(hash_valid) return hash;
+    NanoAccount::hash_state_block(account.bytes.data(), previous.bytes.data(), representative.bytes.data(), balance.bytes.data(), link.bytes.data(), hash.bytes.data());
+    hash_valid = true;
+    return hash;
+}
+
+void NanoBlock::set_account(String address) {
+    ERR_FAIL_COND_MSG(NanoAccount::decode_address(address, account.bytes), "Invalid account: " + address);
+    hash_valid = false;
+}
+
+String NanoBlock::get_account() const {
+    return NanoAccount::encode_address(account.bytes);
+}
+
+void NanoBlock::set_previous(String hash) {
+    ERR_FAIL_COND_MSG(previous.decode_hex(hash), "Invalid previous: " + hash);
+    hash_valid = false;
+}
+
+void NanoBlock::set_representative(String address) {
+    ERR_FAIL_COND_MSG(NanoAccount::decode_address(address, representative.bytes), "Invalid representative: " + address);
+    hash_valid = false;
+}
+
+String NanoBlock::get_representative() const {
+    return NanoAccount::encode_address(representative.bytes);
+}
+
+void NanoBlock::set_balance(String raw) {
+    ERR_FAIL_COND_MSG(balance.decode_dec(raw), "Invalid balance: " + raw);
+    hash_valid = false;
+}
+
+void NanoBlock::set_link(String p_link) {
+    // The link is a block hash for receives and an account for sends, both are accepted
+    if(p_link.begins_with("nano_") || p_link.begins_with("xrb_")) {
+        ERR_FAIL_COND_MSG(NanoAccount::decode_address(p_link, link.bytes), "Invalid link: " + p_link);
+    } else {
+        ERR_FAIL_COND_MSG(link.decode_hex(p_link), "Invalid link: " + p_link);
+    }
+    hash_valid = false;
+}
+
+String NanoBlock::get_link_as_account() const {
+    return NanoAccount::encode_address(link.bytes);
+}
+
+void NanoBlock::set_signature(String p_signature) {
+    ERR_FAIL_COND_MSG(signature.decode_hex(p_signature), "Invalid signature: " + p_signature);
+}
+
+void NanoBlock::set_work(String p_work) {
+    uint64_t value;
+    ERR_FAIL_COND_MSG(!nano_work_parse_u64(p_work, value), "Invalid work: " + p_work);
+    work = value;
+}
+
+String NanoBlock::get_work() const {
+    return work ? nano_work_to_hex(work) : String();
+}
+
+Error NanoBlock::sign(Ref<NanoAccount> signer) {
+    ERR_FAIL_COND_V(signer.is_null(), ERR_INVALID_PARAMETER);
+    ERR_FAIL_COND_V_MSG(!signer->has_private_key(), ERR_UNCONFIGURED, "Account has no private key");
+    if(account.is_zero()) account.bytes = signer->get_public_key_bytes();
+    ERR_FAIL_COND_V_MSG(account.bytes != signer->get_public_key_bytes(), ERR_INVALID_PARAMETER, "Block belongs to a different account than the signer");
+    hash_valid = false;
+    signer->sign_hash(get_hash_bytes().bytes, signature.bytes);
+    return OK;
+}
+
+Error NanoBlock::sign_async(Ref<NanoAccount> signer, ObjectID target, const StringName & method, int tag) {
+    ERR_FAIL_COND_V(signer.is_null(), ERR_INVALID_PARAMETER);
+    ERR_FAIL_COND_V_MSG(!signer->has_private_key(), ERR_UNCONFIGURED, "Account has no private key");
+    if(account.is_zero()) account.bytes = signer->get_public_key_bytes();
+    ERR_FAIL_COND_V_MSG(account.bytes != signer->get_public_key_bytes(), ERR_INVALID_PARAMETER, "Block belongs to a different account than the signer");
+    hash_valid = false;
+    PoolByteArray hash_bytes;
+    hash_bytes.resize(32);
+    memcpy(hash_bytes.write().ptr(), get_hash_bytes().bytes.data(), 32);
+    return signer->sign_hashes_async(hash_bytes, target, method, tag);
+}
+
+void NanoBlock::set_signature_bytes(const PoolByteArray & p_signature) {
+    ERR_FAIL_COND_MSG(p_signature.size() != 64, "A signature is 64 bytes");
+    memcpy(signature.bytes.data(), p_signature.read().ptr(), 64);
+}
+
+void NanoBlock::serialize_to(uint8_t * out) const {
+    write_bytes(out, account.bytes.data(), 32);
+    write_bytes(out, previous.bytes.data(), 32);
+    write_bytes(out, representative.bytes.data(), 32);
+    write_bytes(out, balance.bytes.data(), 16);
+    write_bytes(out, link.bytes.data(), 32);
+    write_bytes(out, signature.bytes.data(), 64);
+    for(int i = 7; i >= 0; i--) // Big endian, as state blocks are on the wire
+        *out++ = (work >> (i * 8)) & 0xff;
+}
+
+void NanoBlock::deserialize_from(const uint8_t * in) {
+    read_bytes(in, account.bytes.data(), 32);
+    read_bytes(in, previous.bytes.data(), 32);
+    read_bytes(in, representative.bytes.data(), 32);
+    read_bytes(in, balance.bytes.data(), 16);
+    read_bytes(in, link.bytes.data(), 32);
+    read_bytes(in, signature.bytes.data(), 64);
+    work = 0;
+    for(int i = 0; i < 8; i++)
+        work = (work << 8) | *in++;
+    hash_valid = false;
+}
+
+PoolByteArray NanoBlock::serialize() const {
+    PoolByteArray data;
+    data.resize(SERIALIZED_SIZE);
+    serialize_to(data.write().ptr());
+    return data;
+}
+
+Error NanoBlock::deserialize(const PoolByteArray & data) {
+    ERR_FAIL_COND_V_MSG(data.size() != SERIALIZED_SIZE, ERR_INVALID_DATA, "A serialized block is " + itos(SERIALIZED_SIZE) + " bytes, got " + itos(data.size()));
+    deserialize_from(data.read().ptr());
+    return OK;
+}
+
+void NanoBlock::write_json(NanoJsonWriter & writer, const char * key) const {
+    writer.begin_object(key);
+    writer.string("account", get_account());
+    writer.string("balance", get_balance());
+    writer.string("link", get_link());
+    writer.string("previous", get_previous());
+    writer.string("representative", get_representative());
+    writer.string("signature", get_signature());
+    writer.string("type", "state");
+    if(work) writer.string("work", get_work());
+    writer.end_object();
+}
+
+Dictionary NanoBlock::to_json() const {
+    Dictionary json;
+    json["type"] = "state";
+    json["account"] = get_account();
+    json["previous"] = get_previous();
+    json["representative"] = get_representative();
+    json["balance"] = get_balance();
+    json["link"] = get_link();
+    json["signature"] = get_signature();
+    if(work) json["work"] = get_work();
+    return json;
+}
+
+Error NanoBlock::from_json(Dictionary json) {
+    String type = json.get("type", "state");
+    ERR_FAIL_COND_V_MSG(type != "state", ERR_INVALID_DATA, "Only state blocks are supported, got " + type);
+
+    nano::uint256_union new_account, new_previous, new_representative, new_link;
+    nano::uint128_union new_balance;
+    nano::uint512_union new_signature;
+    new_signature.clear();
+    uint64_t new_work = 0;
+    String previous_hex = json.get("previous", "0");
+    String link_hex = json.get("link", "0");
+    String signature_hex = json.get("signature", "");
+    String work_hex = json.get("work", "");
+    ERR_FAIL_COND_V(NanoAccount::decode_address(json.get("account", ""), new_account.bytes), ERR_INVALID_DATA);
+    ERR_FAIL_COND_V(NanoAccount::decode_address(json.get("representative", ""), new_representative.bytes), ERR_INVALID_DATA);
+    ERR_FAIL_COND_V(new_previous.decode_hex(previous_hex), ERR_INVALID_DATA);
+    ERR_FAIL_COND_V(new_link.decode_hex(link_hex), ERR_INVALID_DATA);
+    ERR_FAIL_COND_V(new_balance.decode_dec(json.get("balance", "")), ERR_INVALID_DATA);
+    ERR_FAIL_COND_V(!signature_hex.empty() && new_signature.decode_hex(signature_hex), ERR_INVALID_DATA);
+    ERR_FAIL_COND_V(!work_hex.empty() && !nano_work_parse_u64(work_hex, new_work), ERR_INVALID_DATA);
+
+    account = new_account;
+    previous = new_previous;
+    representative = new_representative;
+    link = new_link;
+    balance = new_balance;
+    signature = new_signature;
+    work = new_work;
+    hash_valid = false;
+    return OK;
+}
+
+void NanoBlock::_bind_methods() {
+    ClassDB::bind_method(D_METHOD("set_account", "address"), &NanoBlock::set_account);
+    ClassDB::bind_method(D_METHOD("get_account"), &NanoBlock::get_account);
+    ClassDB::bind_method(D_METHOD("set_previous", "hash"), &NanoBlock::set_previous);
+    ClassDB::bind_method(D_METHOD("get_previous"), &NanoBlock::get_previous);
+    ClassDB::bind_method(D_METHOD("set_representative", "address"), &NanoBlock::set_representative);
+    ClassDB::bind_method(D_METHOD("get_representative"), &NanoBlock::get_representative);
+    ClassDB::bind_method(D_METHOD("set_balance", "raw"), &NanoBlock::set_balance);
+    ClassDB::bind_method(D_METHOD("get_balance"), &NanoBlock::get_balance);
+    ClassDB::bind_method(D_METHOD("set_link", "link"), &NanoBlock::set_link);
+    ClassDB::bind_method(D_METHOD("get_link"), &NanoBlock::get_link);
+    ClassDB::bind_method(D_METHOD("get_link_as_account"), &NanoBlock::get_link_as_account);
+    ClassDB::bind_method(D_METHOD("set_signature", "signature"), &NanoBlock::set_signature);
+    ClassDB::bind_method(D_METHOD("get_signature"), &NanoBlock::get_signature);
+    ClassDB::bind_method(D_METHOD("set_work", "work"), &NanoBlock::set_work);
+    ClassDB::bind_method(D_METHOD("get_work"), &NanoBlock::get_work);
+    ADD_PROPERTY(PropertyInfo(Variant::STRING, "account"), "set_account", "get_account");
+    ADD_PROPERTY(PropertyInfo(Variant::STRING, "previous"), "set_previous", "get_previous");
+    ADD_PROPERTY(PropertyInfo(Variant::STRING, "representative"), "set_representative", "get_representative");
+    ADD_PROPERTY(PropertyInfo(Variant::STRING, "balance"), "set_balance", "get_balance");
+    ADD_PROPERTY(PropertyInfo(Variant::STRING, "link"), "set_link", "get_link");
+    ADD_PROPERTY(PropertyInfo(Variant::STRING, "signature"), "set_signature", "get_signature");
+    ADD_PROPERTY(PropertyInfo(Variant::STRING, "work"), "set_work", "get_work");
+
+    ClassDB::bind_method(D_METHOD("get_hash"), &NanoBlock::get_hash);
+    ClassDB::bind_method(D_METHOD("is_open"), &NanoBlock::is_open);
+    ClassDB::bind_method(D_METHOD("sign", "signer"), &NanoBlock::sign);
+    ClassDB::bind_method(D_METHOD("serialize"), &NanoBlock::serialize);
+    ClassDB::bind_method(D_METHOD("deserialize", "data"), &NanoBlock::deserialize);
+    ClassDB::bind_method(D_METHOD("to_json"), &NanoBlock::to_json);
+    ClassDB::bind_method(D_METHOD("from_json", "json"), &NanoBlock::from_json);
+
+    BIND_CONSTANT(SERIALIZED_SIZE);
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#ifndef NANO_BLOCK_H_
+#define NANO_BLOCK_H_
+
+#include "account.h"
+#include "amount.h"
+#include "json_writer.h"
+#include "numbers.h"
+
+#include "core/reference.h"
+
+// A state block kept in binary form, the 216 bytes the network hashes and signs plus nothing else.
+// The hash is computed once and cached until a field changes. JSON is only produced when the block is sent.
+class NanoBlock : public Reference {
+    GDCLASS(NanoBlock, Reference);
+
+    public:
+        enum { SERIALIZED_SIZE = 216 }; // account, previous, representative, balance, link, signature, work
+
+    private:
+        nano::uint256_union account;
+        nano::uint256_union previous;
+        nano::uint256_union representative;
+        nano::uint128_union balance;
+        nano::uint256_union link;
+        nano::uint512_union signature;
+        uint64_t work = 0;
+
+        mutable nano::uint256_union hash;
+        mutable bool hash_valid = false;
+
+    protected:
+        static void _bind_methods();
+    public:
+        // Fast paths for callers that already hold the binary values
+        void set_fields(const std::array<uint8_t, 32> & account, const nano::uint256_union & previous, const std::array<uint8_t, 32> & representative, const nano::uint128_union & balance, const nano::uint256_union & link);
+        const nano::uint256_union & get_hash_bytes() const;
+        const nano::uint256_union & get_account_bytes() const { return account; }
+        const nano::uint256_union & get_previous_bytes() const { return previous; }
+        const nano::uint128_union & get_balance_bytes() const { return balance; }
+        uint64_t get_work_value() const { return work; }
+        void write_json(NanoJsonWriter & writer, const char * key) const;
+        // Raw SERIALIZED_SIZE byte layout, for callers that store blocks in their own buffers
+        void serialize_to(uint8_t * out) const;
+        void deserialize_from(const uint8_t * in);
+
+        void set_account(String address);
+        String get_account() const;
+        void set_previous(String hash);
+        String get_previous() const { return previous.to_string(); }
+        void set_representative(String address);
+        String get_representative() const;
+        void set_balance(String raw);
+        String get_balance() const { return balance.to_string_dec(); }
+        void set_link(String link);
+        String get_link() const { return link.to_string(); }
+        String get_link_as_account() const;
+        void set_signature(String signature);
+        String get_signature() const { return signature.to_string(); }
+        void set_work(String work);
+        String get_work() const;
+
+        String get_hash() const { return get_hash_bytes().to_string(); }
+        bool is_open() const { return previous.is_zero(); }
+        Error sign(Ref<NanoAccount> signer);
+        // Signs on NanoJobPool, method(tag, signature) is then called on target from the main thread
+        Error sign_async(Ref<NanoAccount> signer, ObjectID target, const StringName & method, int tag);
+        void set_signature_bytes(const PoolByteArray & p_signature);
+
+        PoolByteArray serialize() const;
+        Error deserialize(const PoolByteArray & data);
+        Dictionary to_json() const;
+        Error from_json(Dictionary json);
+
+        NanoBlock();
+};
+
+#endif
\ No newline at end of file
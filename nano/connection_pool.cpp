@@ -0,0 +1,361 @@
+#include "connection_pool.h"
+
+#include "scheduler.h"
+
+#include "core/engine.h"
+#include "core/os/os.h"
+#include "scene/main/http_request.h"
+
+NanoConnectionPool * NanoConnectionPool::singleton = NULL;
+
+Error NanoEndpoint::parse(const String & url, bool verify_host, NanoEndpoint & r_endpoint) {
+    String rest = url.strip_edges();
+    NanoEndpoint endpoint;
+    endpoint.verify_host = verify_host;
+
+    if(rest.begins_with("https://")) {
+        endpoint.ssl = true;
+        endpoint.port = 443;
+        rest = rest.substr(8);
+    } else if(rest.begins_with("http://")) {
+        rest = rest.substr(7);
+    } else if(rest.find("://") != -1) {
+        ERR_FAIL_V_MSG(ERR_INVALID_PARAMETER, "Unsupported url scheme: " + url);
+    }
+
+    int slash = rest.find("/");
+    String host = (slash == -1) ? rest : rest.substr(0, slash);
+    if(slash != -1) endpoint.path = rest.substr(slash);
+
+    int colon = host.find_last(":");
+    if(colon != -1 && colon > host.find_last("]")) {
+        String port = host.substr(colon + 1);
+        ERR_FAIL_COND_V_MSG(!port.is_valid_integer(), ERR_INVALID_PARAMETER, "Invalid port in url: " + url);
+        endpoint.port = port.to_int();
+        host = host.substr(0, colon);
+    }
+    if(host.begins_with("[") && host.ends_with("]")) host = host.substr(1, host.length() - 2);
+    ERR_FAIL_COND_V_MSG(host.empty(), ERR_INVALID_PARAMETER, "Invalid url: " + url);
+
+    endpoint.host = host;
+    r_endpoint = endpoint;
+    return OK;
+}
+
+NanoConnectionPool::NanoConnectionPool() {
+    singleton = this;
+}
+
+NanoConnectionPool::~NanoConnectionPool() {
+    clear();
+    if(singleton == this) singleton = NULL;
+}
+
+Ref<HTTPClient> NanoConnectionPool::open(const NanoEndpoint & endpoint) {
+    Ref<HTTPClient> client;
+    client.instance();
+    client->set_blocking_mode(false);
+    client->set_read_chunk_size(65536);
+    Error err = client->connect_to_host(endpoint.host, endpoint.port, endpoint.ssl, endpoint.verify_host);
+    ERR_FAIL_COND_V_MSG(err, Ref<HTTPClient>(), "Could not start connection to " + endpoint.get_key());
+    return client;
+}
+
+Ref<HTTPClient> NanoConnectionPool::acquire(const NanoEndpoint & endpoint, bool & r_reused, bool p_fresh) {
+    r_reused = false;
+    Map<String, List<IdleConnection> >::Element * e = idle.find(endpoint.get_key());
+    if(e && !p_fresh) {
+        List<IdleConnection> & connections = e->get();
+        poll_endpoint(connections, OS::get_singleton()->get_ticks_msec());
+
+        // Prefer a connection that is already established over one still handshaking
+        for(List<IdleConnection>::Element * c = connections.front(); c; c = c->next()) {
+            if(c->get().client->get_status() != HTTPClient::STATUS_CONNECTED) continue;
+            Ref<HTTPClient> client = c->get().client;
+            connections.erase(c);
+            r_reused = true;
+            return client;
+        }
+        if(!connections.empty()) {
+            Ref<HTTPClient> client = connections.front()->get().client;
+            connections.pop_front();
+            return client;
+        }
+    }
+    return open(endpoint);
+}
+
+void NanoConnectionPool::release(const NanoEndpoint & endpoint, Ref<HTTPClient> client) {
+    if(client.is_null()) return;
+    if(client->get_status() != HTTPClient::STATUS_CONNECTED) {
+        client->close();
+        return;
+    }
+
+    List<IdleConnection> & connections = idle[endpoint.get_key()];
+    if(connections.size() >= max_idle_per_endpoint) {
+        client->close();
+        return;
+    }
+    IdleConnection c;
+    c.client = client;
+    c.since_msec = OS::get_singleton()->get_ticks_msec();
+    connections.push_back(c);
+}
+
+void NanoConnectionPool::preconnect(const NanoEndpoint & endpoint) {
+    if(!endpoint.is_valid() || max_idle_per_endpoint == 0) return;
+    List<IdleConnection> & connections = idle[endpoint.get_key()];
+    if(!connections.empty()) return; // One warm connection is enough, more are kept as requests release them
+
+    IdleConnection c;
+    c.client = open(endpoint);
+    c.since_msec = OS::get_singleton()->get_ticks_msec();
+    if(c.client.is_valid()) connections.push_back(c);
+}
+
+void NanoConnectionPool::poll_endpoint(List<IdleConnection> & connections, uint64_t now) {
+    List<IdleConnection>::Element * c = connections.front();
+    while(c) {
+        List<IdleConnection>::Element * next = c->next();
+        Ref<HTTPClient> client = c->get().client;
+        client->poll();
+        HTTPClient::Status status = client->get_status();
+        bool handshaking = status == HTTPClient::STATUS_RESOLVING || status == HTTPClient::STATUS_CONNECTING;
+        bool alive = status == HTTPClient::STATUS_CONNECTED && now - c->get().since_msec < idle_timeout_msec;
+        if(!handshaking && !alive) {
+            client->close();
+            connections.erase(c);
+        }
+        c = next;
+    }
+}
+
+void NanoConnectionPool::poll() {
+    uint64_t frame = Engine::get_singleton()->get_idle_frames();
+    if(frame == last_poll_frame) return;
+    last_poll_frame = frame;
+
+    uint64_t now = OS::get_singleton()->get_ticks_msec();
+    for(Map<String, List<IdleConnection> >::Element * e = idle.front(); e; e = e->next())
+        poll_endpoint(e->get(), now);
+}
+
+bool NanoConnectionPool::is_handshaking() const {
+    for(const Map<String, List<IdleConnection> >::Element * e = idle.front(); e; e = e->next()) {
+        for(const List<IdleConnection>::Element * c = e->get().front(); c; c = c->next()) {
+            HTTPClient::Status status = c->get().client->get_status();
+            if(status == HTTPClient::STATUS_RESOLVING || status == HTTPClient::STATUS_CONNECTING) return true;
+        }
+    }
+    return false;
+}
+
+void NanoConnectionPool::clear() {
+    for(Map<String, List<IdleConnection> >::Element * e = idle.front(); e; e = e->next()) {
+        for(List<IdleConnection>::Element * c = e->get().front(); c; c = c->next())
+            c->get().client->close();
+    }
+    idle.clear();
+}
+
+Error NanoHttpExchange::start(const NanoEndpoint & p_endpoint, const Vector<String> & p_headers, const PoolByteArray & p_body, int p_priority) {
+    ERR_FAIL_COND_V(stage != STAGE_IDLE && stage != STAGE_DONE, ERR_BUSY);
+    ERR_FAIL_COND_V(!p_endpoint.is_valid(), ERR_UNCONFIGURED);
+    ERR_FAIL_COND_V(!NanoConnectionPool::get_singleton(), ERR_UNCONFIGURED);
+    ERR_FAIL_COND_V(!NanoScheduler::get_singleton(), ERR_UNCONFIGURED);
+
+    endpoint = p_endpoint;
+    headers = p_headers;
+    request_body = p_body;
+    priority = p_priority;
+    throttled = 0;
+    retried = false;
+    keep_alive = true;
+    expected_length = -1;
+    body_length = 0;
+    result = HTTPRequest::RESULT_SUCCESS;
+    response_code = 0;
+    response_headers = PoolStringArray();
+    response_body = PoolByteArray();
+    start_usec = 0;
+    end_usec = 0;
+
+    if(NanoScheduler::get_singleton()->admit(endpoint.get_key(), priority, ticket)) dispatch();
+    else stage = STAGE_QUEUED;
+    return OK;
+}
+
+void NanoHttpExchange::dispatch() {
+    ticket = 0;
+    start_usec = OS::get_singleton()->get_ticks_usec();
+    connect_client();
+}
+
+void NanoHttpExchange::connect_client() {
+    client = NanoConnectionPool::get_singleton()->acquire(endpoint, reused, retried);
+    stage = STAGE_CONNECTING;
+}
+
+bool NanoHttpExchange::send_request() {
+    return client->request_raw(HTTPClient::METHOD_POST, endpoint.path, headers, request_body) == OK;
+}
+
+bool NanoHttpExchange::read_response_headers() {
+    response_code = client->get_response_code();
+    expected_length = client->get_response_body_length();
+
+    List<String> rheaders;
+    client->get_response_headers(&rheaders);
+    for(List<String>::Element * h = rheaders.front(); h; h = h->next()) {
+        response_headers.push_back(h->get());
+        String header = h->get().to_lower();
+        if(header.begins_with("connection:") && header.find("close") != -1) keep_alive = false;
+    }
+    return true;
+}
+
+bool NanoHttpExchange::poll() {
+    if(stage == STAGE_DONE) return true;
+    if(stage == STAGE_IDLE) return false;
+    if(stage == STAGE_QUEUED) {
+        if(!NanoScheduler::get_singleton()->try_dispatch(endpoint.get_key(), priority, ticket)) return false;
+        dispatch();
+    }
+    if(client.is_null()) return finish(HTTPRequest::RESULT_CANT_CONNECT);
+
+    client->poll();
+    HTTPClient::Status status = client->get_status();
+
+    if(stage == STAGE_CONNECTING) {
+        switch(status) {
+            case HTTPClient::STATUS_RESOLVING:
+            case HTTPClient::STATUS_CONNECTING:
+                return false;
+            case HTTPClient::STATUS_CONNECTED:
+                if(!send_request()) return retry_or_fail(HTTPRequest::RESULT_CONNECTION_ERROR);
+                stage = STAGE_REQUESTING;
+                return false;
+            case HTTPClient::STATUS_CANT_RESOLVE:
+                return finish(HTTPRequest::RESULT_CANT_RESOLVE);
+            case HTTPClient::STATUS_SSL_HANDSHAKE_ERROR:
+                return finish(HTTPRequest::RESULT_SSL_HANDSHAKE_ERROR);
+            default:
+                return retry_or_fail(HTTPRequest::RESULT_CANT_CONNECT);
+        }
+    }
+
+    if(stage == STAGE_REQUESTING) {
+        if(status == HTTPClient::STATUS_REQUESTING) return false;
+        if(status != HTTPClient::STATUS_BODY && status != HTTPClient::STATUS_CONNECTED)
+            return retry_or_fail(HTTPRequest::RESULT_CONNECTION_ERROR);
+        if(!client->has_response())
+            return retry_or_fail(HTTPRequest::RESULT_NO_RESPONSE);
+
+        read_response_headers();
+        reused = false; // A response arrived, so the connection was not stale
+        if(response_code == 429 && throttled < MAX_THROTTLED) return requeue_throttled();
+        stage = STAGE_BODY;
+        if(status == HTTPClient::STATUS_CONNECTED) return finish(HTTPRequest::RESULT_SUCCESS);
+    }
+
+    // Read everything that has arrived instead of one chunk per frame
+    while(client->get_status() == HTTPClient::STATUS_BODY) {
+        PoolByteArray chunk = client->read_response_body_chunk();
+        if(chunk.size() == 0) break;
+        body_length += chunk.size();
+        if(body_sink && response_code == 200) body_sink->write_body(chunk.read().ptr(), chunk.size());
+        else response_body.append_array(chunk);
+    }
+
+    switch(client->get_status()) {
+        case HTTPClient::STATUS_BODY:
+            return false;
+        case HTTPClient::STATUS_CONNECTED:
+            return finish(HTTPRequest::RESULT_SUCCESS);
+        case HTTPClient::STATUS_DISCONNECTED: // Body without a length, read until the server closed the connection
+            keep_alive = false;
+            if(expected_length >= 0 && body_length != expected_length) return finish(HTTPRequest::RESULT_CONNECTION_ERROR);
+            return finish(HTTPRequest::RESULT_SUCCESS);
+        default:
+            return finish(HTTPRequest::RESULT_CONNECTION_ERROR);
+    }
+}
+
+bool NanoHttpExchange::retry_or_fail(int p_result) {
+    if(reused && !retried) {
+        // An idle keep-alive connection can be closed by the server, which only shows once it is used again.
+        // Nothing was answered yet, so the request goes out once more on a new connection.
+        retried = true;
+        client->close();
+        connect_client();
+        return false;
+    }
+    return finish(p_result);
+}
+
+bool NanoHttpExchange::requeue_throttled() {
+    // The node is rate limiting, wait as long as it asks and go again instead of failing
+    uint64_t delay_msec = 1000;
+    for(int i = 0; i < response_headers.size(); i++) {
+        String header = response_headers[i].to_lower();
+        if(!header.begins_with("retry-after:")) continue;
+        String seconds = header.substr(12).strip_edges();
+        if(seconds.is_valid_integer()) delay_msec = CLAMP(seconds.to_int(), 0, 60) * 1000;
+    }
+    NanoScheduler::get_singleton()->throttle(endpoint.get_key(), delay_msec);
+
+    throttled++;
+    client->close();
+    client.unref();
+    keep_alive = true;
+    expected_length = -1;
+    response_code = 0;
+    response_headers = PoolStringArray();
+    start_usec = 0;
+    NanoScheduler::get_singleton()->admit(endpoint.get_key(), priority, ticket);
+    stage = STAGE_QUEUED;
+    return false;
+}
+
+bool NanoHttpExchange::finish(int p_result) {
+    result = p_result;
+    end_usec = OS::get_singleton()->get_ticks_usec();
+    stage = STAGE_DONE;
+
+    if(client.is_valid()) {
+        if(p_result == HTTPRequest::RESULT_SUCCESS && keep_alive) NanoConnectionPool::get_singleton()->release(endpoint, client);
+        else client->close();
+        client.unref();
+    }
+    return true;
+}
+
+void NanoHttpExchange::cancel() {
+    if(stage == STAGE_QUEUED) NanoScheduler::get_singleton()->cancel(endpoint.get_key(), ticket);
+    if(client.is_valid()) {
+        client->close();
+        client.unref();
+    }
+    stage = STAGE_IDLE;
+}
+
+void NanoHttpExchange::expire() {
+    if(stage == STAGE_QUEUED) NanoScheduler::get_singleton()->cancel(endpoint.get_key(), ticket);
+    if(stage != STAGE_DONE) finish(HTTPRequest::RESULT_TIMEOUT);
+}
+
+NanoResponse NanoHttpExchange::get_response() const {
+    NanoResponse response;
+    response.result = result;
+    response.response_code = response_code;
+    response.headers = response_headers;
+    response.body = response_body;
+    return response;
+}
+
+uint64_t NanoHttpExchange::get_elapsed_usec() const {
+    if(!start_usec) return 0;
+    uint64_t end = end_usec ? end_usec : OS::get_singleton()->get_ticks_usec();
+    return end - start_usec;
+}
\ No newline at end of file
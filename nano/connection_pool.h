@@ -0,0 +1,134 @@
+#ifndef NANO_CONNECTION_POOL_H_
+#define NANO_CONNECTION_POOL_H_
+
+#include "core/io/http_client.h"
+#include "core/list.h"
+#include "core/map.h"
+
+// Where a request is sent. Connections are pooled per (host, port, ssl).
+struct NanoEndpoint {
+    String host;
+    int port = 80;
+    bool ssl = false;
+    bool verify_host = true;
+    String path = "/";
+
+    String get_key() const { return host + ":" + itos(port) + (ssl ? ":ssl" : ""); }
+    bool is_valid() const { return !host.empty(); }
+    static Error parse(const String & url, bool verify_host, NanoEndpoint & r_endpoint);
+};
+
+// Keeps HTTP/1.1 connections alive between requests, so a send doesn't pay a TCP (and TLS) handshake per RPC.
+// There is one pool shared by every NanoRequest, created in register_nano_types.
+class NanoConnectionPool {
+    private:
+        struct IdleConnection {
+            Ref<HTTPClient> client;
+            uint64_t since_msec;
+        };
+
+        static NanoConnectionPool * singleton;
+        Map<String, List<IdleConnection> > idle;
+        uint64_t last_poll_frame = UINT64_MAX;
+
+        int max_idle_per_endpoint = 8;
+        uint64_t idle_timeout_msec = 20000;
+
+        Ref<HTTPClient> open(const NanoEndpoint & endpoint);
+        void poll_endpoint(List<IdleConnection> & connections, uint64_t now);
+
+    public:
+        static NanoConnectionPool * get_singleton() { return singleton; }
+
+        // Returns a connected (or still connecting) client, r_reused is set when it came out of the pool.
+        // p_fresh skips the pool, for when a pooled connection turned out to be closed by the server.
+        Ref<HTTPClient> acquire(const NanoEndpoint & endpoint, bool & r_reused, bool p_fresh = false);
+        void release(const NanoEndpoint & endpoint, Ref<HTTPClient> client);
+        void preconnect(const NanoEndpoint & endpoint);
+        void poll(); // Drives handshakes of preconnected clients and expires idle ones, at most once per frame
+        bool is_handshaking() const; // A preconnected client still needs poll to get to STATUS_CONNECTED
+        void clear();
+
+        void set_max_idle_per_endpoint(int max) { max_idle_per_endpoint = MAX(max, 0); }
+        void set_idle_timeout_msec(uint64_t msec) { idle_timeout_msec = msec; }
+
+        NanoConnectionPool();
+        ~NanoConnectionPool();
+};
+
+// What a finished request produced, detached from the connection it came over.
+struct NanoResponse {
+    int result = 0;
+    int response_code = 0;
+    PoolStringArray headers;
+    PoolByteArray body;
+};
+
+// Receives a response body as it arrives, instead of it being collected in the exchange.
+class NanoBodySink {
+    public:
+        virtual void write_body(const uint8_t * data, int size) = 0;
+        virtual ~NanoBodySink() {}
+};
+
+// One request and response on a pooled connection, driven by poll() from the owner's process notification.
+// Results use the HTTPRequest::Result codes, so callers can keep the request_completed signal semantics.
+// Requests wait in STAGE_QUEUED while NanoScheduler holds them back, a 429 answer puts them back in the queue.
+class NanoHttpExchange {
+    public:
+        enum Stage { STAGE_IDLE, STAGE_QUEUED, STAGE_CONNECTING, STAGE_REQUESTING, STAGE_BODY, STAGE_DONE };
+
+    private:
+        enum { MAX_THROTTLED = 3 }; // 429 answers a request waits out before it fails with the last one
+
+        NanoEndpoint endpoint;
+        Vector<String> headers;
+        PoolByteArray request_body;
+
+        Ref<HTTPClient> client;
+        Stage stage = STAGE_IDLE;
+        bool reused = false;
+        bool retried = false;
+        bool keep_alive = true;
+        int expected_length = -1;
+        int body_length = 0;
+        int priority = 0;
+        uint64_t ticket = 0;
+        int throttled = 0;
+        NanoBodySink * body_sink = NULL;
+
+        int result = 0;
+        int response_code = 0;
+        PoolStringArray response_headers;
+        PoolByteArray response_body;
+        uint64_t start_usec = 0;
+        uint64_t end_usec = 0;
+
+        void dispatch();
+        void connect_client();
+        bool requeue_throttled();
+        bool send_request();
+        bool read_response_headers();
+        bool retry_or_fail(int p_result);
+        bool finish(int p_result);
+
+    public:
+        Error start(const NanoEndpoint & p_endpoint, const Vector<String> & p_headers, const PoolByteArray & p_body, int p_priority = 0);
+        bool poll(); // Returns true once the exchange has finished, successfully or not
+        // Successful (200) bodies go to the sink chunk by chunk and get_response_body stays empty. Not owned.
+        void set_body_sink(NanoBodySink * sink) { body_sink = sink; }
+        void cancel();
+        void expire(); // Gives up on the exchange, reported as a timeout
+
+        Stage get_stage() const { return stage; }
+        bool is_done() const { return stage == STAGE_DONE; }
+        const NanoEndpoint & get_endpoint() const { return endpoint; }
+        int get_result() const { return result; }
+        int get_response_code() const { return response_code; }
+        const PoolStringArray & get_response_headers() const { return response_headers; }
+        const PoolByteArray & get_response_body() const { return response_body; }
+        uint64_t get_elapsed_usec() const; // Counted from when the request left the queue
+        NanoResponse get_response() const;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "job_pool.h"
+
+#include "core/os/os.h"
+
+NanoJobPool * NanoJobPool::singleton = NULL;
+
+namespace {
+class RangeJob : public NanoJob {
+    private:
+        void (*work)(void *, int, int);
+        void * data;
+        int from;
+        int to;
+        std::atomic<int> * remaining;
+
+    public:
+        void run() {
+            work(data, from, to);
+            remaining->fetch_sub(1); // The waiting caller may return right after this, remaining isn't touched again
+        }
+
+        RangeJob(void (*p_work)(void *, int, int), void * p_data, int p_from, int p_to, std::atomic<int> * p_remaining) :
+            work(p_work), data(p_data), from(p_from), to(p_to), remaining(p_remaining) {
+            group = p_remaining;
+        }
+};
+}
+
+NanoJobPool::NanoJobPool() {
+    singleton = this;
+    exiting = false;
+    next_worker = 0;
+
+    // The main thread keeps a core for itself
+    int count = MAX(OS::get_singleton()->get_processor_count() - 1, 1);
+    for(int i = 0; i < count; i++) {
+        Worker * worker = memnew(Worker);
+        worker->pool = this;
+        worker->index = i;
+        workers.push_back(worker);
+    }
+    for(size_t i = 0; i < workers.size(); i++)
+        workers[i]->thread.start(worker_func, workers[i]);
+}
+
+NanoJobPool::~NanoJobPool() {
+    exiting = true;
+    for(size_t i = 0; i < workers.size(); i++)
+        semaphore.post();
+    for(size_t i = 0; i < workers.size(); i++)
+        workers[i]->thread.wait_to_finish();
+    for(size_t i = 0; i < workers.size(); i++) {
+        for(size_t j = 0; j < workers[i]->jobs.size(); j++)
+            memdelete(workers[i]->jobs[j]);
+        memdelete(workers[i]);
+    }
+    workers.clear();
+    if(singleton == this) singleton = NULL;
+}
+
+void NanoJobPool::worker_func(void * p_userdata) {
+    Worker * worker = static_cast<Worker *>(p_userdata);
+    NanoJobPool * pool = worker->pool;
+    while(true) {
+        pool->semaphore.wait();
+        if(pool->exiting) return;
+        // A helping caller may have taken the job this post was for, that is fine
+        pool->run_one(worker->index);
+    }
+}
+
+NanoJob * NanoJobPool::take(int preferred, const void * group) {
+    for(size_t n = 0; n < workers.size(); n++) {
+        Worker * worker = workers[(preferred + n) % workers.size()];
+        MutexLock lock(worker->mutex);
+        if(worker->jobs.empty()) continue;
+        if(!group) {
+            NanoJob * job;
+            if(n == 0) {
+                job = worker->jobs.front();
+                worker->jobs.pop_front();
+            } else {
+                job = worker->jobs.back();
+                worker->jobs.pop_back();
+            }
+            return job;
+        }
+        for(std::deque<NanoJob *>::iterator it = worker->jobs.begin(); it != worker->jobs.end(); ++it) {
+            if((*it)->group != group) continue;
+            NanoJob * job = *it;
+            worker->jobs.erase(it);
+            return job;
+        }
+    }
+    return NULL;
+}
+
+bool NanoJobPool::run_one(int preferred, const void * group) {
+    NanoJob * job = take(preferred, group);
+    if(!job) return false;
+    job->run();
+    memdelete(job);
+    return true;
+}
+
+void NanoJobPool::submit(NanoJob * job) {
+    ERR_FAIL_NULL(job);
+    Worker * worker = workers[next_worker.fetch_add(1) % workers.size()];
+    {
+        MutexLock lock(worker->mutex);
+        worker->jobs.push_back(job);
+    }
+    semaphore.post();
+}
+
+void NanoJobPool::parallel_for(int count, int min_slice, void (*work)(void *, int, int), void * data) {
+    if(count <= 0) return;
+    int slices = CLAMP(count / MAX(min_slice, 1), 1, (int)workers.size() + 1);
+    if(slices == 1) {
+        work(data, 0, count);
+        return;
+    }
+
+    int per_slice = (count + slices - 1) / slices;
+    std::atomic<int> remaining(slices - 1);
+    for(int i = 1; i < slices; i++)
+        submit(memnew(RangeJob(work, data, i * per_slice, MIN(count, (i + 1) * per_slice), &remaining)));
+    work(data, 0, per_slice);
+
+    // Only slices of this call are helped with, picking up someone's proof of work here would stall the caller
+    while(remaining.load() > 0) {
+        if(!run_one(0, &remaining)) OS::get_singleton()->delay_usec(50);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef NANO_JOB_POOL_H_
+#define NANO_JOB_POOL_H_
+
+#include "core/os/mutex.h"
+#include "core/os/semaphore.h"
+#include "core/os/thread.h"
+
+#include <atomic>
+#include <deque>
+#include <vector>
+
+// A unit of work for NanoJobPool, run once on a worker thread and deleted there.
+// Results meant for scripts go back through MessageQueue::push_call, so they arrive on the main thread as deferred calls.
+class NanoJob {
+    public:
+        const void * group = NULL; // Set by parallel_for, so its caller only helps with its own slices
+        virtual void run() = 0;
+        virtual ~NanoJob() {}
+};
+
+// One set of worker threads for the CPU heavy parts of the module: local proof of work, key derivation, signing,
+// signature checks and QR codes, so none of them spawn threads of their own or run on the main thread.
+// Every worker has its own queue and an idle worker steals from the others. Jobs are meant to be short: a long
+// computation like proof of work runs in bounded slices that submit the next one, so even with a single worker the
+// jobs queued behind it get their turn between slices.
+class NanoJobPool {
+    private:
+        struct Worker {
+            NanoJobPool * pool;
+            int index;
+            Thread thread;
+            Mutex mutex;
+            std::deque<NanoJob *> jobs;
+        };
+
+        static NanoJobPool * singleton;
+        std::vector<Worker *> workers;
+        Semaphore semaphore; // Posted once per submitted job
+        std::atomic<bool> exiting;
+        std::atomic<uint32_t> next_worker;
+
+        static void worker_func(void * p_userdata);
+        // The worker's own queue is served oldest first, other queues are stolen from at the back
+        NanoJob * take(int preferred, const void * group);
+        bool run_one(int preferred, const void * group = NULL);
+
+    public:
+        static NanoJobPool * get_singleton() { return singleton; }
+
+        // Takes ownership of the job
+        void submit(NanoJob * job);
+        // Calls work over slices of [0, count) of at least min_slice rows, and returns once all are done.
+        // The calling thread takes slices too, so this is safe from the main thread and from inside a job.
+        void parallel_for(int count, int min_slice, void (*work)(void *, int, int), void * data);
+
+        int get_thread_count() const { return workers.size(); }
+        // Long running jobs check this and give up, so shutdown doesn't wait for them
+        bool is_exiting() const { return exiting.load(); }
+
+        NanoJobPool();
+        ~NanoJobPool();
+};
+
+#endif
\ No newline at end of file
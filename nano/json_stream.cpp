@@ -0,0 +1,289 @@
+#include "json_stream.h"
+
+#include "json_writer.h"
+
+void NanoJsonStream::reset() {
+    state = STATE_VALUE;
+    containers.clear();
+    token.clear();
+    expect_key = false;
+    token_is_key = false;
+    unicode = 0;
+    unicode_digits = 0;
+    high_surrogate = 0;
+}
+
+bool NanoJsonStream::feed(const uint8_t * data, int size) {
+    for(int i = 0; i < size && state != STATE_ERROR; i++) {
+        uint8_t c = data[i];
+        switch(state) {
+            case STATE_STRING:
+                if(c == '\\') state = STATE_ESCAPE;
+                else if(c == '"') finish_string();
+                else token.push_back(c);
+                break;
+            case STATE_ESCAPE:
+                state = STATE_STRING;
+                switch(c) {
+                    case 'b': token.push_back('\b'); break;
+                    case 'f': token.push_back('\f'); break;
+                    case 'n': token.push_back('\n'); break;
+                    case 'r': token.push_back('\r'); break;
+                    case 't': token.push_back('\t'); break;
+                    case 'u':
+                        state = STATE_UNICODE;
+                        unicode = 0;
+                        unicode_digits = 0;
+                        break;
+                    default: token.push_back(c); // \" \\ and \/
+                }
+                break;
+            case STATE_UNICODE: {
+                int digit = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+                if(digit < 0) {
+                    state = STATE_ERROR;
+                    break;
+                }
+                unicode = (unicode << 4) | digit;
+                if(++unicode_digits < 4) break;
+                state = STATE_STRING;
+                if(unicode >= 0xd800 && unicode < 0xdc00) high_surrogate = unicode;
+                else if(unicode >= 0xdc00 && unicode < 0xe000 && high_surrogate) {
+                    append_utf8(0x10000 + ((high_surrogate - 0xd800) << 10) + (unicode - 0xdc00));
+                    high_surrogate = 0;
+                } else append_utf8(unicode);
+            } break;
+            case STATE_LITERAL:
+                if((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '.' || c == '-' || c == '+' || c == 'E') {
+                    token.push_back(c);
+                    break;
+                }
+                finish_literal();
+                if(!value_byte(c)) state = STATE_ERROR;
+                break;
+            case STATE_VALUE:
+                if(!value_byte(c)) state = STATE_ERROR;
+                break;
+            case STATE_DONE:
+                if(c != ' ' && c != '\n' && c != '\r' && c != '\t') state = STATE_ERROR;
+                break;
+            case STATE_ERROR:
+                break;
+        }
+    }
+    return state != STATE_ERROR;
+}
+
+bool NanoJsonStream::value_byte(uint8_t c) {
+    switch(c) {
+        case ' ':
+        case '\n':
+        case '\r':
+        case '\t':
+            return true;
+        case '{':
+        case '[':
+            if(containers.size() >= MAX_DEPTH) return false;
+            containers.push_back(c);
+            expect_key = c == '{';
+            if(handler) handler->begin_container(c == '[');
+            return true;
+        case '}':
+        case ']':
+            if(containers.empty() || containers.back() != (c == '}' ? '{' : '[')) return false;
+            close_container(c);
+            return true;
+        case ',':
+            if(containers.empty()) return false;
+            expect_key = containers.back() == '{';
+            return true;
+        case ':':
+            expect_key = false;
+            return true;
+        case '"':
+            token.clear();
+            token_is_key = expect_key;
+            state = STATE_STRING;
+            return true;
+        default:
+            if(expect_key) return false;
+            token.clear();
+            token.push_back(c);
+            state = STATE_LITERAL;
+            return true;
+    }
+}
+
+void NanoJsonStream::append_utf8(uint32_t ch) {
+    if(ch < 0x80) {
+        token.push_back(ch);
+    } else if(ch < 0x800) {
+        token.push_back(0xc0 | (ch >> 6));
+        token.push_back(0x80 | (ch & 0x3f));
+    } else if(ch < 0x10000) {
+        token.push_back(0xe0 | (ch >> 12));
+        token.push_back(0x80 | ((ch >> 6) & 0x3f));
+        token.push_back(0x80 | (ch & 0x3f));
+    } else {
+        token.push_back(0xf0 | (ch >> 18));
+        token.push_back(0x80 | ((ch >> 12) & 0x3f));
+        token.push_back(0x80 | ((ch >> 6) & 0x3f));
+        token.push_back(0x80 | (ch & 0x3f));
+    }
+}
+
+void NanoJsonStream::finish_string() {
+    String text;
+    text.parse_utf8(token.data(), token.size());
+    token.clear();
+    state = containers.empty() ? STATE_DONE : STATE_VALUE;
+    if(!handler) return;
+    if(token_is_key) handler->key(text);
+    else handler->scalar(text, true);
+}
+
+void NanoJsonStream::finish_literal() {
+    String text = String(token.c_str());
+    token.clear();
+    state = containers.empty() ? STATE_DONE : STATE_VALUE;
+    if(handler) handler->scalar(text, false);
+}
+
+void NanoJsonStream::close_container(uint8_t c) {
+    containers.pop_back();
+    expect_key = false;
+    if(handler) handler->end_container(c == ']');
+    if(containers.empty()) state = STATE_DONE;
+}
+
+bool NanoRecordStream::is_streamable(const String & action) {
+    return action == "pending" || action == "receivable" || action == "accounts_pending" || action == "accounts_receivable" || action == "account_history";
+}
+
+void NanoRecordStream::begin(const String & action) {
+    nested = action.begins_with("accounts_");
+    history = action == "account_history";
+    received = false;
+    path.clear();
+    pending_key = String();
+    in_record = false;
+    records.clear();
+    top_level.clear();
+    parser.reset();
+    parser.set_handler(this);
+}
+
+void NanoRecordStream::write_body(const uint8_t * data, int size) {
+    received = true;
+    parser.feed(data, size);
+}
+
+String NanoRecordStream::name_for_child() const {
+    return (path.empty() || path.back().array) ? String() : pending_key;
+}
+
+// Record layouts, path[0] is the root object:
+//   pending            blocks.<hash>.{amount,source}, blocks.<hash>: amount, or blocks: [hash...]
+//   accounts_pending   blocks.<account>.<hash>.{amount,source}, blocks.<account>.<hash>: amount, or blocks.<account>: [hash...]
+//   account_history    history: [{type,account,amount,hash...}...]
+void NanoRecordStream::begin_container(bool array) {
+    Level level;
+    level.name = name_for_child();
+    level.array = array;
+    path.push_back(level);
+    if(in_record || array || path.size() < 2) return;
+
+    if(history) {
+        if(path.size() == 3 && path[1].name == "history" && path[1].array) {
+            in_record = true;
+            record_depth = path.size();
+            current = NanoRecord();
+        }
+    } else if(path[1].name == "blocks" && path.size() == (nested ? 4u : 3u)) {
+        in_record = true;
+        record_depth = path.size();
+        current = NanoRecord();
+        current.hash = level.name;
+        if(nested) current.account = path[2].name;
+    }
+}
+
+void NanoRecordStream::end_container(bool array) {
+    if(in_record && path.size() == record_depth) {
+        emit(current);
+        in_record = false;
+    }
+    path.pop_back();
+}
+
+void NanoRecordStream::key(const String & name) {
+    pending_key = name;
+}
+
+void NanoRecordStream::scalar(const String & value, bool quoted) {
+    String name = name_for_child();
+    if(in_record) {
+        if(path.size() != record_depth) return; // Nested deeper than the record, like a block's contents
+        if(name == "amount") current.amount = value;
+        else if(name == "source") current.source = value;
+        else if(name == "hash") current.hash = value;
+        else if(name == "account") current.account = value;
+        else if(name == "type") current.type = value;
+        return;
+    }
+    if(path.size() == 1) {
+        top_level[name] = value;
+        return;
+    }
+    if(path.size() < 2 || history || path[1].name != "blocks" || path.size() != (nested ? 3u : 2u)) return;
+
+    NanoRecord record;
+    if(nested) record.account = path[2].name;
+    if(path.back().array) record.hash = value; // Only hashes were asked for
+    else {
+        record.hash = name; // With a threshold the node answers hash: amount
+        record.amount = value;
+    }
+    emit(record);
+}
+
+Dictionary NanoRecordStream::take_records() {
+    PoolStringArray accounts, hashes, amounts, sources, types;
+    accounts.resize(records.size());
+    hashes.resize(records.size());
+    amounts.resize(records.size());
+    sources.resize(records.size());
+    types.resize(records.size());
+    {
+        PoolStringArray::Write account_w = accounts.write();
+        PoolStringArray::Write hash_w = hashes.write();
+        PoolStringArray::Write amount_w = amounts.write();
+        PoolStringArray::Write source_w = sources.write();
+        PoolStringArray::Write type_w = types.write();
+        int i = 0;
+        for(List<NanoRecord>::Element * r = records.front(); r; r = r->next(), i++) {
+            account_w[i] = r->get().account;
+            hash_w[i] = r->get().hash;
+            amount_w[i] = r->get().amount;
+            source_w[i] = r->get().source;
+            type_w[i] = r->get().type;
+        }
+    }
+    records.clear();
+
+    Dictionary columns;
+    columns["account"] = accounts;
+    columns["hash"] = hashes;
+    columns["amount"] = amounts;
+    columns["source"] = sources;
+    columns["type"] = types;
+    return columns;
+}
+
+PoolByteArray NanoRecordStream::get_summary() const {
+    Dictionary summary = top_level;
+    if(parser.has_error() || (received && !parser.is_done())) summary["error"] = "Malformed response";
+    NanoJsonWriter writer;
+    writer.variant(summary);
+    return writer.to_pool();
+}
\ No newline at end of file
@@ -0,0 +1,107 @@
+#ifndef NANO_JSON_STREAM_H_
+#define NANO_JSON_STREAM_H_
+
+#include "connection_pool.h"
+
+#include "core/dictionary.h"
+#include "core/list.h"
+#include "core/ustring.h"
+
+#include <string>
+#include <vector>
+
+// Incremental JSON tokenizer. Bytes can be fed in chunks split anywhere, events go to the handler as soon as a token
+// is complete. Only the open containers and the current token are kept, so memory does not grow with the document.
+class NanoJsonStream {
+    public:
+        class Handler {
+            public:
+                virtual void begin_container(bool array) {}
+                virtual void end_container(bool array) {}
+                virtual void key(const String & name) {}
+                virtual void scalar(const String & value, bool quoted) {} // Numbers, true, false and null come unquoted
+                virtual ~Handler() {}
+        };
+
+    private:
+        enum State { STATE_VALUE, STATE_STRING, STATE_ESCAPE, STATE_UNICODE, STATE_LITERAL, STATE_DONE, STATE_ERROR };
+        enum { MAX_DEPTH = 64 };
+
+        Handler * handler = NULL;
+        State state = STATE_VALUE;
+        std::vector<uint8_t> containers; // '{' or '[' per open container
+        std::string token;
+        bool expect_key = false;
+        bool token_is_key = false;
+        uint32_t unicode = 0;
+        int unicode_digits = 0;
+        uint32_t high_surrogate = 0;
+
+        bool value_byte(uint8_t c);
+        void append_utf8(uint32_t ch);
+        void finish_string();
+        void finish_literal();
+        void close_container(uint8_t c);
+
+    public:
+        void set_handler(Handler * p_handler) { handler = p_handler; }
+        // Returns false once the input turned out to be malformed, further input is ignored
+        bool feed(const uint8_t * data, int size);
+        bool is_done() const { return state == STATE_DONE; }
+        bool has_error() const { return state == STATE_ERROR; }
+        void reset();
+};
+
+// One receivable or history entry, fields the response does not have are left empty
+struct NanoRecord {
+    String account;
+    String hash;
+    String amount;
+    String source;
+    String type;
+};
+
+// Picks records out of pending, receivable, accounts_pending, accounts_receivable and account_history responses
+// while the body is still arriving. Records are taken in batches with take_records, everything else at the top
+// level of the response (error, previous...) is kept for get_summary.
+class NanoRecordStream : public NanoBodySink, public NanoJsonStream::Handler {
+    private:
+        NanoJsonStream parser;
+        bool nested = false; // accounts_* responses have an object per account around the blocks
+        bool history = false;
+        bool received = false;
+
+        struct Level {
+            String name; // Key the container was opened under, empty for array elements
+            bool array;
+        };
+        std::vector<Level> path;
+        String pending_key;
+        NanoRecord current;
+        bool in_record = false;
+        size_t record_depth = 0;
+        List<NanoRecord> records;
+        Dictionary top_level;
+
+        String name_for_child() const;
+        void emit(const NanoRecord & record) { records.push_back(record); }
+
+    public:
+        static bool is_streamable(const String & action);
+
+        void begin(const String & action);
+        virtual void write_body(const uint8_t * data, int size);
+        bool has_data() const { return received; }
+        bool has_records() const { return !records.empty(); }
+        // Columns of the records parsed since the last call, as PoolStringArrays keyed by field name
+        Dictionary take_records();
+        // The response without the records, as JSON
+        PoolByteArray get_summary() const;
+
+        virtual void begin_container(bool array);
+        virtual void end_container(bool array);
+        virtual void key(const String & name);
+        virtual void scalar(const String & value, bool quoted);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,163 @@
+#include "json_writer.h"
+
+void NanoJsonWriter::separate() {
+    if(buffer.empty()) return;
+    uint8_t last = buffer.back();
+    if(last != '{' && last != '[' && last != ':') buffer.push_back(',');
+}
+
+void NanoJsonWriter::write_raw(const char * text) {
+    while(*text)
+        buffer.push_back(*text++);
+}
+
+void NanoJsonWriter::write_integer(int64_t value) {
+    // Digits go straight into the buffer, without a String and a CharString per number
+    char digits[20];
+    int count = 0;
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    do {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while(magnitude);
+    if(value < 0) buffer.push_back('-');
+    while(count)
+        buffer.push_back(digits[--count]);
+}
+
+void NanoJsonWriter::write_string(const String & text) {
+    static const char hex[] = "0123456789abcdef";
+    buffer.push_back('"');
+    const CharType * c = text.c_str();
+    for(int i = 0; i < text.length(); i++) {
+        uint32_t ch = c[i];
+        switch(ch) {
+            case '"': write_raw("\\\""); break;
+            case '\\': write_raw("\\\\"); break;
+            case '\b': write_raw("\\b"); break;
+            case '\f': write_raw("\\f"); break;
+            case '\n': write_raw("\\n"); break;
+            case '\r': write_raw("\\r"); break;
+            case '\t': write_raw("\\t"); break;
+            default:
+                if(ch < 0x20) {
+                    write_raw("\\u00");
+                    buffer.push_back(hex[ch >> 4]);
+                    buffer.push_back(hex[ch & 0xf]);
+                } else if(ch < 0x80) {
+                    buffer.push_back(ch);
+                } else if(ch < 0x800) {
+                    buffer.push_back(0xc0 | (ch >> 6));
+                    buffer.push_back(0x80 | (ch & 0x3f));
+                } else if(ch < 0x10000) {
+                    buffer.push_back(0xe0 | (ch >> 12));
+                    buffer.push_back(0x80 | ((ch >> 6) & 0x3f));
+                    buffer.push_back(0x80 | (ch & 0x3f));
+                } else {
+                    buffer.push_back(0xf0 | (ch >> 18));
+                    buffer.push_back(0x80 | ((ch >> 12) & 0x3f));
+                    buffer.push_back(0x80 | ((ch >> 6) & 0x3f));
+                    buffer.push_back(0x80 | (ch & 0x3f));
+                }
+        }
+    }
+    buffer.push_back('"');
+}
+
+void NanoJsonWriter::write_key(const char * key) {
+    separate();
+    buffer.push_back('"');
+    write_raw(key); // Keys are RPC field names, nothing to escape
+    buffer.push_back('"');
+    buffer.push_back(':');
+}
+
+void NanoJsonWriter::begin_object() {
+    separate();
+    buffer.push_back('{');
+}
+
+void NanoJsonWriter::begin_object(const char * key) {
+    write_key(key);
+    buffer.push_back('{');
+}
+
+void NanoJsonWriter::end_object() {
+    buffer.push_back('}');
+}
+
+void NanoJsonWriter::begin_array(const char * key) {
+    write_key(key);
+    buffer.push_back('[');
+}
+
+void NanoJsonWriter::end_array() {
+    buffer.push_back(']');
+}
+
+void NanoJsonWriter::string(const char * key, const String & value) {
+    write_key(key);
+    write_string(value);
+}
+
+void NanoJsonWriter::string(const String & value) {
+    separate();
+    write_string(value);
+}
+
+void NanoJsonWriter::boolean(const char * key, bool value) {
+    write_key(key);
+    write_raw(value ? "true" : "false");
+}
+
+void NanoJsonWriter::integer(const char * key, int64_t value) {
+    write_key(key);
+    write_integer(value);
+}
+
+void NanoJsonWriter::variant(const char * key, const Variant & value) {
+    write_key(key);
+    variant(value);
+}
+
+void NanoJsonWriter::variant(const Variant & value) {
+    separate();
+    switch(value.get_type()) {
+        case Variant::NIL: write_raw("null"); break;
+        case Variant::BOOL: write_raw(bool(value) ? "true" : "false"); break;
+        case Variant::INT: write_integer(value); break;
+        case Variant::REAL: write_raw(rtos(value).ascii().get_data()); break;
+        case Variant::DICTIONARY: {
+            Dictionary d = value;
+            List<Variant> keys;
+            d.get_key_list(&keys);
+            keys.sort();
+            buffer.push_back('{');
+            for(List<Variant>::Element * k = keys.front(); k; k = k->next()) {
+                separate();
+                write_string(k->get());
+                buffer.push_back(':');
+                variant(d[k->get()]);
+            }
+            buffer.push_back('}');
+        } break;
+        case Variant::ARRAY:
+        case Variant::POOL_STRING_ARRAY:
+        case Variant::POOL_INT_ARRAY:
+        case Variant::POOL_REAL_ARRAY: {
+            Array a = value;
+            buffer.push_back('[');
+            for(int i = 0; i < a.size(); i++)
+                variant(a[i]);
+            buffer.push_back(']');
+        } break;
+        default: write_string(value);
+    }
+}
+
+PoolByteArray NanoJsonWriter::to_pool() const {
+    PoolByteArray raw;
+    raw.resize(buffer.size());
+    if(!buffer.empty()) memcpy(raw.write().ptr(), buffer.data(), buffer.size());
+    return raw;
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef NANO_JSON_WRITER_H_
+#define NANO_JSON_WRITER_H_
+
+#include "core/array.h"
+#include "core/dictionary.h"
+#include "core/pool_vector.h"
+#include "core/ustring.h"
+
+#include <vector>
+
+// Writes an RPC body straight into a byte buffer, without building a Dictionary and printing it to a String first.
+// The buffer keeps its capacity between bodies. Write keys in sorted order, then the bytes match JSON::print with
+// sort_keys, which is what NanoRequest sends for Dictionary bodies too, so both hit the same NanoResponseCache entry.
+class NanoJsonWriter {
+    private:
+        std::vector<uint8_t> buffer;
+
+        void separate();
+        void write_raw(const char * text);
+        void write_string(const String & text);
+        void write_integer(int64_t value);
+        void write_key(const char * key);
+
+    public:
+        void clear() { buffer.clear(); }
+        bool empty() const { return buffer.empty(); }
+
+        void begin_object();
+        void begin_object(const char * key);
+        void end_object();
+        void begin_array(const char * key);
+        void end_array();
+
+        void string(const char * key, const String & value);
+        void string(const String & value); // Array element
+        void boolean(const char * key, bool value);
+        void integer(const char * key, int64_t value);
+        // Anything a script passed in, dictionaries are written with sorted keys
+        void variant(const char * key, const Variant & value);
+        void variant(const Variant & value);
+
+        PoolByteArray to_pool() const;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,402 @@
+#include "ledger.h"
+
+#include "core/io/marshalls.h"
+#include "core/project_settings.h"
+
+#ifdef UNIX_ENABLED
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+const size_t initial_capacity = 64 * 1024;
+const char ledger_magic[4] = { 'N', 'L', 'D', 'G' };
+
+// Offsets inside an account record
+const int record_frontier = 32;
+const int record_representative = 64;
+const int record_balance = 96;
+const int record_block_count = 112;
+const int record_flags = 120;
+}
+
+#ifdef UNIX_ENABLED
+
+Error NanoMappedFile::open(const String & p_path) {
+    close();
+    path = p_path;
+    CharString file_path = ProjectSettings::get_singleton()->globalize_path(p_path).utf8();
+    fd = ::open(file_path.get_data(), O_RDWR | O_CREAT, 0644);
+    ERR_FAIL_COND_V_MSG(fd < 0, ERR_CANT_OPEN, "Could not open " + p_path);
+    struct stat info;
+    if(fstat(fd, &info) != 0) {
+        close();
+        ERR_FAIL_V_MSG(ERR_CANT_OPEN, "Could not stat " + p_path);
+    }
+    Error err = reserve(MAX((size_t)info.st_size, initial_capacity));
+    if(err != OK) close();
+    return err;
+}
+
+void NanoMappedFile::close() {
+    if(data) munmap(data, capacity);
+    if(fd >= 0) ::close(fd);
+    data = NULL;
+    capacity = 0;
+    fd = -1;
+}
+
+Error NanoMappedFile::reserve(size_t size) {
+    if(data && size <= capacity) return OK;
+    ERR_FAIL_COND_V(fd < 0, ERR_UNCONFIGURED);
+    // Doubling keeps remaps rare while the block log grows one record at a time
+    size_t new_capacity = MAX(size, capacity * 2);
+    ERR_FAIL_COND_V_MSG(ftruncate(fd, new_capacity) != 0, ERR_CANT_CREATE, "Could not grow " + path);
+    if(data) munmap(data, capacity);
+    void * mapped = mmap(NULL, new_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(mapped == MAP_FAILED) {
+        data = NULL;
+        capacity = 0;
+        ERR_FAIL_V_MSG(ERR_CANT_CREATE, "Could not map " + path);
+    }
+    data = static_cast<uint8_t *>(mapped);
+    capacity = new_capacity;
+    return OK;
+}
+
+void NanoMappedFile::written(size_t offset, size_t size) {
+    // The mapping is shared, the change is already in the page cache
+}
+
+void NanoMappedFile::flush() {
+    if(data) msync(data, capacity, MS_ASYNC);
+}
+
+#else
+
+Error NanoMappedFile::open(const String & p_path) {
+    close();
+    path = p_path;
+    file = FileAccess::open(p_path, FileAccess::READ_WRITE);
+    if(!file) file = FileAccess::open(p_path, FileAccess::WRITE_READ);
+    ERR_FAIL_COND_V_MSG(!file, ERR_CANT_OPEN, "Could not open " + p_path);
+    size_t length = file->get_len();
+    buffer.resize(MAX(length, initial_capacity));
+    if(length) file->get_buffer(buffer.data(), length);
+    data = buffer.data();
+    capacity = buffer.size();
+    return OK;
+}
+
+void NanoMappedFile::close() {
+    if(file) {
+        file->close();
+        memdelete(file);
+    }
+    file = NULL;
+    buffer.clear();
+    data = NULL;
+    capacity = 0;
+}
+
+Error NanoMappedFile::reserve(size_t size) {
+    if(data && size <= capacity) return OK;
+    ERR_FAIL_COND_V(!file, ERR_UNCONFIGURED);
+    buffer.resize(MAX(size, capacity * 2));
+    data = buffer.data();
+    capacity = buffer.size();
+    return OK;
+}
+
+void NanoMappedFile::written(size_t offset, size_t size) {
+    ERR_FAIL_COND(!file || offset + size > capacity);
+    file->seek(offset);
+    file->store_buffer(data + offset, size);
+}
+
+void NanoMappedFile::flush() {
+    if(file) file->flush();
+}
+
+#endif
+
+NanoLedger::~NanoLedger() {
+    close();
+}
+
+nano::uint256_union NanoLedger::read_key(const uint8_t * data) {
+    nano::uint256_union key;
+    memcpy(key.bytes.data(), data, sizeof(key.bytes));
+    return key;
+}
+
+Error NanoLedger::open_file(NanoMappedFile & file, const String & file_path, int record_size, uint64_t & r_count) {
+    Error err = file.open(file_path);
+    ERR_FAIL_COND_V_MSG(err != OK, err, "Could not open ledger file " + file_path);
+    uint8_t * header = file.ptr();
+    if(decode_uint32(header) == 0) {
+        memcpy(header, ledger_magic, sizeof(ledger_magic));
+        encode_uint16(VERSION, header + 4);
+        encode_uint16(record_size, header + 6);
+        encode_uint64(0, header + 8);
+        file.written(0, HEADER_SIZE);
+    }
+    ERR_FAIL_COND_V_MSG(memcmp(header, ledger_magic, sizeof(ledger_magic)) != 0 || decode_uint16(header + 4) != VERSION || decode_uint16(header + 6) != record_size,
+        ERR_FILE_CORRUPT, "Not a ledger file: " + file_path);
+    r_count = decode_uint64(header + 8);
+    ERR_FAIL_COND_V_MSG(HEADER_SIZE + r_count * record_size > file.get_capacity(), ERR_FILE_CORRUPT, "Truncated ledger file: " + file_path);
+    return OK;
+}
+
+void NanoLedger::write_count(NanoMappedFile & file, uint64_t count) {
+    encode_uint64(count, file.ptr() + 8);
+    file.written(8, 8);
+}
+
+Error NanoLedger::open(String p_path) {
+    close();
+    Error err = open_file(accounts_file, p_path + ".accounts", ACCOUNT_RECORD_SIZE, account_count);
+    if(err == OK) err = open_file(blocks_file, p_path + ".blocks", BLOCK_RECORD_SIZE, block_count);
+    if(err != OK) {
+        close();
+        return err;
+    }
+    path = p_path;
+
+    // Fixed records make the indexes a single pass over the mapped files, nothing is parsed
+    for(uint64_t i = 0; i < account_count; i++)
+        account_index[read_key(account_record(i))] = i;
+    for(uint64_t i = 0; i < block_count; i++) {
+        const uint8_t * record = blocks_file.ptr() + HEADER_SIZE + i * BLOCK_RECORD_SIZE;
+        block_index[read_key(record)] = i;
+        nano::uint256_union account = read_key(record + 32); // The account is the first field of a serialized block
+        if(account_index.has(account)) account_blocks[account].push_back(i);
+    }
+    return OK;
+}
+
+void NanoLedger::close() {
+    flush();
+    accounts_file.close();
+    blocks_file.close();
+    account_index.clear();
+    block_index.clear();
+    account_blocks.clear();
+    account_count = 0;
+    block_count = 0;
+    path = "";
+}
+
+void NanoLedger::flush() {
+    accounts_file.flush();
+    blocks_file.flush();
+}
+
+uint8_t * NanoLedger::account_record(int index) const {
+    return accounts_file.ptr() + HEADER_SIZE + (size_t)index * ACCOUNT_RECORD_SIZE;
+}
+
+int NanoLedger::find_or_add_account(const nano::uint256_union & key) {
+    const Map<nano::uint256_union, int>::Element * e = account_index.find(key);
+    if(e) return e->get();
+
+    size_t offset = HEADER_SIZE + account_count * ACCOUNT_RECORD_SIZE;
+    ERR_FAIL_COND_V(accounts_file.reserve(offset + ACCOUNT_RECORD_SIZE) != OK, -1);
+    uint8_t * record = accounts_file.ptr() + offset;
+    memset(record, 0, ACCOUNT_RECORD_SIZE);
+    memcpy(record, key.bytes.data(), sizeof(key.bytes));
+    accounts_file.written(offset, ACCOUNT_RECORD_SIZE);
+    int index = account_count;
+    account_index[key] = index;
+    write_count(accounts_file, ++account_count);
+    return index;
+}
+
+Error NanoLedger::apply_block(Ref<NanoBlock> block) {
+    ERR_FAIL_COND_V(block.is_null(), ERR_INVALID_PARAMETER);
+    ERR_FAIL_COND_V_MSG(!is_open(), ERR_UNCONFIGURED, "The ledger is not open");
+    const nano::uint256_union & hash = block->get_hash_bytes();
+    // Blocks this game processed come back as confirmations
+    if(block_index.has(hash)) return OK;
+
+    size_t offset = HEADER_SIZE + block_count * BLOCK_RECORD_SIZE;
+    Error err = blocks_file.reserve(offset + BLOCK_RECORD_SIZE);
+    ERR_FAIL_COND_V(err != OK, err);
+    uint8_t * record = blocks_file.ptr() + offset;
+    memcpy(record, hash.bytes.data(), sizeof(hash.bytes));
+    block->serialize_to(record + 32);
+    blocks_file.written(offset, BLOCK_RECORD_SIZE);
+    // The count is written after the record, a crash in between leaves the record unused rather than half written
+    const nano::uint256_union & account = block->get_account_bytes();
+    block_index[hash] = block_count;
+    account_blocks[account].push_back(block_count);
+    write_count(blocks_file, ++block_count);
+
+    int index = find_or_add_account(account);
+    ERR_FAIL_COND_V(index < 0, ERR_CANT_CREATE);
+    uint8_t * entry = account_record(index);
+    uint32_t flags = decode_uint32(entry + record_flags);
+    // Blocks arrive newest last, one that doesn't build on the frontier means some were missed in between
+    if(read_key(entry + record_frontier) == block->get_previous_bytes())
+        encode_uint64(decode_uint64(entry + record_block_count) + 1, entry + record_block_count);
+    else
+        flags |= FLAG_STALE;
+    memcpy(entry + record_frontier, hash.bytes.data(), 32);
+    memcpy(entry + record_representative, record + 32 + 64, 32); // Straight from the serialized block, after account and previous
+    memcpy(entry + record_balance, block->get_balance_bytes().bytes.data(), 16);
+    encode_uint32(flags, entry + record_flags);
+    accounts_file.written(HEADER_SIZE + (size_t)index * ACCOUNT_RECORD_SIZE, ACCOUNT_RECORD_SIZE);
+    return OK;
+}
+
+Error NanoLedger::set_account_info(String address, String frontier, String balance, String representative, int count) {
+    ERR_FAIL_COND_V_MSG(!is_open(), ERR_UNCONFIGURED, "The ledger is not open");
+    nano::uint256_union account, frontier_hash, rep;
+    nano::uint128_union raw_balance;
+    ERR_FAIL_COND_V_MSG(NanoAccount::decode_address(address, account.bytes), ERR_INVALID_PARAMETER, "Invalid account: " + address);
+    ERR_FAIL_COND_V_MSG(frontier_hash.decode_hex(frontier), ERR_INVALID_PARAMETER, "Invalid frontier: " + frontier);
+    ERR_FAIL_COND_V_MSG(raw_balance.decode_dec(balance), ERR_INVALID_PARAMETER, "Invalid balance: " + balance);
+    ERR_FAIL_COND_V_MSG(NanoAccount::decode_address(representative, rep.bytes), ERR_INVALID_PARAMETER, "Invalid representative: " + representative);
+
+    int index = find_or_add_account(account);
+    ERR_FAIL_COND_V(index < 0, ERR_CANT_CREATE);
+    uint8_t * entry = account_record(index);
+    memcpy(entry + record_frontier, frontier_hash.bytes.data(), 32);
+    memcpy(entry + record_representative, rep.bytes.data(), 32);
+    memcpy(entry + record_balance, raw_balance.bytes.data(), 16);
+    encode_uint64(MAX(count, 0), entry + record_block_count);
+    encode_uint32(decode_uint32(entry + record_flags) & ~FLAG_STALE, entry + record_flags);
+    accounts_file.written(HEADER_SIZE + (size_t)index * ACCOUNT_RECORD_SIZE, ACCOUNT_RECORD_SIZE);
+    return OK;
+}
+
+void NanoLedger::remove_account(String address) {
+    ERR_FAIL_COND_MSG(!is_open(), "The ledger is not open");
+    nano::uint256_union account;
+    ERR_FAIL_COND_MSG(NanoAccount::decode_address(address, account.bytes), "Invalid account: " + address);
+    Map<nano::uint256_union, int>::Element * e = account_index.find(account);
+    if(!e) return;
+
+    // The last record fills the hole, the table stays dense. The account's blocks stay in the log.
+    int index = e->get();
+    int last = account_count - 1;
+    if(index != last) {
+        memcpy(account_record(index), account_record(last), ACCOUNT_RECORD_SIZE);
+        accounts_file.written(HEADER_SIZE + (size_t)index * ACCOUNT_RECORD_SIZE, ACCOUNT_RECORD_SIZE);
+        account_index[read_key(account_record(index))] = index;
+    }
+    account_index.erase(account);
+    account_blocks.erase(account);
+    write_count(accounts_file, --account_count);
+}
+
+Dictionary NanoLedger::read_account(int index) const {
+    const uint8_t * entry = account_record(index);
+    nano::uint256_union frontier = read_key(entry + record_frontier);
+    nano::uint128_union balance;
+    memcpy(balance.bytes.data(), entry + record_balance, 16);
+    std::array<uint8_t, 32> key, rep;
+    memcpy(key.data(), entry, 32);
+    memcpy(rep.data(), entry + record_representative, 32);
+
+    Dictionary info;
+    info["account"] = NanoAccount::encode_address(key);
+    info["frontier"] = frontier.to_string();
+    info["representative"] = NanoAccount::encode_address(rep);
+    info["balance"] = balance.to_string_dec();
+    info["block_count"] = (int64_t)decode_uint64(entry + record_block_count);
+    info["stale"] = (decode_uint32(entry + record_flags) & FLAG_STALE) != 0;
+    return info;
+}
+
+Dictionary NanoLedger::get_account_info(String address) const {
+    nano::uint256_union account;
+    if(!is_open() || NanoAccount::decode_address(address, account.bytes)) return Dictionary();
+    const Map<nano::uint256_union, int>::Element * e = account_index.find(account);
+    return e ? read_account(e->get()) : Dictionary();
+}
+
+PoolStringArray NanoLedger::get_accounts() const {
+    PoolStringArray accounts;
+    for(uint64_t i = 0; i < account_count; i++)
+        accounts.push_back(NanoAccount::encode_address(read_key(account_record(i)).bytes));
+    return accounts;
+}
+
+Dictionary NanoLedger::get_frontiers() const {
+    Dictionary frontiers;
+    for(uint64_t i = 0; i < account_count; i++) {
+        const uint8_t * entry = account_record(i);
+        frontiers[NanoAccount::encode_address(read_key(entry).bytes)] = read_key(entry + record_frontier).to_string();
+    }
+    return frontiers;
+}
+
+PoolStringArray NanoLedger::get_changed_accounts(Dictionary frontiers) const {
+    PoolStringArray changed;
+    for(uint64_t i = 0; i < account_count; i++) {
+        const uint8_t * entry = account_record(i);
+        String address = NanoAccount::encode_address(read_key(entry).bytes);
+        nano::uint256_union remote;
+        // The node may answer with either prefix
+        String remote_hex = frontiers.get(address, frontiers.get("xrb_" + address.substr(5, address.length()), ""));
+        bool stale = decode_uint32(entry + record_flags) & FLAG_STALE;
+        if(stale || remote.decode_hex(remote_hex) || remote != read_key(entry + record_frontier))
+            changed.push_back(address);
+    }
+    return changed;
+}
+
+Array NanoLedger::get_blocks(String address, int count) const {
+    Array blocks;
+    nano::uint256_union account;
+    if(!is_open() || NanoAccount::decode_address(address, account.bytes)) return blocks;
+    const Map<nano::uint256_union, Vector<int> >::Element * e = account_blocks.find(account);
+    if(!e) return blocks;
+    const Vector<int> & positions = e->get();
+    for(int i = positions.size() - 1; i >= 0 && (count <= 0 || blocks.size() < count); i--) {
+        Ref<NanoBlock> block(memnew(NanoBlock));
+        block->deserialize_from(blocks_file.ptr() + HEADER_SIZE + (size_t)positions[i] * BLOCK_RECORD_SIZE + 32);
+        blocks.push_back(block);
+    }
+    return blocks;
+}
+
+Ref<NanoBlock> NanoLedger::get_block(String hash) const {
+    nano::uint256_union key;
+    if(!is_open() || key.decode_hex(hash)) return Ref<NanoBlock>();
+    const Map<nano::uint256_union, int>::Element * e = block_index.find(key);
+    if(!e) return Ref<NanoBlock>();
+    Ref<NanoBlock> block(memnew(NanoBlock));
+    block->deserialize_from(blocks_file.ptr() + HEADER_SIZE + (size_t)e->get() * BLOCK_RECORD_SIZE + 32);
+    return block;
+}
+
+bool NanoLedger::has_block(String hash) const {
+    nano::uint256_union key;
+    return !key.decode_hex(hash) && block_index.has(key);
+}
+
+void NanoLedger::_bind_methods() {
+    ClassDB::bind_method(D_METHOD("open", "path"), &NanoLedger::open);
+    ClassDB::bind_method(D_METHOD("close"), &NanoLedger::close);
+    ClassDB::bind_method(D_METHOD("is_open"), &NanoLedger::is_open);
+    ClassDB::bind_method(D_METHOD("get_path"), &NanoLedger::get_path);
+    ClassDB::bind_method(D_METHOD("flush"), &NanoLedger::flush);
+
+    ClassDB::bind_method(D_METHOD("apply_block", "block"), &NanoLedger::apply_block);
+    ClassDB::bind_method(D_METHOD("set_account_info", "account", "frontier", "balance", "representative", "block_count"), &NanoLedger::set_account_info, DEFVAL(0));
+    ClassDB::bind_method(D_METHOD("remove_account", "account"), &NanoLedger::remove_account);
+
+    ClassDB::bind_method(D_METHOD("get_account_info", "account"), &NanoLedger::get_account_info);
+    ClassDB::bind_method(D_METHOD("get_accounts"), &NanoLedger::get_accounts);
+    ClassDB::bind_method(D_METHOD("get_frontiers"), &NanoLedger::get_frontiers);
+    ClassDB::bind_method(D_METHOD("get_changed_accounts", "frontiers"), &NanoLedger::get_changed_accounts);
+    ClassDB::bind_method(D_METHOD("get_blocks", "account", "count"), &NanoLedger::get_blocks, DEFVAL(0));
+    ClassDB::bind_method(D_METHOD("get_block", "hash"), &NanoLedger::get_block);
+    ClassDB::bind_method(D_METHOD("has_block", "hash"), &NanoLedger::has_block);
+    ClassDB::bind_method(D_METHOD("get_block_count"), &NanoLedger::get_block_count);
+    ClassDB::bind_method(D_METHOD("get_account_count"), &NanoLedger::get_account_count);
+}
\ No newline at end of file
@@ -0,0 +1,107 @@
+#ifndef NANO_LEDGER_H_
+#define NANO_LEDGER_H_
+
+#include "block.h"
+#include "numbers.h"
+
+#include "core/map.h"
+#include "core/os/file_access.h"
+#include "core/reference.h"
+
+#include <vector>
+
+// A file whose contents are reached through one pointer. On unix the file is memory mapped, so opening it costs
+// nothing and the page cache writes it back. Elsewhere it is read into memory and changed ranges are written through.
+class NanoMappedFile {
+    private:
+        String path;
+        uint8_t * data = NULL;
+        size_t capacity = 0;
+#ifdef UNIX_ENABLED
+        int fd = -1;
+#else
+        FileAccess * file = NULL;
+        std::vector<uint8_t> buffer;
+#endif
+
+    public:
+        Error open(const String & p_path);
+        void close();
+        bool is_open() const { return data != NULL; }
+
+        // Grows the file to at least size bytes, the pointer may move
+        Error reserve(size_t size);
+        uint8_t * ptr() const { return data; }
+        size_t get_capacity() const { return capacity; }
+        // Marks a range as changed, the fallback writes it to disk right away
+        void written(size_t offset, size_t size);
+        void flush();
+
+        ~NanoMappedFile() { close(); }
+};
+
+// Local copy of the chains of the accounts this game manages, so a cold start can show balances and history
+// before the node answers, and then only fetch what changed since the stored frontier.
+// Two fixed record files: <path>.accounts holds frontier, representative, balance and block count per account,
+// <path>.blocks is an append-only log of hash and serialized block. Only used from the main thread.
+class NanoLedger : public Reference {
+    GDCLASS(NanoLedger, Reference);
+
+    private:
+        enum {
+            HEADER_SIZE = 16, // magic, version, record count
+            VERSION = 1,
+            ACCOUNT_RECORD_SIZE = 128, // key, frontier, representative, balance, block count, flags
+            BLOCK_RECORD_SIZE = 32 + NanoBlock::SERIALIZED_SIZE // hash, block
+        };
+        enum {
+            FLAG_STALE = 1 // A block arrived that doesn't follow the frontier, account_info has to be asked again
+        };
+
+        String path;
+        NanoMappedFile accounts_file;
+        NanoMappedFile blocks_file;
+        uint64_t account_count = 0;
+        uint64_t block_count = 0;
+
+        Map<nano::uint256_union, int> account_index;
+        Map<nano::uint256_union, int> block_index;
+        Map<nano::uint256_union, Vector<int> > account_blocks; // Log positions of each account's blocks, oldest first
+
+        Error open_file(NanoMappedFile & file, const String & file_path, int record_size, uint64_t & r_count);
+        void write_count(NanoMappedFile & file, uint64_t count);
+        uint8_t * account_record(int index) const;
+        int find_or_add_account(const nano::uint256_union & key);
+        static nano::uint256_union read_key(const uint8_t * data);
+        Dictionary read_account(int index) const;
+
+    protected:
+        static void _bind_methods();
+    public:
+        Error open(String p_path);
+        void close();
+        bool is_open() const { return accounts_file.is_open() && blocks_file.is_open(); }
+        String get_path() const { return path; }
+
+        // Appends a processed or confirmed block and moves the account's frontier to it
+        Error apply_block(Ref<NanoBlock> block);
+        // Stores what account_info returned, for accounts whose blocks weren't seen locally
+        Error set_account_info(String address, String frontier, String balance, String representative, int count = 0);
+        void remove_account(String address);
+
+        Dictionary get_account_info(String address) const;
+        PoolStringArray get_accounts() const;
+        Dictionary get_frontiers() const;
+        // Accounts whose stored frontier differs from an accounts_frontiers answer, or that are marked stale
+        PoolStringArray get_changed_accounts(Dictionary frontiers) const;
+        Array get_blocks(String address, int count = 0) const;
+        Ref<NanoBlock> get_block(String hash) const;
+        bool has_block(String hash) const;
+        int get_block_count() const { return block_count; }
+        int get_account_count() const { return account_count; }
+        void flush();
+
+        ~NanoLedger();
+};
+
+#endif
\ No newline at end of file
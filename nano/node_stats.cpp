@@ -0,0 +1,94 @@
+#include "node_stats.h"
+
+#include "core/os/os.h"
+
+#include <algorithm>
+
+NanoNodeStats * NanoNodeStats::singleton = NULL;
+
+NanoNodeStats::NanoNodeStats() {
+    singleton = this;
+}
+
+NanoNodeStats::~NanoNodeStats() {
+    if(singleton == this) singleton = NULL;
+}
+
+void NanoNodeStats::record_success(const String & key, uint64_t latency_usec) {
+    EndpointStats & s = endpoints[key];
+    double msec = latency_usec / 1000.0;
+    s.ewma_msec = s.has_samples ? s.ewma_msec + ewma_weight * (msec - s.ewma_msec) : msec;
+    s.has_samples = true;
+    s.samples_usec[s.next_sample] = MIN(latency_usec, (uint64_t)UINT32_MAX);
+    s.next_sample = (s.next_sample + 1) % SAMPLE_COUNT;
+    s.sample_count = MIN(s.sample_count + 1, (int)SAMPLE_COUNT);
+    s.successes++;
+    s.consecutive_failures = 0;
+    s.probe_in_flight = false;
+}
+
+void NanoNodeStats::record_failure(const String & key) {
+    EndpointStats & s = endpoints[key];
+    s.failures++;
+    s.consecutive_failures++;
+    s.last_failure_msec = OS::get_singleton()->get_ticks_msec();
+    s.probe_in_flight = false;
+}
+
+void NanoNodeStats::record_lower_bound(const String & key, uint64_t elapsed_usec) {
+    EndpointStats & s = endpoints[key];
+    double msec = elapsed_usec / 1000.0;
+    if(s.has_samples && s.ewma_msec >= msec) return; // Already known to be at least this slow
+    s.ewma_msec = s.has_samples ? s.ewma_msec + ewma_weight * (msec - s.ewma_msec) : msec;
+    s.has_samples = true;
+}
+
+bool NanoNodeStats::allow_request(const String & key) {
+    Map<String, EndpointStats>::Element * e = endpoints.find(key);
+    if(!e || e->get().consecutive_failures < failure_threshold) return true;
+    if(!is_healthy(key)) return false;
+    // A probe that never reported back (cancelled by its caller) doesn't keep the circuit open forever
+    uint64_t now = OS::get_singleton()->get_ticks_msec();
+    if(e->get().probe_in_flight && now - e->get().probe_msec < failure_cooldown_msec) return false;
+    e->get().probe_in_flight = true;
+    e->get().probe_msec = now;
+    return true;
+}
+
+bool NanoNodeStats::is_healthy(const String & key) const {
+    const Map<String, EndpointStats>::Element * e = endpoints.find(key);
+    if(!e || e->get().consecutive_failures < failure_threshold) return true;
+    return OS::get_singleton()->get_ticks_msec() - e->get().last_failure_msec >= failure_cooldown_msec;
+}
+
+double NanoNodeStats::get_score(const String & key) const {
+    const Map<String, EndpointStats>::Element * e = endpoints.find(key);
+    if(!e || !e->get().has_samples) return 0;
+    return e->get().ewma_msec;
+}
+
+uint64_t NanoNodeStats::get_p95_usec(const String & key, uint64_t p_fallback) const {
+    const Map<String, EndpointStats>::Element * e = endpoints.find(key);
+    if(!e || e->get().sample_count < 8) return p_fallback;
+
+    const EndpointStats & s = e->get();
+    uint32_t sorted[SAMPLE_COUNT];
+    std::copy(s.samples_usec, s.samples_usec + s.sample_count, sorted);
+    int index = (s.sample_count * 95 + 99) / 100 - 1;
+    std::nth_element(sorted, sorted + index, sorted + s.sample_count);
+    return sorted[index];
+}
+
+Dictionary NanoNodeStats::get_stats(const String & key) const {
+    Dictionary d;
+    const Map<String, EndpointStats>::Element * e = endpoints.find(key);
+    d["healthy"] = is_healthy(key);
+    d["latency_msec"] = e ? e->get().ewma_msec : 0.0;
+    d["p95_msec"] = get_p95_usec(key, 0) / 1000.0;
+    d["successes"] = e ? e->get().successes : 0;
+    d["failures"] = e ? e->get().failures : 0;
+    d["consecutive_failures"] = e ? e->get().consecutive_failures : 0;
+    if(!e || e->get().consecutive_failures < failure_threshold) d["circuit"] = "closed";
+    else d["circuit"] = is_healthy(key) ? "half_open" : "open";
+    return d;
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#ifndef NANO_NODE_STATS_H_
+#define NANO_NODE_STATS_H_
+
+#include "core/dictionary.h"
+#include "core/map.h"
+#include "core/ustring.h"
+
+// Latency and error tracking per endpoint, shared by every NanoRequest so routing learns from all traffic.
+// Keyed by NanoEndpoint::get_key(), only used from the main thread.
+class NanoNodeStats {
+    private:
+        enum { SAMPLE_COUNT = 32 };
+
+        struct EndpointStats {
+            double ewma_msec = 0;
+            bool has_samples = false;
+            uint32_t samples_usec[SAMPLE_COUNT];
+            int sample_count = 0;
+            int next_sample = 0;
+            int successes = 0;
+            int failures = 0;
+            int consecutive_failures = 0;
+            uint64_t last_failure_msec = 0;
+            bool probe_in_flight = false;
+            uint64_t probe_msec = 0;
+        };
+
+        static NanoNodeStats * singleton;
+        Map<String, EndpointStats> endpoints;
+
+        double ewma_weight = 0.2;
+        int failure_threshold = 3;
+        uint64_t failure_cooldown_msec = 10000;
+
+    public:
+        static NanoNodeStats * get_singleton() { return singleton; }
+
+        void record_success(const String & key, uint64_t latency_usec);
+        void record_failure(const String & key);
+        // The endpoint took at least this long and was cut off, only ever raises its expected latency
+        void record_lower_bound(const String & key, uint64_t elapsed_usec);
+
+        // Unhealthy after failure_threshold failures in a row, until the cooldown has passed and it gets another try
+        bool is_healthy(const String & key) const;
+        // Circuit breaker: false while the endpoint is down, so callers fail fast instead of waiting on it.
+        // After the cooldown a single probe request is let through, its result closes or reopens the circuit.
+        bool allow_request(const String & key);
+        // Expected latency, nodes without samples score 0 so they get tried at least once
+        double get_score(const String & key) const;
+        // 95th percentile of the recent latencies, or p_fallback while there are too few samples
+        uint64_t get_p95_usec(const String & key, uint64_t p_fallback) const;
+        Dictionary get_stats(const String & key) const;
+
+        NanoNodeStats();
+        ~NanoNodeStats();
+};
+
+#endif
\ No newline at end of file
@@ -3,22 +3,126 @@
 #include "core/bind/core_bind.h"
 #include "core/method_bind_ext.gen.inc"
 #include "core/io/json.h"
+#include "core/math/math_funcs.h"
+#include "core/os/os.h"
 
 NanoReceiver::NanoReceiver() {
     state = READY;
     requester = memnew(NanoRequest);
     add_child(requester);
-    requester->connect("request_completed", this, "_nano_request_completed");
+    requester->connect("rpc_completed", this, "_nano_request_completed");
+    requester->set_priority(NanoRequest::PRIORITY_INTERACTIVE);
+    requester->set_use_cache(false); // Blocks are built on the frontier, it has to be fresh
+    requester->set_timeout_msec(rpc_timeout_msec);
+    requester->set_work_timeout_msec(work_timeout_msec);
 }
 
 void NanoReceiver::cancel_receive_request(String error_message, int error_code) {
     state = READY;
+    current_request = 0;
+    sign_sequence++;
+    process_waiting = false;
+    retry_at_msec = 0;
+    set_process_internal(false);
     emit_signal("nano_receive_completed", requester->get_account(), error_message, error_code);
     ERR_FAIL_MSG(error_message);
 }
 
-void NanoReceiver::_nano_request_completed(int p_status, int p_code, const PoolStringArray &headers, const PoolByteArray &p_data) {
-    if(p_status) return cancel_receive_request("Could not communicate with node, see Result error.", p_status);
+void NanoReceiver::cancel() {
+    if(state.load() == READY) return;
+    requester->cancel_rpc(current_request);
+    state = READY;
+    current_request = 0;
+    sign_sequence++;
+    process_waiting = false;
+    retry_at_msec = 0;
+    set_process_internal(false);
+    emit_signal("nano_receive_completed", requester->get_account(), "Cancelled", ERR_SKIP);
+}
+
+Error NanoReceiver::send_step() {
+    Error r = ERR_BUG;
+    switch(state.load()) {
+        case ACCOUNT: r = requester->account_info(); break;
+        case WORK: r = requester->work_generate(work_root, use_peers, "fffffe0000000000"); break;
+        case PROCESS:
+            if(!block_signed) {
+                // _block_signed sends it once the signature is in
+                process_waiting = true;
+                current_request = 0;
+                return OK;
+            }
+            r = requester->process_block(process_subtype, block);
+            break;
+        default: break;
+    }
+    current_request = r ? 0 : requester->get_last_request_id();
+    return r;
+}
+
+void NanoReceiver::_block_signed(int tag, const PoolByteArray & signature) {
+    if(tag != sign_sequence || state.load() == READY) return;
+    block->set_signature_bytes(signature);
+    block_signed = true;
+    if(!process_waiting) return;
+    process_waiting = false;
+    Error r = send_step();
+    if(r == ERR_UNAVAILABLE) cancel_receive_request("Node unavailable, requests are paused after repeated failures", r);
+    else if(r) retry_or_cancel("Could not start request", r);
+}
+
+void NanoReceiver::retry_or_cancel(String error_message, int error_code) {
+    if(retries >= max_retries) return cancel_receive_request(error_message + " (after " + itos(retries) + " retries)", error_code);
+
+    // Jittered exponential backoff, so the watcher's receives don't all come back at the same moment
+    int delay = MIN((int64_t)retry_base_msec << MIN(retries, 16), (int64_t)retry_max_msec);
+    delay = delay / 2 + Math::rand() % (delay / 2 + 1);
+    retries++;
+    schedule_step(delay);
+}
+
+void NanoReceiver::schedule_step(int delay_msec) {
+    current_request = 0;
+    retry_at_msec = OS::get_singleton()->get_ticks_msec() + delay_msec;
+    set_process_internal(true);
+}
+
+bool NanoReceiver::resync(const String & error) {
+    // Someone else moved the account (another device, a wallet, the watcher) between account_info and process.
+    // The frontier is fetched again and the block rebuilt on top of it, instead of failing the whole operation.
+    if(resyncs >= max_resyncs || (error != "Fork" && error != "Gap previous" && error != "Old block")) return false;
+    resyncs++;
+    retries = 0;
+    state = ACCOUNT;
+    // A gap means the node hasn't seen our previous block yet, give it a moment to arrive
+    schedule_step(error == "Gap previous" ? retry_base_msec : 0);
+    return true;
+}
+
+void NanoReceiver::_notification(int what) {
+    if(what != NOTIFICATION_INTERNAL_PROCESS || !retry_at_msec || OS::get_singleton()->get_ticks_msec() < retry_at_msec) return;
+    retry_at_msec = 0;
+    set_process_internal(false);
+    Error r = send_step();
+    if(r == ERR_UNAVAILABLE) cancel_receive_request("Node unavailable, requests are paused after repeated failures", r);
+    else if(r) retry_or_cancel("Could not start request", r);
+}
+
+void NanoReceiver::set_rpc_timeout_msec(int msec) {
+    rpc_timeout_msec = MAX(msec, 0);
+    requester->set_timeout_msec(rpc_timeout_msec);
+}
+
+void NanoReceiver::set_work_timeout_msec(int msec) {
+    work_timeout_msec = MAX(msec, 0);
+    requester->set_work_timeout_msec(work_timeout_msec);
+}
+
+void NanoReceiver::_nano_request_completed(int request_id, String action, int p_status, int p_code, const PoolByteArray &p_data) {
+    if(request_id != current_request) return;
+    // Transport failures, timeouts and overloaded nodes are retried, every step is safe to send again
+    if(p_status) return retry_or_cancel("Could not communicate with node, see Result error.", p_status);
+    if(p_code >= 500 || p_code == 429) return retry_or_cancel("Node returned HTTP " + itos(p_code), p_code);
     
     String json_string;
     json_string.parse_utf8((const char *) p_data.read().ptr(), p_data.size());
@@ -41,23 +145,49 @@ void NanoReceiver::_nano_request_completed(int p_status, int p_code, const PoolS
             String previous = json.get("frontier", "");
             String representative = json.get("representative", "");
             String current_balance = json.get("balance", "");
-            Ref<NanoAmount> balance(memnew(NanoAmount));
-            balance->set_amount(current_balance);
-            balance->add(sending_amount);
-
-            if(previous.empty() || representative.empty() || sending_amount.is_null()) return cancel_receive_request("Unexpected account state", 1);
-            Ref<NanoAccount> rep(memnew(NanoAccount));
-            rep->set_address(representative);
-            
-            block = requester->block_create(previous, rep, balance, linked_send_block);
-            state = WORK;
-            requester->work_generate(previous, use_peers, "fffffe0000000000");
+            // Plain values, nothing is allocated for the balance and representative
+            nano::uint128_union balance;
+            nano::uint256_union previous_hash;
+            if(previous.empty() || representative.empty() || balance.decode_dec(current_balance) || previous_hash.decode_hex(previous)) return cancel_receive_request("Unexpected account state", 1);
+            balance = balance.number() + sending_amount.number();
+            std::array<uint8_t, 32> rep;
+            if(NanoAccount::decode_address(representative, rep)) return cancel_receive_request("Invalid representative address", 1);
+
+            // After a resync the block from the last attempt may turn out to be the frontier already
+            if(resyncs && block.is_valid() && previous == block->get_hash()) {
+                if(ledger.is_valid()) ledger->apply_block(block);
+                state = READY;
+                emit_signal("nano_receive_completed", requester->get_account(), previous, 0);
+                break;
+            }
+
+            block = requester->create_block_raw(previous_hash, rep, balance, linked_send_hash, false);
+            work_root = previous;
         } else { // This account hasn't been opened, so this must be the first receive
             if(error != "Account not found") return cancel_receive_request("JSON Parsing failed at line " + itos(err_line) + " with message: " + err_string, json_error);
-            block = requester->block_create("0", default_rep, sending_amount, linked_send_block);
-            state = WORK;
-            requester->work_generate(requester->get_account()->get_public_key(), use_peers, "fffffe0000000000");
+            if(default_rep.is_null()) return cancel_receive_request("Default representative not set", 1);
+            nano::uint256_union zero;
+            zero.clear();
+            block = requester->create_block_raw(zero, default_rep->get_public_key_bytes(), sending_amount, linked_send_hash, false);
+            work_root = requester->get_account()->get_public_key();
+        }
+        if(block.is_null()) return cancel_receive_request("Could not create block", 1);
+        // Signed on the job pool while the work request is out
+        block_signed = false;
+        process_waiting = false;
+        if(block->sign_async(requester->get_account(), get_instance_id(), "_block_signed", ++sign_sequence)) return cancel_receive_request("Could not sign block", 1);
+
+        retries = 0;
+        if(work_root == cached_work_root && !cached_work.empty()) {
+            // Same root as the work we already have, so it is still valid for the rebuilt block
+            block->set_work(cached_work);
+            state = PROCESS;
+            process_subtype = block->is_open() ? "open" : "receive";
+            if(send_step()) return cancel_receive_request("Could not process block", 1);
+            break;
         }
+        state = WORK;
+        if(send_step()) return cancel_receive_request("Could not request work", 1);
         break;
     }
     case WORK:
@@ -67,23 +197,25 @@ void NanoReceiver::_nano_request_completed(int p_status, int p_code, const PoolS
 
         String work = json.get("work", "");
         String hash = json.get("hash", "");
-        String current_hash = block["hash"];
-
-        Dictionary subblock = block["block"];
-        subblock["work"] = work;
+        cached_work_root = work_root;
+        cached_work = work;
+        block->set_work(work);
 
         state = PROCESS;
-        String subtype;
-        if(subblock.get("previous", "0") == "0") subtype = "open";
-        else subtype = "receive";
-        requester->process(subtype, subblock);
+        process_subtype = block->is_open() ? "open" : "receive";
+        retries = 0;
+        if(send_step()) return cancel_receive_request("Could not process block", 1);
         break;
     }
     case PROCESS:
     {
         String error = json.get("error", "");
-        if(!error.empty()) return cancel_receive_request("Error on process call: " + error, 1);
+        // A resubmitted block the node already has means the first submission made it
+        if(error == "Old block" && retries > 0) json["hash"] = block->get_hash();
+        else if(resync(error)) return;
+        else if(!error.empty()) return cancel_receive_request("Error on process call: " + error, 1);
         String hash = json.get("hash", "");
+        if(ledger.is_valid()) ledger->apply_block(block);
         state = READY;
         emit_signal("nano_receive_completed", requester->get_account(), hash, 0);
         break;
@@ -102,12 +234,26 @@ void NanoReceiver::set_connection_parameters(String node_url, Ref<NanoAccount> d
     this->auth = auth_header;
     this->use_ssl = use_ssl;
     this->use_peers = use_peers;
+
+    requester->set_connection_parameters(node_url, auth_header, use_ssl, this->work_url); // Warms up the pooled connections before the first receive
+    if(node_urls.size()) requester->set_node_urls(node_urls);
+}
+
+void NanoReceiver::set_node_urls(PoolStringArray urls) {
+    node_urls = urls;
+    if(urls.size()) node_url = urls[0];
+    requester->set_node_urls(urls);
 }
 
 void NanoReceiver::receive(Ref<NanoAccount> receiver, String linked_send_block, Ref<NanoAmount> amount, String override_url) {
+    ERR_FAIL_COND_MSG(amount.is_null(), "Amount not set");
+    receive_raw(receiver, linked_send_block, amount->get_amount(), override_url);
+}
+
+void NanoReceiver::receive_raw(Ref<NanoAccount> receiver, String linked_send_block, const nano::uint128_union & amount, String override_url) {
     ERR_FAIL_COND_MSG(receiver->get_private_key().empty(), "Receiver private key not set");
-    ERR_FAIL_COND_MSG(linked_send_block.empty(), "Linked send block not set");
-    ERR_FAIL_COND_MSG(amount->get_raw_amount().empty(), "Amount not set");
+    nano::uint256_union link;
+    ERR_FAIL_COND_MSG(linked_send_block.empty() || link.decode_hex(linked_send_block), "Linked send block not set");
 
     String url = (override_url.empty()) ? node_url : override_url;
     String w_url = (work_url.empty()) ? override_url : work_url;
@@ -116,21 +262,52 @@ void NanoReceiver::receive(Ref<NanoAccount> receiver, String linked_send_block,
     
     ERR_FAIL_COND_MSG(state, "Already in use, only one send can happen per Receiver.");
     state = ACCOUNT;
+    retries = 0;
+    resyncs = 0;
 
     requester->set_connection_parameters(url, auth, use_ssl, w_url);
+    if(override_url.empty() && node_urls.size()) requester->set_node_urls(node_urls);
     requester->set_account(receiver);
 
     this->linked_send_block = linked_send_block;
+    this->linked_send_hash = link;
     this->sending_amount = amount;
 
-    requester->account_info();
+    Error r = send_step();
+    if(r) cancel_receive_request(r == ERR_UNAVAILABLE ? "Node unavailable, requests are paused after repeated failures" : "Could not start request", r);
 }
 
 void NanoReceiver::_bind_methods() {
     ClassDB::bind_method(D_METHOD("is_ready"), &NanoReceiver::is_ready);
+    ClassDB::bind_method(D_METHOD("cancel"), &NanoReceiver::cancel);
     ClassDB::bind_method(D_METHOD("receive", "receiver", "linked_send_block", "amount", "url"), &NanoReceiver::receive, DEFVAL(""));
+    ClassDB::bind_method(D_METHOD("set_node_urls", "urls"), &NanoReceiver::set_node_urls);
+    ClassDB::bind_method(D_METHOD("get_node_urls"), &NanoReceiver::get_node_urls);
     ClassDB::bind_method(D_METHOD("set_connection_parameters", "node_url", "default_representative", "auth_header", "use_ssl", "work_url", "use_peers"), &NanoReceiver::set_connection_parameters, DEFVAL(false), DEFVAL(""), DEFVAL(true), DEFVAL(""));
 
-    ClassDB::bind_method(D_METHOD("_nano_request_completed", "p_status", "p_code", "headers", "p_data"), &NanoReceiver::_nano_request_completed);
+    ClassDB::bind_method(D_METHOD("_nano_request_completed", "request_id", "action", "p_status", "p_code", "p_data"), &NanoReceiver::_nano_request_completed);
+    ClassDB::bind_method(D_METHOD("_block_signed", "tag", "signature"), &NanoReceiver::_block_signed);
+    ClassDB::bind_method(D_METHOD("set_max_retries", "count"), &NanoReceiver::set_max_retries);
+    ClassDB::bind_method(D_METHOD("get_max_retries"), &NanoReceiver::get_max_retries);
+    ClassDB::bind_method(D_METHOD("set_retry_base_msec", "msec"), &NanoReceiver::set_retry_base_msec);
+    ClassDB::bind_method(D_METHOD("get_retry_base_msec"), &NanoReceiver::get_retry_base_msec);
+    ClassDB::bind_method(D_METHOD("set_retry_max_msec", "msec"), &NanoReceiver::set_retry_max_msec);
+    ClassDB::bind_method(D_METHOD("get_retry_max_msec"), &NanoReceiver::get_retry_max_msec);
+    ClassDB::bind_method(D_METHOD("set_max_resyncs", "count"), &NanoReceiver::set_max_resyncs);
+    ClassDB::bind_method(D_METHOD("get_max_resyncs"), &NanoReceiver::get_max_resyncs);
+    ClassDB::bind_method(D_METHOD("set_rpc_timeout_msec", "msec"), &NanoReceiver::set_rpc_timeout_msec);
+    ClassDB::bind_method(D_METHOD("get_rpc_timeout_msec"), &NanoReceiver::get_rpc_timeout_msec);
+    ClassDB::bind_method(D_METHOD("set_work_timeout_msec", "msec"), &NanoReceiver::set_work_timeout_msec);
+    ClassDB::bind_method(D_METHOD("get_work_timeout_msec"), &NanoReceiver::get_work_timeout_msec);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "max_resyncs"), "set_max_resyncs", "get_max_resyncs");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "max_retries"), "set_max_retries", "get_max_retries");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "retry_base_msec"), "set_retry_base_msec", "get_retry_base_msec");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "retry_max_msec"), "set_retry_max_msec", "get_retry_max_msec");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "rpc_timeout_msec"), "set_rpc_timeout_msec", "get_rpc_timeout_msec");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "work_timeout_msec"), "set_work_timeout_msec", "get_work_timeout_msec");
+    ClassDB::bind_method(D_METHOD("set_ledger", "ledger"), &NanoReceiver::set_ledger);
+    ClassDB::bind_method(D_METHOD("get_ledger"), &NanoReceiver::get_ledger);
+    ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "ledger", PROPERTY_HINT_NONE, "", 0), "set_ledger", "get_ledger");
+
     ADD_SIGNAL(MethodInfo("nano_receive_completed", PropertyInfo(Variant::OBJECT, "account"), PropertyInfo(Variant::STRING, "message"), PropertyInfo(Variant::INT, "response_code")));
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "core/crypto/crypto_core.h"
 #include "core/io/json.h"
+#include "core/os/os.h"
 
 void NanoRequest::set_account(Ref<NanoAccount> a) {
     this->account = a;
@@ -13,6 +14,116 @@ void NanoRequest::set_connection_parameters(String node_url, String auth_header,
     else this->work_url = work_url;
     this->auth = auth_header;
     this->use_ssl = use_ssl;
+
+    // use_ssl has always been passed on as domain validation, https urls decide whether tls is used
+    work_endpoint = NanoEndpoint();
+    if(!this->work_url.empty()) NanoEndpoint::parse(this->work_url, use_ssl, work_endpoint);
+
+    PoolStringArray urls;
+    if(!node_url.empty()) urls.push_back(node_url);
+    set_node_urls(urls);
+    if(this->work_url != node_url && NanoConnectionPool::get_singleton()) NanoConnectionPool::get_singleton()->preconnect(work_endpoint);
+    update_processing();
+}
+
+void NanoRequest::set_node_urls(PoolStringArray urls) {
+    node_endpoints.clear();
+    for(int i = 0; i < urls.size(); i++) {
+        NanoEndpoint endpoint;
+        if(NanoEndpoint::parse(urls[i], use_ssl, endpoint) == OK) node_endpoints.push_back(endpoint);
+    }
+    if(urls.size()) node_url = urls[0];
+
+    // Start the handshakes now, so the first request finds a warm connection
+    NanoConnectionPool * pool = NanoConnectionPool::get_singleton();
+    for(int i = 0; pool && i < node_endpoints.size(); i++)
+        pool->preconnect(node_endpoints[i]);
+    update_processing(); // Nothing else polls the pool before the first request
+}
+
+void NanoRequest::update_processing() {
+    NanoConnectionPool * pool = NanoConnectionPool::get_singleton();
+    set_process_internal(!calls.empty() || !detached.empty() || (pool && pool->is_handshaking()));
+}
+
+PoolStringArray NanoRequest::get_node_urls() {
+    PoolStringArray urls;
+    for(int i = 0; i < node_endpoints.size(); i++) {
+        const NanoEndpoint & e = node_endpoints[i];
+        urls.push_back((e.ssl ? "https://" : "http://") + e.host + ":" + itos(e.port) + e.path);
+    }
+    return urls;
+}
+
+Array NanoRequest::get_node_stats() {
+    Array stats;
+    PoolStringArray urls = get_node_urls();
+    for(int i = 0; i < node_endpoints.size(); i++) {
+        Dictionary d = NanoNodeStats::get_singleton()->get_stats(node_endpoints[i].get_key());
+        Dictionary scheduling = NanoScheduler::get_singleton()->get_stats(node_endpoints[i].get_key());
+        for(int k = 0; k < scheduling.size(); k++)
+            d[scheduling.get_key_at_index(k)] = scheduling.get_value_at_index(k);
+        d["url"] = urls[i];
+        stats.append(d);
+    }
+    return stats;
+}
+
+bool NanoRequest::is_read_only(const String & action) {
+    static const char * read_only[] = {
+        "account_balance", "account_block_count", "account_history", "account_info", "account_key", "account_representative",
+        "account_weight", "accounts_balances", "accounts_frontiers", "accounts_pending", "accounts_receivable", "active_difficulty",
+        "block_account", "block_count", "block_info", "blocks", "blocks_info", "chain", "frontiers", "pending", "pending_exists",
+        "receivable", "receivable_exists", "representatives", "representatives_online", "successors", "telemetry", "version", NULL
+    };
+    for(int i = 0; read_only[i]; i++) {
+        if(action == read_only[i]) return true;
+    }
+    return false;
+}
+
+bool NanoRequest::pick_node(const Vector<String> & exclude, NanoEndpoint & r_endpoint) {
+    NanoNodeStats * stats = NanoNodeStats::get_singleton();
+    Vector<String> rejected = exclude;
+    while(true) {
+        int best = -1;
+        double best_score = 0;
+        for(int i = 0; i < node_endpoints.size(); i++) {
+            String key = node_endpoints[i].get_key();
+            if(rejected.find(key) != -1 || !stats->is_healthy(key)) continue;
+            double score = stats->get_score(key);
+            if(best == -1 || score < best_score) {
+                best = i;
+                best_score = score;
+            }
+        }
+        if(best == -1) return false;
+
+        // A node coming back from a cooldown only gets one probe at a time
+        String key = node_endpoints[best].get_key();
+        if(stats->allow_request(key)) {
+            r_endpoint = node_endpoints[best];
+            return true;
+        }
+        rejected.push_back(key);
+    }
+}
+
+String NanoRequest::get_stats_key(const Call & call, const NanoEndpoint & endpoint) {
+    // Work servers are tracked apart from the node, work latency says nothing about rpc latency
+    return call.is_work ? "work:" + endpoint.get_key() : endpoint.get_key();
+}
+
+Error NanoRequest::start_attempt(Call & call, const NanoEndpoint & endpoint) {
+    NanoHttpExchange & attempt = call.attempts.push_back(NanoHttpExchange())->get();
+    if(call.stream) attempt.set_body_sink(call.stream);
+    Error r = attempt.start(endpoint, get_common_headers(), call.body, priority);
+    if(r) {
+        call.attempts.pop_back();
+        return r;
+    }
+    call.tried.push_back(endpoint.get_key());
+    return OK;
 }
 
 String NanoRequest::basic_auth_header(String username, String password) {
@@ -33,92 +144,620 @@ Vector<String> NanoRequest::get_common_headers() {
     return headers;
 }
 
-Error NanoRequest::nano_request(Dictionary body, bool is_work) {
-    String url = (is_work) ? work_url : node_url;
-    if(url.empty()) return Error::ERR_UNCONFIGURED;
+Error NanoRequest::submit(Dictionary body, bool is_work, int & r_request_id) {
+    if(is_work ? !work_endpoint.is_valid() : node_endpoints.empty()) return Error::ERR_UNCONFIGURED;
 
     String action = body["action"];
     if(action.empty()) return ERR_INVALID_PARAMETER;
 
-    String data = JSON::print(body);
-    Error r = request(url, get_common_headers(), use_ssl, HTTPClient::METHOD_POST, data);
+    writer.clear();
+    writer.variant(body);
+
+    String process_account;
+    if(action == "process" && body.get("block", Variant()).get_type() == Variant::DICTIONARY) process_account = Dictionary(body["block"]).get("account", "");
+    bool stream = stream_records && !is_work && NanoRecordStream::is_streamable(action);
+    return submit_raw(action, writer.to_pool(), is_work, NanoResponseCache::get_accounts(body), process_account, stream, r_request_id);
+}
+
+Error NanoRequest::submit_written(const String & action, bool is_work, const String & account) {
+    Vector<String> accounts;
+    if(!account.empty()) accounts.push_back(account);
+    int id;
+    bool stream = stream_records && !is_work && NanoRecordStream::is_streamable(action);
+    return submit_raw(action, writer.to_pool(), is_work, accounts, action == "process" ? account : String(), stream, id);
+}
+
+Error NanoRequest::submit_raw(const String & action, const PoolByteArray & raw, bool is_work, const Vector<String> & accounts, const String & process_account, bool stream, int & r_request_id) {
+    if(is_work ? !work_endpoint.is_valid() : node_endpoints.empty()) return Error::ERR_UNCONFIGURED;
+
+    int id = next_request_id++;
+    Call & call = calls[id];
+    call.action = action;
+    call.is_work = is_work;
+    call.body = raw;
+    call.process_account = process_account;
+    if(stream) {
+        call.stream = &streams[id];
+        call.stream->begin(action);
+    }
+
+    // Streamed answers are not kept whole, so there is nothing to cache or to share
+    NanoResponseCache * cache = NanoResponseCache::get_singleton();
+    if(!is_work && !stream && use_cache && cache->get_ttl(action) > 0) {
+        call.cache_key = NanoResponseCache::make_key(get_cache_scope(), raw);
+        if(cache->lookup(call.cache_key, call.response)) call.has_response = true;
+        else if(!cache->begin(call.cache_key, accounts, get_instance_id(), id)) call.waiting = true;
+        else call.leader = true;
 
-    if(r) return r;
-    current_action = action;
-    last_reply.clear();
+        // Answers from the cache still arrive through rpc_completed on the next frame, like any other
+        if(!call.leader) {
+            last_request_id = id;
+            r_request_id = id;
+            set_process_internal(true);
+            return OK;
+        }
+    }
+
+    // With every circuit open the call fails right away, instead of waiting on a node that is known to be down
+    Error r = ERR_UNAVAILABLE;
+    if(is_work) {
+        if(NanoNodeStats::get_singleton()->allow_request(get_stats_key(call, work_endpoint))) r = start_attempt(call, work_endpoint);
+    } else {
+        // process goes to several nodes at once, so the block propagates from more than one place
+        int fanout = (action == "process") ? MIN(process_broadcast, node_endpoints.size()) : 1;
+        NanoEndpoint endpoint;
+        for(int i = 0; i < fanout && pick_node(call.tried, endpoint); i++) {
+            Error attempt_error = start_attempt(call, endpoint);
+            if(attempt_error && call.attempts.empty()) r = attempt_error;
+        }
+        if(hedging && !stream && is_read_only(action) && node_endpoints.size() > 1 && !call.attempts.empty()) {
+            uint64_t delay = NanoNodeStats::get_singleton()->get_p95_usec(call.tried[0], hedge_delay_msec * 1000);
+            call.hedge_at_usec = OS::get_singleton()->get_ticks_usec() + MAX(delay, (uint64_t)hedge_delay_msec * 1000);
+        }
+    }
+    if(call.attempts.empty()) {
+        if(call.leader) cache->complete(call.cache_key, action, NanoResponse());
+        calls.erase(id);
+        streams.erase(id);
+        return r;
+    }
+
+    last_request_id = id;
+    r_request_id = id;
+    set_process_internal(true);
+    return OK;
+}
+
+bool NanoRequest::poll_call(Call & call, NanoResponse & r_response) {
+    if(call.has_response) {
+        r_response = call.response;
+        return true;
+    }
+    if(call.waiting) return false;
+
+    NanoNodeStats * stats = NanoNodeStats::get_singleton();
+    bool answered = false;
+
+    uint64_t timeout_usec = (uint64_t)(call.is_work ? work_timeout_msec : timeout_msec) * 1000;
+    List<NanoHttpExchange>::Element * a = call.attempts.front();
+    while(a) {
+        List<NanoHttpExchange>::Element * next = a->next();
+        NanoHttpExchange & attempt = a->get();
+        if(timeout_usec && attempt.get_elapsed_usec() >= timeout_usec) attempt.expire();
+        if(attempt.poll()) {
+            bool ok = attempt.get_result() == HTTPRequest::RESULT_SUCCESS && attempt.get_response_code() < 500 && attempt.get_response_code() != 429;
+            String key = get_stats_key(call, attempt.get_endpoint());
+            if(ok) stats->record_success(key, attempt.get_elapsed_usec());
+            else stats->record_failure(key);
+            if(ok && !answered) {
+                r_response = attempt.get_response();
+                if(call.stream && r_response.response_code == 200) r_response.body = call.stream->get_summary();
+                answered = true;
+            } else if(!ok) call.last_failure = attempt;
+            call.attempts.erase(a);
+        }
+        a = next;
+    }
+
+    if(answered) {
+        // Other copies of a process keep going so every node gets the block, a hedge that lost is dropped
+        for(List<NanoHttpExchange>::Element * e = call.attempts.front(); e; e = e->next()) {
+            if(call.action == "process") detached.push_back(e->get());
+            else e->get().cancel();
+        }
+        call.attempts.clear();
+        return true;
+    }
+
+    if(!call.attempts.empty()) {
+        if(call.hedge_at_usec && OS::get_singleton()->get_ticks_usec() >= call.hedge_at_usec) {
+            call.hedge_at_usec = 0;
+            NanoEndpoint endpoint;
+            if(pick_node(call.tried, endpoint)) start_attempt(call, endpoint);
+        }
+        return false;
+    }
+
+    // Every attempt failed, calls that are safe to repeat fail over to a node that has not been tried yet.
+    // A stream that already passed on records can't start over without repeating them.
+    bool streamed = call.stream && call.stream->has_data();
+    if(!call.is_work && !streamed && (is_read_only(call.action) || call.action == "process")) {
+        NanoEndpoint endpoint;
+        if(pick_node(call.tried, endpoint) && start_attempt(call, endpoint) == OK) return false;
+    }
+    r_response = call.last_failure.get_response();
+    return true;
+}
 
-    return r;
+String NanoRequest::get_cache_scope() const {
+    String scope = auth;
+    for(int i = 0; i < node_endpoints.size(); i++)
+        scope += "|" + node_endpoints[i].get_key();
+    return scope;
 }
 
+void NanoRequest::release_cache(int request_id, Call & call) {
+    NanoResponseCache * cache = NanoResponseCache::get_singleton();
+    if(call.waiting) cache->remove_waiter(call.cache_key, get_instance_id(), request_id);
+    else if(call.leader) {
+        NanoResponse failed;
+        failed.result = HTTPRequest::RESULT_REQUEST_FAILED;
+        cache->complete(call.cache_key, call.action, failed);
+    }
+}
+
+void NanoRequest::deliver_response(int request_id, const NanoResponse & response) {
+    Map<int, Call>::Element * e = calls.find(request_id);
+    if(!e) return;
+    e->get().waiting = false;
+    e->get().has_response = true;
+    e->get().response = response;
+    set_process_internal(true);
+}
+
+void NanoRequest::set_rate_limit(String url, float requests_per_second, int burst) {
+    NanoEndpoint endpoint;
+    ERR_FAIL_COND_MSG(NanoEndpoint::parse(url, true, endpoint), "Invalid url: " + url);
+    NanoScheduler::get_singleton()->set_rate_limit(endpoint.get_key(), requests_per_second, burst);
+}
+
+void NanoRequest::set_cache_ttl(String action, int msec) {
+    NanoResponseCache::get_singleton()->set_ttl(action, msec);
+}
+
+int NanoRequest::get_cache_ttl(String action) {
+    return NanoResponseCache::get_singleton()->get_ttl(action);
+}
+
+void NanoRequest::clear_cache() {
+    NanoResponseCache::get_singleton()->clear();
+}
+
+Error NanoRequest::nano_request(Dictionary body, bool is_work) {
+    int id;
+    return submit(body, is_work, id);
+}
+
+int NanoRequest::request_rpc(Dictionary body, bool is_work) {
+    int id = 0;
+    Error r = submit(body, is_work, id);
+    ERR_FAIL_COND_V_MSG(r, 0, "Could not start request, error: " + itos(r));
+    return id;
+}
+
+Error NanoRequest::request(String url, PoolStringArray custom_headers, bool ssl_validate_domain, int method, String request_data) {
+    // Node RPC only: the body is sent like nano_request, to the configured nodes, or to the work url when that is the one asked for
+    ERR_FAIL_COND_V_MSG(method != HTTPClient::METHOD_POST, ERR_INVALID_PARAMETER, "Node RPC calls are POST requests");
+    Variant json;
+    String err_string;
+    int err_line;
+    ERR_FAIL_COND_V_MSG(JSON::parse(request_data, json, err_string, err_line) || json.get_type() != Variant::DICTIONARY, ERR_PARSE_ERROR, "request_data must be a JSON object");
+    bool is_work = !url.empty() && url == work_url && url != node_url;
+    if(!url.empty() && url != node_url && !is_work) WARN_PRINT("NanoRequest.request sends to the configured nodes, not to " + url);
+    return nano_request(json, is_work);
+}
+
+void NanoRequest::cancel_rpc(int request_id) {
+    Map<int, Call>::Element * e = calls.find(request_id);
+    if(!e) return;
+    if(e->get().leader && NanoResponseCache::get_singleton()->has_waiters(e->get().cache_key)) {
+        e->get().silent = true; // Other requests are waiting on this answer
+        return;
+    }
+    for(List<NanoHttpExchange>::Element * a = e->get().attempts.front(); a; a = a->next())
+        a->get().cancel();
+    release_cache(request_id, e->get());
+    calls.erase(e);
+    streams.erase(request_id);
+    if(calls.empty() && detached.empty()) update_processing();
+}
+
+void NanoRequest::cancel_request() {
+    for(Map<int, Call>::Element * e = calls.front(); e; e = e->next()) {
+        for(List<NanoHttpExchange>::Element * a = e->get().attempts.front(); a; a = a->next())
+            a->get().cancel();
+        release_cache(e->key(), e->get());
+    }
+    for(List<NanoHttpExchange>::Element * a = detached.front(); a; a = a->next())
+        a->get().cancel();
+    calls.clear();
+    streams.clear();
+    detached.clear();
+    batches.clear();
+    for(Map<int, BatchChunk>::Element * e = batch_chunks.front(); e; e = e->next())
+        cancelled_chunks.insert(e->key());
+    batch_chunks.clear();
+    update_processing();
+}
+
+NanoRequest::~NanoRequest() {
+    // Queued requests hold a place in NanoScheduler until they are cancelled, also for requesters freed outside the tree
+    cancel_request();
+}
+
+void NanoRequest::_notification(int p_what) {
+    switch(p_what) {
+        case NOTIFICATION_INTERNAL_PROCESS: {
+            NanoConnectionPool::get_singleton()->poll();
+
+            List<NanoHttpExchange>::Element * d = detached.front();
+            while(d) {
+                List<NanoHttpExchange>::Element * next = d->next();
+                if(timeout_msec && d->get().get_elapsed_usec() >= (uint64_t)timeout_msec * 1000) d->get().expire();
+                if(d->get().poll()) {
+                    bool ok = d->get().get_result() == HTTPRequest::RESULT_SUCCESS && d->get().get_response_code() < 500;
+                    if(ok) NanoNodeStats::get_singleton()->record_success(d->get().get_endpoint().get_key(), d->get().get_elapsed_usec());
+                    else NanoNodeStats::get_singleton()->record_failure(d->get().get_endpoint().get_key());
+                    detached.erase(d);
+                }
+                d = next;
+            }
+
+            // Finished calls are taken out before any signal goes out, handlers are free to start new requests
+            List<int> finished_ids;
+            List<String> finished_actions;
+            List<NanoResponse> finished;
+            List<int> streamed_ids;
+            List<String> streamed_actions;
+            List<Dictionary> streamed;
+            NanoResponseCache * cache = NanoResponseCache::get_singleton();
+            Map<int, Call>::Element * e = calls.front();
+            while(e) {
+                Map<int, Call>::Element * next = e->next();
+                NanoResponse answer;
+                bool done = poll_call(e->get(), answer);
+                if(e->get().stream && e->get().stream->has_records() && !e->get().silent) {
+                    streamed_ids.push_back(e->key());
+                    streamed_actions.push_back(e->get().action);
+                    streamed.push_back(e->get().stream->take_records());
+                }
+                if(done) {
+                    const Call & call = e->get();
+                    if(call.leader) cache->complete(call.cache_key, call.action, answer);
+                    // Whatever was cached about the account is out of date once a block for it is in
+                    if(!call.process_account.empty() && answer.result == HTTPRequest::RESULT_SUCCESS && answer.response_code == 200) cache->invalidate_account(call.process_account);
+                    if(!call.silent) {
+                        finished_ids.push_back(e->key());
+                        finished_actions.push_back(call.action);
+                        finished.push_back(answer);
+                    }
+                    streams.erase(e->key());
+                    calls.erase(e);
+                }
+                e = next;
+            }
+            if(calls.empty() && detached.empty()) update_processing();
+
+            List<int>::Element * streamed_id = streamed_ids.front();
+            List<String>::Element * streamed_action = streamed_actions.front();
+            for(List<Dictionary>::Element * r = streamed.front(); r; r = r->next(), streamed_id = streamed_id->next(), streamed_action = streamed_action->next())
+                emit_signal("records_received", streamed_id->get(), streamed_action->get(), r->get());
+
+            List<int>::Element * id = finished_ids.front();
+            List<String>::Element * action = finished_actions.front();
+            for(List<NanoResponse>::Element * c = finished.front(); c; c = c->next(), id = id->next(), action = action->next()) {
+                const NanoResponse & response = c->get();
+                if(cancelled_chunks.has(id->get())) continue; // Its batch was cancelled by an earlier handler
+                Map<int, BatchChunk>::Element * chunk = batch_chunks.find(id->get());
+                if(chunk) { // Chunks are reported through the batch signals only
+                    BatchChunk finished_chunk = chunk->get();
+                    batch_chunks.erase(chunk);
+                    batch_chunk_completed(finished_chunk, response);
+                    continue;
+                }
+                if(body_size_limit >= 0 && response.body.size() > body_size_limit) {
+                    emit_signal("rpc_completed", id->get(), action->get(), HTTPRequest::RESULT_BODY_SIZE_LIMIT_EXCEEDED, response.response_code, PoolByteArray());
+                    emit_signal("request_completed", HTTPRequest::RESULT_BODY_SIZE_LIMIT_EXCEEDED, response.response_code, response.headers, PoolByteArray());
+                    continue;
+                }
+                emit_signal("rpc_completed", id->get(), action->get(), response.result, response.response_code, response.body);
+                emit_signal("request_completed", response.result, response.response_code, response.headers, response.body);
+            }
+            cancelled_chunks.clear(); // Later answers of cancelled chunks can't arrive, their calls are gone
+            break;
+        }
+        case NOTIFICATION_EXIT_TREE: {
+            cancel_request();
+            break;
+        }
+    }
+}
+
+// The built in requests write their bodies directly, keys in sorted order
 Error NanoRequest::account_balance() {
-    Dictionary data;
-    data["action"] = "account_balance";
-    data["account"] = account->get_address();
-    return nano_request(data);
+    String address = account->get_address();
+    writer.clear();
+    writer.begin_object();
+    writer.string("account", address);
+    writer.string("action", "account_balance");
+    writer.end_object();
+    return submit_written("account_balance", false, address);
 }
 
 Error NanoRequest::account_info(bool include_confirmed) {
-    Dictionary data;
-    data["action"] = "account_info";
-    data["account"] = account->get_address();
-    data["include_confirmed"] = include_confirmed;
-    data["representative"] = true;
-
-    return nano_request(data);
+    String address = account->get_address();
+    writer.clear();
+    writer.begin_object();
+    writer.string("account", address);
+    writer.string("action", "account_info");
+    writer.boolean("include_confirmed", include_confirmed);
+    writer.boolean("representative", true);
+    writer.end_object();
+    return submit_written("account_info", false, address);
 }
 
 Dictionary NanoRequest::block_create(String previous, Ref<NanoAccount> representative, Ref<NanoAmount> balance, String link, String work) {
-    uint256_union prev(previous);
-    String signature = account->sign(prev.to_string(), representative, balance, link);
-
-    Dictionary block;
-    block["type"] = "state";
-    block["account"] = account->get_address();
-    block["previous"] = prev.to_string();
-    block["representative"] = representative->get_address();
-    block["balance"] = balance->get_raw_amount();
-    block["link"] = link;
-    block["signature"] = signature;
-    if(!work.empty()) block["work"] = work;
+    Ref<NanoBlock> block = create_block(previous, representative, balance, link, work);
+    ERR_FAIL_COND_V(block.is_null(), Dictionary());
 
     Dictionary dict;
-    dict["block"] = block;
-    dict["hash"] = account->block_hash(previous, representative, balance, link);
+    dict["block"] = block->to_json();
+    dict["hash"] = block->get_hash();
     return dict;
 }
 
+Ref<NanoBlock> NanoRequest::create_block(String previous, Ref<NanoAccount> representative, Ref<NanoAmount> balance, String link, String work) {
+    ERR_FAIL_COND_V(representative.is_null() || balance.is_null(), Ref<NanoBlock>());
+    uint256_union prev, link_u;
+    ERR_FAIL_COND_V_MSG(prev.decode_hex(previous), Ref<NanoBlock>(), "Invalid previous: " + previous);
+    ERR_FAIL_COND_V_MSG(link_u.decode_hex(link), Ref<NanoBlock>(), "Invalid link: " + link);
+
+    Ref<NanoBlock> block = create_block_raw(prev, representative->get_public_key_bytes(), balance->get_amount(), link_u);
+    if(block.is_valid() && !work.empty()) block->set_work(work);
+    return block;
+}
+
+Ref<NanoBlock> NanoRequest::create_block_raw(const nano::uint256_union & previous, const std::array<uint8_t, 32> & representative, const nano::uint128_union & balance, const nano::uint256_union & link, bool p_sign) {
+    ERR_FAIL_COND_V_MSG(account.is_null(), Ref<NanoBlock>(), "Account not set");
+    // Hashed once here, the signature and the hash reported back both come from it
+    Ref<NanoBlock> block(memnew(NanoBlock));
+    block->set_fields(account->get_public_key_bytes(), previous, representative, balance, link);
+    if(p_sign && block->sign(account)) return Ref<NanoBlock>();
+    return block;
+}
+
 Error NanoRequest::pending(int count, String threshold) {
-    Dictionary data;
-    data["action"] = "pending";
-    data["account"] = account->get_address();
-    if(count) data["count"] = count;
     if(!threshold.empty()) {
         // Validate amount is in proper format
         NanoAmount amount;
         amount.set_amount(threshold);
-        data["threshold"] = threshold;
     }
 
-    return nano_request(data);
+    String address = account->get_address();
+    writer.clear();
+    writer.begin_object();
+    writer.string("account", address);
+    writer.string("action", "pending");
+    if(count) writer.integer("count", count);
+    if(!threshold.empty()) writer.string("threshold", threshold);
+    writer.end_object();
+    return submit_written("pending", false, address);
 }
 
 Error NanoRequest::process(String subtype, Dictionary block) {
-    Dictionary data;
-    data["action"] = "process";
-    data["json_block"] = true;
-    data["subtype"] = subtype;
-    data["block"] = block;
+    writer.clear();
+    writer.begin_object();
+    writer.string("action", "process");
+    writer.variant("block", block);
+    writer.boolean("json_block", true);
+    writer.string("subtype", subtype);
+    writer.end_object();
+    return submit_written("process", false, block.get("account", ""));
+}
 
-    return nano_request(data);
+Error NanoRequest::process_block(String subtype, Ref<NanoBlock> block) {
+    ERR_FAIL_COND_V(block.is_null(), ERR_INVALID_PARAMETER);
+    writer.clear();
+    writer.begin_object();
+    writer.string("action", "process");
+    block->write_json(writer, "block");
+    writer.boolean("json_block", true);
+    writer.string("subtype", subtype);
+    writer.end_object();
+    return submit_written("process", false, block->get_account());
 }
 
 Error NanoRequest::work_generate(String hash, bool use_peers, String difficulty) {
-    Dictionary data;
-    data["action"] = "work_generate";
-    data["hash"] = hash;
-    data["difficulty"] = difficulty;
-    if(use_peers) data["use_peers"] = use_peers;
-    return nano_request(data);
+    writer.clear();
+    writer.begin_object();
+    writer.string("action", "work_generate");
+    writer.string("difficulty", difficulty);
+    writer.string("hash", hash);
+    if(use_peers) writer.boolean("use_peers", true);
+    writer.end_object();
+    return submit_written("work_generate", true, "");
+}
+
+int NanoRequest::start_batch(String action, String result_key, Array accounts, Dictionary params, bool stream) {
+    ERR_FAIL_COND_V_MSG(node_endpoints.empty(), 0, "Url not set");
+    ERR_FAIL_COND_V_MSG(accounts.empty(), 0, "No accounts given");
+
+    int batch_id = next_batch_id++;
+    Batch & batch = batches[batch_id];
+    batch.action = action;
+    batch.result_key = result_key;
+    batch.params = params;
+    batch.stream = stream;
+    for(int i = 0; i < accounts.size(); i++) {
+        // Accepts NanoAccounts as well as plain addresses
+        Ref<NanoAccount> acc = accounts[i];
+        batch.addresses.push_back(acc.is_valid() ? acc->get_address() : String(accounts[i]));
+    }
+
+    send_batch_chunks(batch_id);
+    return batch_id;
+}
+
+void NanoRequest::send_batch_chunks(int batch_id) {
+    Map<int, Batch>::Element * e = batches.find(batch_id);
+    if(!e) return;
+    Batch & batch = e->get();
+
+    while(batch.chunks_in_flight < batch_concurrency && batch.next_chunk_start < batch.addresses.size()) {
+        BatchChunk chunk;
+        chunk.batch_id = batch_id;
+        chunk.start = batch.next_chunk_start;
+        chunk.end = MIN(chunk.start + batch_size, batch.addresses.size());
+        batch.next_chunk_start = chunk.end;
+
+        // Written field by field, the chunk's addresses go in without an Array or a copy of params
+        List<Variant> keys;
+        batch.params.get_key_list(&keys);
+        keys.push_back("accounts");
+        keys.push_back("action");
+        keys.sort();
+        writer.clear();
+        writer.begin_object();
+        Vector<String> addresses;
+        for(List<Variant>::Element * k = keys.front(); k; k = k->next()) {
+            String key = k->get();
+            if(key == "accounts") {
+                writer.begin_array("accounts");
+                for(int i = chunk.start; i < chunk.end; i++) {
+                    writer.string(batch.addresses[i]);
+                    addresses.push_back(batch.addresses[i]);
+                }
+                writer.end_array();
+            } else if(key == "action") writer.string("action", batch.action);
+            else writer.variant(key.utf8().get_data(), batch.params[key]);
+        }
+        writer.end_object();
+
+        int request_id;
+        Error err = submit_raw(batch.action, writer.to_pool(), false, addresses, "", false, request_id);
+        if(err) {
+            for(int i = chunk.start; i < chunk.end; i++) batch.errors[batch.addresses[i]] = "Could not start request, error: " + itos(err);
+            continue;
+        }
+        batch_chunks[request_id] = chunk;
+        batch.chunks_in_flight++;
+    }
+
+    // Deferred, when no chunk could be started this runs inside start_batch and the caller doesn't have the id yet
+    if(batch.chunks_in_flight == 0 && !batch.finishing) {
+        batch.finishing = true;
+        call_deferred("_finish_batch", batch_id);
+    }
+}
+
+void NanoRequest::_finish_batch(int batch_id) {
+    Map<int, Batch>::Element * e = batches.find(batch_id);
+    if(!e) return; // Cancelled in the meantime
+    Dictionary result;
+    result[e->get().result_key] = e->get().merged;
+    if(!e->get().errors.empty()) result["errors"] = e->get().errors;
+    String action = e->get().action;
+    batches.erase(e);
+    emit_signal("batch_completed", batch_id, action, result);
+}
+
+void NanoRequest::batch_chunk_completed(const BatchChunk & chunk, const NanoResponse & response) {
+    Map<int, Batch>::Element * e = batches.find(chunk.batch_id);
+    if(!e) return;
+    Batch & batch = e->get();
+    batch.chunks_in_flight--;
+
+    const PoolByteArray & body = response.body;
+    String json_string;
+    json_string.parse_utf8((const char *) body.read().ptr(), body.size());
+
+    Variant json_result;
+    String err_string;
+    int err_line;
+    Dictionary json;
+    String error;
+    if(response.result) error = "Could not communicate with node, result: " + itos(response.result);
+    else if(JSON::parse(json_string, json_result, err_string, err_line)) error = "JSON Parsing failed at line " + itos(err_line) + " with message: " + err_string;
+    else {
+        json = json_result;
+        error = json.get("error", "");
+    }
+
+    Dictionary part;
+    Dictionary chunk_errors;
+    if(!error.empty()) {
+        // The whole chunk failed, every account in it is reported with the same error
+        for(int i = chunk.start; i < chunk.end; i++) chunk_errors[batch.addresses[i]] = error;
+    } else {
+        Variant v = json.get(batch.result_key, Dictionary());
+        if(v.get_type() == Variant::DICTIONARY) part = v;
+        Variant errors = json.get("errors", Dictionary());
+        if(errors.get_type() == Variant::DICTIONARY) chunk_errors = errors;
+    }
+
+    Array keys = chunk_errors.keys();
+    for(int i = 0; i < keys.size(); i++) batch.errors[keys[i]] = chunk_errors[keys[i]];
+
+    if(batch.stream) {
+        Dictionary result;
+        result[batch.result_key] = part;
+        if(!chunk_errors.empty()) result["errors"] = chunk_errors;
+        emit_signal("batch_chunk_completed", chunk.batch_id, batch.action, result);
+    } else {
+        keys = part.keys();
+        for(int i = 0; i < keys.size(); i++) batch.merged[keys[i]] = part[keys[i]];
+    }
+
+    // The batch may have been cancelled from a chunk handler
+    if(batches.has(chunk.batch_id)) send_batch_chunks(chunk.batch_id);
+}
+
+void NanoRequest::cancel_batch(int batch_id) {
+    Map<int, BatchChunk>::Element * e = batch_chunks.front();
+    while(e) {
+        Map<int, BatchChunk>::Element * next = e->next();
+        if(e->get().batch_id == batch_id) {
+            cancel_rpc(e->key());
+            cancelled_chunks.insert(e->key()); // It may already be among this frame's finished calls
+            batch_chunks.erase(e);
+        }
+        e = next;
+    }
+    batches.erase(batch_id);
+}
+
+int NanoRequest::accounts_balances(Array accounts, bool stream) {
+    return start_batch("accounts_balances", "balances", accounts, Dictionary(), stream);
+}
+
+int NanoRequest::accounts_frontiers(Array accounts, bool stream) {
+    return start_batch("accounts_frontiers", "frontiers", accounts, Dictionary(), stream);
+}
+
+int NanoRequest::accounts_pending(Array accounts, int count, String threshold, bool source, bool stream) {
+    Dictionary params;
+    if(count) {
+        params["count"] = count;
+        params["sorting"] = true; // With a count, the largest receivables are the ones kept
+    }
+    if(!threshold.empty()) {
+        // Validate amount is in proper format
+        NanoAmount amount;
+        ERR_FAIL_COND_V(amount.set_amount(threshold), 0);
+        params["threshold"] = threshold;
+    }
+    if(source) params["source"] = true;
+    return start_batch("accounts_pending", "blocks", accounts, params, stream);
 }
 
 void NanoRequest::_bind_methods() {
@@ -126,13 +765,87 @@ void NanoRequest::_bind_methods() {
     ClassDB::bind_method(D_METHOD("set_account", "account"), &NanoRequest::set_account);
     ClassDB::bind_method(D_METHOD("set_connection_parameters", "node_url", "auth_header", "use_ssl", "work_url"), &NanoRequest::set_connection_parameters, DEFVAL(""), DEFVAL(true),  DEFVAL(""));
     ClassDB::bind_method(D_METHOD("basic_auth_header", "username", "password"), &NanoRequest::basic_auth_header);
+    ClassDB::bind_method(D_METHOD("set_node_urls", "urls"), &NanoRequest::set_node_urls);
+    ClassDB::bind_method(D_METHOD("get_node_urls"), &NanoRequest::get_node_urls);
+    ClassDB::bind_method(D_METHOD("get_node_stats"), &NanoRequest::get_node_stats);
+    ClassDB::bind_method(D_METHOD("set_hedging", "enabled"), &NanoRequest::set_hedging);
+    ClassDB::bind_method(D_METHOD("get_hedging"), &NanoRequest::get_hedging);
+    ClassDB::bind_method(D_METHOD("set_hedge_delay_msec", "msec"), &NanoRequest::set_hedge_delay_msec);
+    ClassDB::bind_method(D_METHOD("get_hedge_delay_msec"), &NanoRequest::get_hedge_delay_msec);
+    ClassDB::bind_method(D_METHOD("set_process_broadcast", "count"), &NanoRequest::set_process_broadcast);
+    ClassDB::bind_method(D_METHOD("get_process_broadcast"), &NanoRequest::get_process_broadcast);
+    ADD_PROPERTY(PropertyInfo(Variant::POOL_STRING_ARRAY, "node_urls"), "set_node_urls", "get_node_urls");
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "hedging"), "set_hedging", "get_hedging");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "hedge_delay_msec"), "set_hedge_delay_msec", "get_hedge_delay_msec");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "process_broadcast"), "set_process_broadcast", "get_process_broadcast");
+    ClassDB::bind_method(D_METHOD("set_priority", "priority"), &NanoRequest::set_priority);
+    ClassDB::bind_method(D_METHOD("get_priority"), &NanoRequest::get_priority);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "priority", PROPERTY_HINT_ENUM, "Interactive,Normal,Background"), "set_priority", "get_priority");
+    ClassDB::bind_method(D_METHOD("set_rate_limit", "url", "requests_per_second", "burst"), &NanoRequest::set_rate_limit, DEFVAL(0));
+    ClassDB::bind_method(D_METHOD("set_stream_records", "enabled"), &NanoRequest::set_stream_records);
+    ClassDB::bind_method(D_METHOD("get_stream_records"), &NanoRequest::get_stream_records);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "stream_records"), "set_stream_records", "get_stream_records");
+    ClassDB::bind_method(D_METHOD("set_use_cache", "enabled"), &NanoRequest::set_use_cache);
+    ClassDB::bind_method(D_METHOD("get_use_cache"), &NanoRequest::get_use_cache);
+    ClassDB::bind_method(D_METHOD("set_cache_ttl", "action", "msec"), &NanoRequest::set_cache_ttl);
+    ClassDB::bind_method(D_METHOD("get_cache_ttl", "action"), &NanoRequest::get_cache_ttl);
+    ClassDB::bind_method(D_METHOD("clear_cache"), &NanoRequest::clear_cache);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "use_cache"), "set_use_cache", "get_use_cache");
+    ClassDB::bind_method(D_METHOD("set_timeout_msec", "msec"), &NanoRequest::set_timeout_msec);
+    ClassDB::bind_method(D_METHOD("get_timeout_msec"), &NanoRequest::get_timeout_msec);
+    ClassDB::bind_method(D_METHOD("set_work_timeout_msec", "msec"), &NanoRequest::set_work_timeout_msec);
+    ClassDB::bind_method(D_METHOD("get_work_timeout_msec"), &NanoRequest::get_work_timeout_msec);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "timeout_msec"), "set_timeout_msec", "get_timeout_msec");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "work_timeout_msec"), "set_work_timeout_msec", "get_work_timeout_msec");
+
+    ClassDB::bind_method(D_METHOD("request", "url", "custom_headers", "ssl_validate_domain", "method", "request_data"), &NanoRequest::request, DEFVAL(PoolStringArray()), DEFVAL(true), DEFVAL(HTTPClient::METHOD_POST), DEFVAL(""));
+    ClassDB::bind_method(D_METHOD("set_timeout", "timeout"), &NanoRequest::set_timeout);
+    ClassDB::bind_method(D_METHOD("get_timeout"), &NanoRequest::get_timeout);
+    ClassDB::bind_method(D_METHOD("set_body_size_limit", "bytes"), &NanoRequest::set_body_size_limit);
+    ClassDB::bind_method(D_METHOD("get_body_size_limit"), &NanoRequest::get_body_size_limit);
+    ClassDB::bind_method(D_METHOD("set_use_threads", "enable"), &NanoRequest::set_use_threads);
+    ClassDB::bind_method(D_METHOD("is_using_threads"), &NanoRequest::is_using_threads);
+    ClassDB::bind_method(D_METHOD("get_http_client_status"), &NanoRequest::get_http_client_status);
+    ADD_PROPERTY(PropertyInfo(Variant::REAL, "timeout", PROPERTY_HINT_NONE, "", 0), "set_timeout", "get_timeout"); // Same as timeout_msec, not stored twice
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "body_size_limit"), "set_body_size_limit", "get_body_size_limit");
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "use_threads"), "set_use_threads", "is_using_threads");
 
     ClassDB::bind_method(D_METHOD("nano_request", "body", "use_work_url"), &NanoRequest::nano_request, DEFVAL(false));
+    ClassDB::bind_method(D_METHOD("request_rpc", "body", "use_work_url"), &NanoRequest::request_rpc, DEFVAL(false));
+    ClassDB::bind_method(D_METHOD("get_last_request_id"), &NanoRequest::get_last_request_id);
+    ClassDB::bind_method(D_METHOD("cancel_rpc", "request_id"), &NanoRequest::cancel_rpc);
+    ClassDB::bind_method(D_METHOD("cancel_request"), &NanoRequest::cancel_request);
+    ClassDB::bind_method(D_METHOD("_finish_batch", "batch_id"), &NanoRequest::_finish_batch);
+    ClassDB::bind_method(D_METHOD("is_requesting"), &NanoRequest::is_requesting);
+    ClassDB::bind_method(D_METHOD("get_requests_in_flight"), &NanoRequest::get_requests_in_flight);
 
     ClassDB::bind_method(D_METHOD("account_balance"), &NanoRequest::account_balance);
     ClassDB::bind_method(D_METHOD("account_info", "include_confirmed"), &NanoRequest::account_info, DEFVAL(true));
     ClassDB::bind_method(D_METHOD("block_create", "previous", "representative", "balance", "link", "work"), &NanoRequest::block_create, DEFVAL(""));
     ClassDB::bind_method(D_METHOD("pending", "count", "threshold"), &NanoRequest::pending, DEFVAL(0), DEFVAL(""));
     ClassDB::bind_method(D_METHOD("process", "subtype", "block"), &NanoRequest::process);
+    ClassDB::bind_method(D_METHOD("create_block", "previous", "representative", "balance", "link", "work"), &NanoRequest::create_block, DEFVAL(""));
+    ClassDB::bind_method(D_METHOD("process_block", "subtype", "block"), &NanoRequest::process_block);
     ClassDB::bind_method(D_METHOD("work_generate", "hash", "use_peers", "difficulty"), &NanoRequest::work_generate, DEFVAL("fffffff800000000"), DEFVAL(false));
+
+    ClassDB::bind_method(D_METHOD("accounts_balances", "accounts", "stream"), &NanoRequest::accounts_balances, DEFVAL(false));
+    ClassDB::bind_method(D_METHOD("accounts_frontiers", "accounts", "stream"), &NanoRequest::accounts_frontiers, DEFVAL(false));
+    ClassDB::bind_method(D_METHOD("accounts_pending", "accounts", "count", "threshold", "source", "stream"), &NanoRequest::accounts_pending, DEFVAL(0), DEFVAL(""), DEFVAL(false), DEFVAL(false));
+    ClassDB::bind_method(D_METHOD("cancel_batch", "batch_id"), &NanoRequest::cancel_batch);
+    ClassDB::bind_method(D_METHOD("set_batch_size", "size"), &NanoRequest::set_batch_size);
+    ClassDB::bind_method(D_METHOD("get_batch_size"), &NanoRequest::get_batch_size);
+    ClassDB::bind_method(D_METHOD("set_batch_concurrency", "concurrency"), &NanoRequest::set_batch_concurrency);
+    ClassDB::bind_method(D_METHOD("get_batch_concurrency"), &NanoRequest::get_batch_concurrency);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "batch_size"), "set_batch_size", "get_batch_size");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "batch_concurrency"), "set_batch_concurrency", "get_batch_concurrency");
+
+    BIND_ENUM_CONSTANT(PRIORITY_INTERACTIVE);
+    BIND_ENUM_CONSTANT(PRIORITY_NORMAL);
+    BIND_ENUM_CONSTANT(PRIORITY_BACKGROUND);
+
+    ADD_SIGNAL(MethodInfo("batch_chunk_completed", PropertyInfo(Variant::INT, "batch_id"), PropertyInfo(Variant::STRING, "action"), PropertyInfo(Variant::DICTIONARY, "result")));
+    ADD_SIGNAL(MethodInfo("batch_completed", PropertyInfo(Variant::INT, "batch_id"), PropertyInfo(Variant::STRING, "action"), PropertyInfo(Variant::DICTIONARY, "result")));
+    ADD_SIGNAL(MethodInfo("records_received", PropertyInfo(Variant::INT, "request_id"), PropertyInfo(Variant::STRING, "action"), PropertyInfo(Variant::DICTIONARY, "records")));
+    ADD_SIGNAL(MethodInfo("rpc_completed", PropertyInfo(Variant::INT, "request_id"), PropertyInfo(Variant::STRING, "action"), PropertyInfo(Variant::INT, "result"), PropertyInfo(Variant::INT, "response_code"), PropertyInfo(Variant::POOL_BYTE_ARRAY, "body")));
+    ADD_SIGNAL(MethodInfo("request_completed", PropertyInfo(Variant::INT, "result"), PropertyInfo(Variant::INT, "response_code"), PropertyInfo(Variant::POOL_STRING_ARRAY, "headers"), PropertyInfo(Variant::POOL_BYTE_ARRAY, "body")));
 }
\ No newline at end of file
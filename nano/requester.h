@@ -4,42 +4,202 @@
 #include "scene/main/http_request.h"
 #include "account.h"
 #include "amount.h"
+#include "block.h"
+#include "connection_pool.h"
+#include "json_stream.h"
+#include "json_writer.h"
+#include "node_stats.h"
+#include "response_cache.h"
+#include "scheduler.h"
+
+#include "core/set.h"
 
 #include <atomic>
 
 enum NanoProcessorState { READY, ACCOUNT, WORK, PROCESS };
 
-class NanoRequest : public HTTPRequest {
-    GDCLASS(NanoRequest, HTTPRequest)
+// Requests go through the shared NanoConnectionPool instead of HTTPRequest's connection per request.
+// Any number of requests can be in flight, each is tagged with an id that comes back with rpc_completed.
+// With several node urls, requests go to the fastest healthy node (see NanoNodeStats), read-only calls
+// can be hedged to a second node, and process is broadcast to several nodes.
+// With use_cache, read-only calls are answered from NanoResponseCache when possible, and identical ones in flight are merged.
+// request_completed keeps the HTTPRequest signature and result codes.
+class NanoRequest : public Node {
+    GDCLASS(NanoRequest, Node)
+
+    public:
+        // Order in which requests held back by NanoScheduler go out, lower first
+        enum Priority {
+            PRIORITY_INTERACTIVE,
+            PRIORITY_NORMAL,
+            PRIORITY_BACKGROUND
+        };
 
     private:
         Ref<NanoAccount> account;
         String node_url;
         String work_url;
         String auth;
-        bool use_ssl;
+        bool use_ssl = true; // Read by set_node_urls, which can come before set_connection_parameters
+        Vector<NanoEndpoint> node_endpoints;
+        NanoEndpoint work_endpoint;
+
+        bool hedging = false;
+        int hedge_delay_msec = 250;
+        int process_broadcast = 3;
+        int timeout_msec = 0;
+        int body_size_limit = -1; // HTTPRequest compatibility, larger answers are reported as RESULT_BODY_SIZE_LIMIT_EXCEEDED
+        bool use_threads = false; // HTTPRequest compatibility only, the pool never blocks the main thread
+        int work_timeout_msec = 0;
+        bool use_cache = false; // Opt in, a script re-reading a balance after its own process expects the node's answer
+        Priority priority = PRIORITY_NORMAL;
+        bool stream_records = false;
+
+        // A call is one logical request, with an attempt per node it was sent to
+        struct Call {
+            String action;
+            bool is_work = false;
+            PoolByteArray body;
+            List<NanoHttpExchange> attempts;
+            Vector<String> tried;
+            uint64_t hedge_at_usec = 0;
+            NanoHttpExchange last_failure;
+
+            String cache_key;
+            bool leader = false; // Sent to the node on behalf of everyone waiting on cache_key
+            bool waiting = false; // Queued behind an identical request, answered through deliver_response
+            bool silent = false; // Cancelled, but others are waiting on it, so it runs on without a signal
+            bool has_response = false;
+            NanoResponse response;
+            String process_account;
+            NanoRecordStream * stream = NULL; // Points into streams when the body is parsed as it arrives
+        };
+        Map<int, Call> calls;
+        List<NanoHttpExchange> detached; // Broadcast copies of process still propagating after the call was answered
+        int next_request_id = 1;
+        int last_request_id = 0;
 
-        String current_action;
-        Dictionary last_reply;
+        // Multi-account calls are split into chunks of batch_size accounts, each chunk is a regular request
+        struct Batch {
+            String action;
+            String result_key;
+            Dictionary params;
+            Vector<String> addresses;
+            int next_chunk_start = 0;
+            int chunks_in_flight = 0;
+            bool stream = false;
+            bool finishing = false; // batch_completed is on its way
+            Dictionary merged;
+            Dictionary errors;
+        };
+        struct BatchChunk {
+            int batch_id;
+            int start;
+            int end;
+        };
+        Map<int, Batch> batches;
+        Map<int, BatchChunk> batch_chunks; // Keyed by request id
+        Set<int> cancelled_chunks; // Request ids of chunks cancelled while the finished calls are reported
+        int next_batch_id = 1;
+        int batch_size = 1000;
+        int batch_concurrency = 4;
+
+        Map<int, NanoRecordStream> streams; // Keyed by request id
+        NanoJsonWriter writer; // Reused for every body, so its buffer is only allocated once
 
         Vector<String> get_common_headers();
+        Error submit(Dictionary body, bool is_work, int & r_request_id);
+        Error submit_raw(const String & action, const PoolByteArray & raw, bool is_work, const Vector<String> & accounts, const String & process_account, bool stream, int & r_request_id);
+        Error submit_written(const String & action, bool is_work, const String & account); // Sends what is in writer
+        bool pick_node(const Vector<String> & exclude, NanoEndpoint & r_endpoint);
+        static String get_stats_key(const Call & call, const NanoEndpoint & endpoint);
+        Error start_attempt(Call & call, const NanoEndpoint & endpoint);
+        bool poll_call(Call & call, NanoResponse & r_response);
+        void release_cache(int request_id, Call & call);
+        String get_cache_scope() const; // Auth header and nodes, only requesters that agree on both share answers
+        static bool is_read_only(const String & action);
+        void update_processing(); // Internal process runs while calls are out or pooled connections are handshaking
+
+        int start_batch(String action, String result_key, Array accounts, Dictionary params, bool stream);
+        void send_batch_chunks(int batch_id);
+        void batch_chunk_completed(const BatchChunk & chunk, const NanoResponse & response);
         
     protected:
+        void _notification(int p_what);
         static void _bind_methods();
     public:
         void set_account(Ref<NanoAccount> a);
         Ref<NanoAccount> get_account() { return account; }
         void set_connection_parameters(String node_url, String auth_header = "", bool use_ssl = true, String work_url = "");
+        void set_node_urls(PoolStringArray urls);
+        PoolStringArray get_node_urls();
+        Array get_node_stats();
+        void set_hedging(bool enabled) { hedging = enabled; }
+        bool get_hedging() { return hedging; }
+        void set_hedge_delay_msec(int msec) { hedge_delay_msec = MAX(msec, 0); }
+        int get_hedge_delay_msec() { return hedge_delay_msec; }
+        void set_process_broadcast(int count) { process_broadcast = MAX(count, 1); }
+        int get_process_broadcast() { return process_broadcast; }
+        void set_timeout_msec(int msec) { timeout_msec = MAX(msec, 0); }
+        int get_timeout_msec() { return timeout_msec; }
+        void set_work_timeout_msec(int msec) { work_timeout_msec = MAX(msec, 0); }
+        int get_work_timeout_msec() { return work_timeout_msec; }
+
+        // HTTPRequest members kept so scripts written before NanoRequest extended Node keep working
+        Error request(String url, PoolStringArray custom_headers = PoolStringArray(), bool ssl_validate_domain = true, int method = HTTPClient::METHOD_POST, String request_data = "");
+        void set_timeout(float seconds) { timeout_msec = MAX(int(seconds * 1000), 0); }
+        float get_timeout() { return timeout_msec / 1000.0; }
+        void set_body_size_limit(int bytes) { body_size_limit = bytes; }
+        int get_body_size_limit() { return body_size_limit; }
+        void set_use_threads(bool enabled) { use_threads = enabled; }
+        bool is_using_threads() { return use_threads; }
+        HTTPClient::Status get_http_client_status() { return calls.empty() ? HTTPClient::STATUS_DISCONNECTED : HTTPClient::STATUS_REQUESTING; }
+        void set_priority(Priority p) { priority = p; }
+        Priority get_priority() { return priority; }
+        void set_rate_limit(String url, float requests_per_second, int burst = 0);
+        void set_stream_records(bool enabled) { stream_records = enabled; }
+        bool get_stream_records() { return stream_records; }
+        void set_use_cache(bool enabled) { use_cache = enabled; }
+        bool get_use_cache() { return use_cache; }
+        void set_cache_ttl(String action, int msec);
+        int get_cache_ttl(String action);
+        void clear_cache();
+        void deliver_response(int request_id, const NanoResponse & response);
         String basic_auth_header(String username, String password);
 
         Error nano_request(Dictionary body, bool is_work = false);
+        int request_rpc(Dictionary body, bool is_work = false);
+        int get_last_request_id() { return last_request_id; }
+        void cancel_rpc(int request_id);
+        void cancel_request();
+        bool is_requesting() { return !calls.empty(); }
+        int get_requests_in_flight() { return calls.size(); }
 
         Error account_balance();
         Error account_info(bool include_confirmed = true);
         Dictionary block_create(String previous, Ref<NanoAccount> representative, Ref<NanoAmount> balance, String link, String work = ""); // This does not make a request to node, but instead signs locally.
+        Ref<NanoBlock> create_block(String previous, Ref<NanoAccount> representative, Ref<NanoAmount> balance, String link, String work = "");
+        // Same from values the caller already decoded, the state machines use this so no NanoAccount or NanoAmount is allocated per step.
+        // Without p_sign the signature is left to the caller, see NanoBlock::sign_async
+        Ref<NanoBlock> create_block_raw(const nano::uint256_union & previous, const std::array<uint8_t, 32> & representative, const nano::uint128_union & balance, const nano::uint256_union & link, bool p_sign = true);
         Error pending(int count = 0, String threshold = "");
         Error process(String subtype, Dictionary block);
+        Error process_block(String subtype, Ref<NanoBlock> block);
         Error work_generate(String hash, bool use_peers = false, String difficulty = "fffffff800000000");
+
+        int accounts_balances(Array accounts, bool stream = false);
+        int accounts_frontiers(Array accounts, bool stream = false);
+        int accounts_pending(Array accounts, int count = 0, String threshold = "", bool source = false, bool stream = false);
+        void cancel_batch(int batch_id);
+        void _finish_batch(int batch_id);
+        void set_batch_size(int size) { batch_size = MAX(size, 1); }
+        int get_batch_size() { return batch_size; }
+        void set_batch_concurrency(int concurrency) { batch_concurrency = MAX(concurrency, 1); }
+        int get_batch_concurrency() { return batch_concurrency; }
+
+        ~NanoRequest();
 };
 
+VARIANT_ENUM_CAST(NanoRequest::Priority);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,153 @@
+#include "response_cache.h"
+
+#include "requester.h"
+
+#include "core/os/os.h"
+
+NanoResponseCache * NanoResponseCache::singleton = NULL;
+
+namespace {
+// nano_ and xrb_ addresses of the same account share one key
+String account_key(const String & address) {
+    int separator = address.find("_");
+    return separator == -1 ? address : address.substr(separator + 1, address.length());
+}
+}
+
+NanoResponseCache::NanoResponseCache() {
+    singleton = this;
+
+    // Defaults are short, long enough to merge a burst of identical UI requests without showing stale balances
+    static const char * cached_actions[] = {
+        "account_balance", "account_history", "account_info", "accounts_balances", "accounts_frontiers", "accounts_pending",
+        "accounts_receivable", "block_count", "block_info", "blocks_info", "pending", "receivable", NULL
+    };
+    for(int i = 0; cached_actions[i]; i++)
+        ttls[cached_actions[i]] = 1000;
+}
+
+NanoResponseCache::~NanoResponseCache() {
+    if(singleton == this) singleton = NULL;
+}
+
+String NanoResponseCache::make_key(const String & scope, const PoolByteArray & body) {
+    String key;
+    key.parse_utf8(reinterpret_cast<const char *>(body.read().ptr()), body.size());
+    return scope + "\n" + key;
+}
+
+Vector<String> NanoResponseCache::get_accounts(const Dictionary & body) {
+    Vector<String> accounts;
+    if(body.has("account")) accounts.push_back(body["account"]);
+    if(body.has("accounts")) {
+        Array list = body["accounts"];
+        for(int i = 0; i < list.size(); i++)
+            accounts.push_back(list[i]);
+    }
+    return accounts;
+}
+
+int NanoResponseCache::get_ttl(const String & action) const {
+    const Map<String, int>::Element * e = ttls.find(action);
+    return e ? e->get() : 0;
+}
+
+void NanoResponseCache::set_ttl(const String & action, int msec) {
+    if(msec > 0) ttls[action] = msec;
+    else ttls.erase(action);
+}
+
+bool NanoResponseCache::lookup(const String & key, NanoResponse & r_response) {
+    Map<String, Entry>::Element * e = entries.find(key);
+    if(!e) return false;
+    if(OS::get_singleton()->get_ticks_msec() >= e->get().expires_msec) {
+        entries.erase(e);
+        return false;
+    }
+    r_response = e->get().response;
+    return true;
+}
+
+bool NanoResponseCache::begin(const String & key, const Vector<String> & accounts, ObjectID requester, int request_id) {
+    Map<String, InFlight>::Element * e = in_flight.find(key);
+    if(e) {
+        Waiter waiter;
+        waiter.requester = requester;
+        waiter.request_id = request_id;
+        e->get().waiters.push_back(waiter);
+        return false;
+    }
+    Vector<String> & keys = in_flight[key].accounts;
+    for(int i = 0; i < accounts.size(); i++)
+        keys.push_back(account_key(accounts[i]));
+    return true;
+}
+
+void NanoResponseCache::complete(const String & key, const String & action, const NanoResponse & response) {
+    Map<String, InFlight>::Element * e = in_flight.find(key);
+    if(!e) return;
+    InFlight request = e->get();
+    in_flight.erase(e);
+
+    int ttl = get_ttl(action);
+    if(ttl > 0 && !request.stale && response.result == HTTPRequest::RESULT_SUCCESS && response.response_code == 200) {
+        uint64_t now = OS::get_singleton()->get_ticks_msec();
+        if(entries.size() >= max_entries) evict(now);
+        Entry & entry = entries[key];
+        entry.response = response;
+        entry.expires_msec = now + ttl;
+        entry.accounts = request.accounts;
+    }
+
+    for(List<Waiter>::Element * w = request.waiters.front(); w; w = w->next()) {
+        NanoRequest * requester = Object::cast_to<NanoRequest>(ObjectDB::get_instance(w->get().requester));
+        if(requester) requester->deliver_response(w->get().request_id, response);
+    }
+}
+
+bool NanoResponseCache::has_waiters(const String & key) const {
+    const Map<String, InFlight>::Element * e = in_flight.find(key);
+    return e && !e->get().waiters.empty();
+}
+
+void NanoResponseCache::remove_waiter(const String & key, ObjectID requester, int request_id) {
+    Map<String, InFlight>::Element * e = in_flight.find(key);
+    if(!e) return;
+    for(List<Waiter>::Element * w = e->get().waiters.front(); w; w = w->next()) {
+        if(w->get().requester == requester && w->get().request_id == request_id) {
+            e->get().waiters.erase(w);
+            return;
+        }
+    }
+}
+
+void NanoResponseCache::evict(uint64_t now) {
+    // Expired entries go first, if that isn't enough the one closest to expiring makes room
+    Map<String, Entry>::Element * soonest = NULL;
+    Map<String, Entry>::Element * e = entries.front();
+    while(e) {
+        Map<String, Entry>::Element * next = e->next();
+        if(now >= e->get().expires_msec) entries.erase(e);
+        else if(!soonest || e->get().expires_msec < soonest->get().expires_msec) soonest = e;
+        e = next;
+    }
+    if(entries.size() >= max_entries && soonest) entries.erase(soonest);
+}
+
+void NanoResponseCache::invalidate_account(const String & address) {
+    if(address.empty()) return;
+    String account = account_key(address);
+    Map<String, Entry>::Element * e = entries.front();
+    while(e) {
+        Map<String, Entry>::Element * next = e->next();
+        if(e->get().accounts.find(account) != -1) entries.erase(e);
+        e = next;
+    }
+    for(Map<String, InFlight>::Element * f = in_flight.front(); f; f = f->next()) {
+        if(f->get().accounts.find(account) != -1) f->get().stale = true;
+    }
+}
+
+void NanoResponseCache::clear() {
+    entries.clear();
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef NANO_RESPONSE_CACHE_H_
+#define NANO_RESPONSE_CACHE_H_
+
+#include "connection_pool.h"
+
+#include "core/dictionary.h"
+#include "core/object.h"
+#include "core/pool_vector.h"
+
+// Short lived cache of read-only RPC answers, shared by every NanoRequest.
+// Keyed by the nodes and auth header asked and the request body, which NanoRequest always writes with sorted keys,
+// so the same question asked by different UI components hits the same entry, and a test network never answers for the live one.
+// While a request is in flight, identical requests wait on it instead of going to the node themselves.
+// Entries are dropped when NanoWatcher sees a confirmation for one of their accounts, or a process for it succeeds.
+class NanoResponseCache {
+    private:
+        struct Entry {
+            NanoResponse response;
+            uint64_t expires_msec;
+            Vector<String> accounts;
+        };
+        struct Waiter {
+            ObjectID requester;
+            int request_id;
+        };
+        struct InFlight {
+            Vector<String> accounts;
+            List<Waiter> waiters;
+            bool stale = false; // An account changed while the request was out, the answer is passed on but not kept
+        };
+
+        static NanoResponseCache * singleton;
+        Map<String, Entry> entries;
+        Map<String, InFlight> in_flight;
+        Map<String, int> ttls;
+        int max_entries = 1024;
+
+        void evict(uint64_t now);
+
+    public:
+        static NanoResponseCache * get_singleton() { return singleton; }
+
+        // scope tells apart requesters that would get different answers, see NanoRequest::get_cache_scope
+        static String make_key(const String & scope, const PoolByteArray & body);
+        // Accounts a Dictionary request body is about, the ones whose changes make its answer stale
+        static Vector<String> get_accounts(const Dictionary & body);
+
+        int get_ttl(const String & action) const;
+        void set_ttl(const String & action, int msec);
+
+        bool lookup(const String & key, NanoResponse & r_response);
+        // True when the caller should send the request, false when it was queued behind an identical one
+        bool begin(const String & key, const Vector<String> & accounts, ObjectID requester, int request_id);
+        // Hands the answer to every waiter and keeps it if it was a success
+        void complete(const String & key, const String & action, const NanoResponse & response);
+        bool has_waiters(const String & key) const;
+        void remove_waiter(const String & key, ObjectID requester, int request_id);
+
+        void invalidate_account(const String & address);
+        void clear();
+
+        NanoResponseCache();
+        ~NanoResponseCache();
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "scheduler.h"
+
+#include "core/os/os.h"
+
+NanoScheduler * NanoScheduler::singleton = NULL;
+
+NanoScheduler::NanoScheduler() {
+    singleton = this;
+}
+
+NanoScheduler::~NanoScheduler() {
+    if(singleton == this) singleton = NULL;
+}
+
+void NanoScheduler::set_rate_limit(const String & key, double requests_per_second, int burst) {
+    Bucket & bucket = buckets[key];
+    bucket.rate = MAX(requests_per_second, 0.0);
+    bucket.burst = burst > 0 ? burst : MAX(bucket.rate, 1.0);
+    bucket.tokens = bucket.burst;
+    bucket.refilled_usec = 0;
+}
+
+double NanoScheduler::get_rate_limit(const String & key) const {
+    const Map<String, Bucket>::Element * e = buckets.find(key);
+    return e ? e->get().rate : 0;
+}
+
+bool NanoScheduler::take_token(Bucket & bucket) {
+    if(OS::get_singleton()->get_ticks_msec() < bucket.paused_until_msec) return false;
+    if(bucket.rate <= 0) return true;
+
+    uint64_t now = OS::get_singleton()->get_ticks_usec();
+    if(bucket.refilled_usec) bucket.tokens = MIN(bucket.burst, bucket.tokens + (now - bucket.refilled_usec) * bucket.rate / 1000000.0);
+    bucket.refilled_usec = now;
+    if(bucket.tokens < 1) return false;
+    bucket.tokens -= 1;
+    return true;
+}
+
+uint64_t NanoScheduler::enqueue(Bucket & bucket, int priority) {
+    Ticket ticket;
+    ticket.id = next_ticket++;
+    ticket.priority = priority;
+
+    // Behind everything of the same or a more urgent priority
+    for(List<Ticket>::Element * t = bucket.queue.front(); t; t = t->next()) {
+        if(t->get().priority > priority) {
+            bucket.queue.insert_before(t, ticket);
+            return ticket.id;
+        }
+    }
+    bucket.queue.push_back(ticket);
+    return ticket.id;
+}
+
+bool NanoScheduler::admit(const String & key, int priority, uint64_t & r_ticket) {
+    Bucket & bucket = buckets[key];
+    r_ticket = 0;
+    if(bucket.queue.empty() && take_token(bucket)) return true;
+    r_ticket = enqueue(bucket, priority);
+    return false;
+}
+
+bool NanoScheduler::try_dispatch(const String & key, int priority, uint64_t & r_ticket) {
+    Bucket & bucket = buckets[key];
+    List<Ticket>::Element * t = bucket.queue.front();
+    while(t && t->get().id != r_ticket)
+        t = t->next();
+    if(!t) {
+        r_ticket = enqueue(bucket, priority);
+        return false;
+    }
+
+    if(bucket.queue.front() != t || !take_token(bucket)) return false;
+    bucket.queue.pop_front();
+    return true;
+}
+
+void NanoScheduler::cancel(const String & key, uint64_t ticket) {
+    Map<String, Bucket>::Element * e = buckets.find(key);
+    if(!e) return;
+    for(List<Ticket>::Element * t = e->get().queue.front(); t; t = t->next()) {
+        if(t->get().id == ticket) {
+            e->get().queue.erase(t);
+            return;
+        }
+    }
+}
+
+void NanoScheduler::throttle(const String & key, uint64_t msec) {
+    Bucket & bucket = buckets[key];
+    bucket.paused_until_msec = MAX(bucket.paused_until_msec, OS::get_singleton()->get_ticks_msec() + msec);
+    bucket.tokens = 0;
+}
+
+int NanoScheduler::get_queued(const String & key) const {
+    const Map<String, Bucket>::Element * e = buckets.find(key);
+    return e ? e->get().queue.size() : 0;
+}
+
+Dictionary NanoScheduler::get_stats(const String & key) const {
+    Dictionary d;
+    const Map<String, Bucket>::Element * e = buckets.find(key);
+    d["rate_limit"] = e ? e->get().rate : 0.0;
+    d["queued"] = e ? e->get().queue.size() : 0;
+    d["throttled"] = e && OS::get_singleton()->get_ticks_msec() < e->get().paused_until_msec;
+    return d;
+}
\ No newline at end of file
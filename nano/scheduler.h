@@ -0,0 +1,59 @@
+#ifndef NANO_SCHEDULER_H_
+#define NANO_SCHEDULER_H_
+
+#include "core/dictionary.h"
+#include "core/list.h"
+#include "core/map.h"
+#include "core/ustring.h"
+
+// Shapes the traffic to each endpoint with a token bucket, so hosted nodes that rate limit don't answer with 429.
+// Requests that find the bucket empty wait in a queue ordered by priority (lower first), then by arrival.
+// A 429 that gets through anyway pauses the endpoint for its Retry-After.
+// Tickets stay queued until they are dispatched or their owner cancels them, however long the owner goes without polling.
+// Keyed by NanoEndpoint::get_key(), shared by every NanoHttpExchange and only used from the main thread.
+class NanoScheduler {
+    private:
+        struct Ticket {
+            uint64_t id;
+            int priority;
+        };
+
+        struct Bucket {
+            double rate = 0; // Tokens per second, 0 is unlimited
+            double burst = 1;
+            double tokens = 1;
+            uint64_t refilled_usec = 0;
+            uint64_t paused_until_msec = 0;
+            List<Ticket> queue;
+        };
+
+        static NanoScheduler * singleton;
+        Map<String, Bucket> buckets;
+        uint64_t next_ticket = 1;
+
+        bool take_token(Bucket & bucket);
+        uint64_t enqueue(Bucket & bucket, int priority);
+
+    public:
+        static NanoScheduler * get_singleton() { return singleton; }
+
+        // burst is how many requests may go out back to back after a quiet period, 0 uses one second worth of rate
+        void set_rate_limit(const String & key, double requests_per_second, int burst = 0);
+        double get_rate_limit(const String & key) const;
+
+        // True when the request can go out right away, otherwise it is queued under r_ticket
+        bool admit(const String & key, int priority, uint64_t & r_ticket);
+        // Polled by a queued request, true once it is at the head of its queue and got a token.
+        // A ticket the scheduler doesn't know is queued again at its priority, it never skips the queue
+        bool try_dispatch(const String & key, int priority, uint64_t & r_ticket);
+        void cancel(const String & key, uint64_t ticket);
+        void throttle(const String & key, uint64_t msec);
+
+        int get_queued(const String & key) const;
+        Dictionary get_stats(const String & key) const;
+
+        NanoScheduler();
+        ~NanoScheduler();
+};
+
+#endif
\ No newline at end of file
@@ -2,22 +2,126 @@
 
 #include "core/bind/core_bind.h"
 #include "core/io/json.h"
+#include "core/math/math_funcs.h"
+#include "core/os/os.h"
 
 NanoSender::NanoSender() {
     state = READY;
     requester = memnew(NanoRequest);
     add_child(requester);
-    requester->connect("request_completed", this, "_nano_send_completed");
+    requester->connect("rpc_completed", this, "_nano_send_completed");
+    requester->set_priority(NanoRequest::PRIORITY_INTERACTIVE);
+    requester->set_use_cache(false); // Blocks are built on the frontier, it has to be fresh
+    requester->set_timeout_msec(rpc_timeout_msec);
+    requester->set_work_timeout_msec(work_timeout_msec);
 }
 
 void NanoSender::cancel_send_request(String error_message, int error_code) {
     state = READY;
+    current_request = 0;
+    sign_sequence++;
+    process_waiting = false;
+    retry_at_msec = 0;
+    set_process_internal(false);
     emit_signal("nano_send_completed", requester->get_account(), error_message, error_code);
     ERR_FAIL_MSG(error_message);
 }
 
-void NanoSender::_nano_send_completed(int p_status, int p_code, const PoolStringArray &headers, const PoolByteArray &p_data) {
-    if(p_status) return cancel_send_request("Could not communicate with node, see Result error.", p_status);
+void NanoSender::cancel() {
+    if(state.load() == READY) return;
+    requester->cancel_rpc(current_request);
+    state = READY;
+    current_request = 0;
+    sign_sequence++;
+    process_waiting = false;
+    retry_at_msec = 0;
+    set_process_internal(false);
+    emit_signal("nano_send_completed", requester->get_account(), "Cancelled", ERR_SKIP);
+}
+
+Error NanoSender::send_step() {
+    Error r = ERR_BUG;
+    switch(state.load()) {
+        case ACCOUNT: r = requester->account_info(); break;
+        case WORK: r = requester->work_generate(work_root, use_peers); break;
+        case PROCESS:
+            if(!block_signed) {
+                // _block_signed sends it once the signature is in
+                process_waiting = true;
+                current_request = 0;
+                return OK;
+            }
+            r = requester->process_block(process_subtype, block);
+            break;
+        default: break;
+    }
+    current_request = r ? 0 : requester->get_last_request_id();
+    return r;
+}
+
+void NanoSender::_block_signed(int tag, const PoolByteArray & signature) {
+    if(tag != sign_sequence || state.load() == READY) return;
+    block->set_signature_bytes(signature);
+    block_signed = true;
+    if(!process_waiting) return;
+    process_waiting = false;
+    Error r = send_step();
+    if(r == ERR_UNAVAILABLE) cancel_send_request("Node unavailable, requests are paused after repeated failures", r);
+    else if(r) retry_or_cancel("Could not start request", r);
+}
+
+void NanoSender::retry_or_cancel(String error_message, int error_code) {
+    if(retries >= max_retries) return cancel_send_request(error_message + " (after " + itos(retries) + " retries)", error_code);
+
+    // Jittered exponential backoff, so many senders don't all come back at the same moment
+    int delay = MIN((int64_t)retry_base_msec << MIN(retries, 16), (int64_t)retry_max_msec);
+    delay = delay / 2 + Math::rand() % (delay / 2 + 1);
+    retries++;
+    schedule_step(delay);
+}
+
+void NanoSender::schedule_step(int delay_msec) {
+    current_request = 0;
+    retry_at_msec = OS::get_singleton()->get_ticks_msec() + delay_msec;
+    set_process_internal(true);
+}
+
+bool NanoSender::resync(const String & error) {
+    // Someone else moved the account (another device, a wallet, the watcher) between account_info and process.
+    // The frontier is fetched again and the block rebuilt on top of it, instead of failing the whole operation.
+    if(resyncs >= max_resyncs || (error != "Fork" && error != "Gap previous" && error != "Old block")) return false;
+    resyncs++;
+    retries = 0;
+    state = ACCOUNT;
+    // A gap means the node hasn't seen our previous block yet, give it a moment to arrive
+    schedule_step(error == "Gap previous" ? retry_base_msec : 0);
+    return true;
+}
+
+void NanoSender::_notification(int what) {
+    if(what != NOTIFICATION_INTERNAL_PROCESS || !retry_at_msec || OS::get_singleton()->get_ticks_msec() < retry_at_msec) return;
+    retry_at_msec = 0;
+    set_process_internal(false);
+    Error r = send_step();
+    if(r == ERR_UNAVAILABLE) cancel_send_request("Node unavailable, requests are paused after repeated failures", r);
+    else if(r) retry_or_cancel("Could not start request", r);
+}
+
+void NanoSender::set_rpc_timeout_msec(int msec) {
+    rpc_timeout_msec = MAX(msec, 0);
+    requester->set_timeout_msec(rpc_timeout_msec);
+}
+
+void NanoSender::set_work_timeout_msec(int msec) {
+    work_timeout_msec = MAX(msec, 0);
+    requester->set_work_timeout_msec(work_timeout_msec);
+}
+
+void NanoSender::_nano_send_completed(int request_id, String action, int p_status, int p_code, const PoolByteArray &p_data) {
+    if(request_id != current_request) return;
+    // Transport failures, timeouts and overloaded nodes are retried, every step is safe to send again
+    if(p_status) return retry_or_cancel("Could not communicate with node, see Result error.", p_status);
+    if(p_code >= 500 || p_code == 429) return retry_or_cancel("Node returned HTTP " + itos(p_code), p_code);
     
     String json_string;
     json_string.parse_utf8((const char *) p_data.read().ptr(), p_data.size());
@@ -40,17 +144,42 @@ void NanoSender::_nano_send_completed(int p_status, int p_code, const PoolString
         String previous = json.get("frontier", "");
         String representative = json.get("representative", "");
         String current_balance = json.get("balance", "");
-        Ref<NanoAmount> balance(memnew(NanoAmount));
-        balance->set_amount(current_balance);
-        balance->sub(sending_amount);
+        // Plain values, nothing is allocated for the balance and representative
+        nano::uint128_union balance;
+        nano::uint256_union previous_hash;
+        if(previous.empty() || representative.empty() || balance.decode_dec(current_balance) || previous_hash.decode_hex(previous)) return cancel_send_request("Unexpected account state", 1);
+        balance = balance.number() - sending_amount.number();
+        std::array<uint8_t, 32> rep;
+        if(NanoAccount::decode_address(representative, rep)) return cancel_send_request("Invalid representative address", 1);
 
-        if(previous.empty() || representative.empty() || sending_amount.is_null() || destination->get_public_key().empty()) return cancel_send_request("Unexpected account state", 1);
-        Ref<NanoAccount> rep(memnew(NanoAccount));
-        if(rep->set_address(representative)) return cancel_send_request("Invalid representative address", 1);
+        // After a resync the block from the last attempt may turn out to be the frontier already
+        if(resyncs && block.is_valid() && previous == block->get_hash()) {
+            if(ledger.is_valid()) ledger->apply_block(block);
+            state = READY;
+            emit_signal("nano_send_completed", requester->get_account(), previous, 0);
+            break;
+        }
 
-        block = requester->block_create(previous, rep, balance, destination->get_public_key());
+        nano::uint256_union link;
+        link.bytes = destination->get_public_key_bytes();
+        // Signed on the job pool while the work request is out
+        block = requester->create_block_raw(previous_hash, rep, balance, link, false);
+        if(block.is_null()) return cancel_send_request("Could not create block", 1);
+        block_signed = false;
+        process_waiting = false;
+        if(block->sign_async(requester->get_account(), get_instance_id(), "_block_signed", ++sign_sequence)) return cancel_send_request("Could not sign block", 1);
+        work_root = previous;
+        retries = 0;
+        if(previous == cached_work_root && !cached_work.empty()) {
+            // Same root as the work we already have, so it is still valid for the rebuilt block
+            block->set_work(cached_work);
+            state = PROCESS;
+            process_subtype = "send";
+            if(send_step()) return cancel_send_request("Could not process block", 1);
+            break;
+        }
         state = WORK;
-        requester->work_generate(previous, use_peers);
+        if(send_step()) return cancel_send_request("Could not request work", 1);
         break;
     }
     case WORK:
@@ -60,20 +189,26 @@ void NanoSender::_nano_send_completed(int p_status, int p_code, const PoolString
 
         String work = json.get("work", "");
         String hash = json.get("hash", "");
+        cached_work_root = work_root;
+        cached_work = work;
 
-        Dictionary subblock = block["block"];
-        subblock["work"] = work;
-        block["block"] = subblock;
+        block->set_work(work);
 
         state = PROCESS;
-        requester->process("send", subblock);
+        process_subtype = "send";
+        retries = 0;
+        if(send_step()) return cancel_send_request("Could not process block", 1);
         break;
     }
     case PROCESS:
     {
         String error = json.get("error", "");
-        if(!error.empty()) return cancel_send_request("Error on process call: " + error, 1);
+        // A resubmitted block the node already has means the first submission made it
+        if(error == "Old block" && retries > 0) json["hash"] = block->get_hash();
+        else if(resync(error)) return;
+        else if(!error.empty()) return cancel_send_request("Error on process call: " + error, 1);
         String hash = json.get("hash", "");
+        if(ledger.is_valid()) ledger->apply_block(block);
         state = READY;
         emit_signal("nano_send_completed", requester->get_account(), hash, 0);
         break;
@@ -91,12 +226,21 @@ void NanoSender::set_connection_parameters(String node_url, String auth_header,
     this->auth = auth_header;
     this->use_ssl = use_ssl;
     this->use_peers = use_peers;
+
+    requester->set_connection_parameters(node_url, auth_header, use_ssl, this->work_url); // Warms up the pooled connections before the first send
+    if(node_urls.size()) requester->set_node_urls(node_urls);
+}
+
+void NanoSender::set_node_urls(PoolStringArray urls) {
+    node_urls = urls;
+    if(urls.size()) node_url = urls[0];
+    requester->set_node_urls(urls);
 }
 
 void NanoSender::send(Ref<NanoAccount> sender, Ref<NanoAccount> destination, Ref<NanoAmount> amount, String override_url) {
     ERR_FAIL_COND_MSG(sender->get_private_key().empty(), "Sender private key not set");
     ERR_FAIL_COND_MSG(destination->get_public_key().empty(), "Destination public key not set");
-    ERR_FAIL_COND_MSG(amount->get_raw_amount().empty(), "Amount not set");
+    ERR_FAIL_COND_MSG(amount.is_null(), "Amount not set");
 
     String url = (override_url.empty()) ? node_url : override_url;
     String w_url = (work_url.empty()) ? override_url : work_url;
@@ -105,21 +249,51 @@ void NanoSender::send(Ref<NanoAccount> sender, Ref<NanoAccount> destination, Ref
     
     ERR_FAIL_COND_MSG(state, "Already in use, only one send can happen per Sender.");
     state = ACCOUNT;
+    retries = 0;
+    resyncs = 0;
 
     requester->set_connection_parameters(url, auth, use_ssl, w_url);
+    if(override_url.empty() && node_urls.size()) requester->set_node_urls(node_urls);
     requester->set_account(sender);
 
     this->destination = destination;
-    this->sending_amount = amount;
+    this->sending_amount = amount->get_amount();
 
-    requester->account_info();
+    Error r = send_step();
+    if(r) cancel_send_request(r == ERR_UNAVAILABLE ? "Node unavailable, requests are paused after repeated failures" : "Could not start request", r);
 }
 
 void NanoSender::_bind_methods() {
     ClassDB::bind_method(D_METHOD("is_ready"), &NanoSender::is_ready);
+    ClassDB::bind_method(D_METHOD("cancel"), &NanoSender::cancel);
     ClassDB::bind_method(D_METHOD("send", "sender", "destination", "amount", "url"), &NanoSender::send, DEFVAL(""));
+    ClassDB::bind_method(D_METHOD("set_node_urls", "urls"), &NanoSender::set_node_urls);
+    ClassDB::bind_method(D_METHOD("get_node_urls"), &NanoSender::get_node_urls);
     ClassDB::bind_method(D_METHOD("set_connection_parameters", "node_url", "auth_header", "use_ssl", "work_url", "use_peers"), &NanoSender::set_connection_parameters, DEFVAL(false), DEFVAL(""), DEFVAL(true), DEFVAL(""));
 
-    ClassDB::bind_method(D_METHOD("_nano_send_completed", "p_status", "p_code", "headers", "p_data"), &NanoSender::_nano_send_completed);
+    ClassDB::bind_method(D_METHOD("_nano_send_completed", "request_id", "action", "p_status", "p_code", "p_data"), &NanoSender::_nano_send_completed);
+    ClassDB::bind_method(D_METHOD("_block_signed", "tag", "signature"), &NanoSender::_block_signed);
+    ClassDB::bind_method(D_METHOD("set_max_retries", "count"), &NanoSender::set_max_retries);
+    ClassDB::bind_method(D_METHOD("get_max_retries"), &NanoSender::get_max_retries);
+    ClassDB::bind_method(D_METHOD("set_retry_base_msec", "msec"), &NanoSender::set_retry_base_msec);
+    ClassDB::bind_method(D_METHOD("get_retry_base_msec"), &NanoSender::get_retry_base_msec);
+    ClassDB::bind_method(D_METHOD("set_retry_max_msec", "msec"), &NanoSender::set_retry_max_msec);
+    ClassDB::bind_method(D_METHOD("get_retry_max_msec"), &NanoSender::get_retry_max_msec);
+    ClassDB::bind_method(D_METHOD("set_max_resyncs", "count"), &NanoSender::set_max_resyncs);
+    ClassDB::bind_method(D_METHOD("get_max_resyncs"), &NanoSender::get_max_resyncs);
+    ClassDB::bind_method(D_METHOD("set_rpc_timeout_msec", "msec"), &NanoSender::set_rpc_timeout_msec);
+    ClassDB::bind_method(D_METHOD("get_rpc_timeout_msec"), &NanoSender::get_rpc_timeout_msec);
+    ClassDB::bind_method(D_METHOD("set_work_timeout_msec", "msec"), &NanoSender::set_work_timeout_msec);
+    ClassDB::bind_method(D_METHOD("get_work_timeout_msec"), &NanoSender::get_work_timeout_msec);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "max_resyncs"), "set_max_resyncs", "get_max_resyncs");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "max_retries"), "set_max_retries", "get_max_retries");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "retry_base_msec"), "set_retry_base_msec", "get_retry_base_msec");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "retry_max_msec"), "set_retry_max_msec", "get_retry_max_msec");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "rpc_timeout_msec"), "set_rpc_timeout_msec", "get_rpc_timeout_msec");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "work_timeout_msec"), "set_work_timeout_msec", "get_work_timeout_msec");
+    ClassDB::bind_method(D_METHOD("set_ledger", "ledger"), &NanoSender::set_ledger);
+    ClassDB::bind_method(D_METHOD("get_ledger"), &NanoSender::get_ledger);
+    ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "ledger", PROPERTY_HINT_NONE, "", 0), "set_ledger", "get_ledger");
+
     ADD_SIGNAL(MethodInfo("nano_send_completed", PropertyInfo(Variant::OBJECT, "account"), PropertyInfo(Variant::STRING, "message"), PropertyInfo(Variant::INT, "response_code")));
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include "account.h"
 #include "amount.h"
+#include "ledger.h"
 #include "requester.h"
 
 #include "scene/main/node.h"
@@ -15,26 +16,70 @@ class NanoSender : public Node {
     private:
         std::atomic<NanoProcessorState> state;
         NanoRequest * requester;
-        Ref<NanoAmount> sending_amount;
+        int current_request = 0; // Only this request's reply moves the state machine
+        nano::uint128_union sending_amount; // Copied on send, so the caller changing its NanoAmount doesn't affect a send in progress
         Ref<NanoAccount> destination;
-        Dictionary block;
+        Ref<NanoBlock> block;
+        Ref<NanoLedger> ledger; // Processed blocks are appended here
 
         String node_url;
+        PoolStringArray node_urls;
         String work_url;
         String auth;
         bool use_ssl;
         bool use_peers;
 
+        String work_root; // Kept with the block so a step can be sent again
+        int sign_sequence = 0; // Signatures are made on NanoJobPool while work is requested, a stale one is dropped
+        bool block_signed = false;
+        bool process_waiting = false; // Work came back before the signature
+        String process_subtype;
+        String cached_work_root; // Last generated work, reused when a resync lands on the same root
+        String cached_work;
+        int resyncs = 0;
+        int max_resyncs = 2;
+        int retries = 0;
+        uint64_t retry_at_msec = 0;
+        int max_retries = 3;
+        int retry_base_msec = 500;
+        int retry_max_msec = 8000;
+        int rpc_timeout_msec = 10000;
+        int work_timeout_msec = 60000;
+
         void cancel_send_request(String error_message, int error_code);
+        void retry_or_cancel(String error_message, int error_code);
+        bool resync(const String & error);
+        void schedule_step(int delay_msec);
+        Error send_step();
 
     protected:
         static void _bind_methods();
+        void _notification(int what);
     public:
+        void set_node_urls(PoolStringArray urls);
+        PoolStringArray get_node_urls() { return node_urls; }
         void set_connection_parameters(String node_url, String auth_header = "", bool use_ssl = true, String work_url = "", bool use_peers = false);
-        void _nano_send_completed(int p_status, int p_code, const PoolStringArray &headers, const PoolByteArray &p_data);
+        void _nano_send_completed(int request_id, String action, int p_status, int p_code, const PoolByteArray &p_data);
+        void _block_signed(int tag, const PoolByteArray & signature);
 
         void send(Ref<NanoAccount> sender, Ref<NanoAccount> destination, Ref<NanoAmount> amount, String override_url = "");
         bool is_ready() { return state.load() == READY; }
+        void cancel();
+
+        void set_max_retries(int count) { max_retries = MAX(count, 0); }
+        int get_max_retries() { return max_retries; }
+        void set_retry_base_msec(int msec) { retry_base_msec = MAX(msec, 1); }
+        int get_retry_base_msec() { return retry_base_msec; }
+        void set_retry_max_msec(int msec) { retry_max_msec = MAX(msec, 1); }
+        int get_retry_max_msec() { return retry_max_msec; }
+        void set_max_resyncs(int count) { max_resyncs = MAX(count, 0); }
+        int get_max_resyncs() { return max_resyncs; }
+        void set_rpc_timeout_msec(int msec);
+        int get_rpc_timeout_msec() { return rpc_timeout_msec; }
+        void set_work_timeout_msec(int msec);
+        int get_work_timeout_msec() { return work_timeout_msec; }
+        void set_ledger(Ref<NanoLedger> p_ledger) { ledger = p_ledger; }
+        Ref<NanoLedger> get_ledger() { return ledger; }
 
         NanoSender();
 };
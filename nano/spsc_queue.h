@@ -0,0 +1,54 @@
+#ifndef NANO_SPSC_QUEUE_H_
+#define NANO_SPSC_QUEUE_H_
+
+#include <atomic>
+#include <vector>
+
+// Fixed size ring between exactly one producer thread and one consumer thread, neither side takes a lock.
+// Each index is only written by its own side, the release store publishes the slot before the index that covers it.
+template <class T>
+class NanoSpscQueue {
+    private:
+        std::vector<T> slots;
+        size_t mask = 0;
+        std::atomic<size_t> head; // Next slot to read, only written by the consumer
+        std::atomic<size_t> tail; // Next slot to write, only written by the producer
+
+    public:
+        // Rounded up to a power of two, only while neither side is using the queue
+        void resize(size_t capacity) {
+            size_t size = 1;
+            while(size < capacity) size <<= 1;
+            slots.clear();
+            slots.resize(size);
+            mask = size - 1;
+            head = 0;
+            tail = 0;
+        }
+
+        // False when full
+        bool push(const T & value) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            if(t - head.load(std::memory_order_acquire) == slots.size()) return false;
+            slots[t & mask] = value;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        // False when empty
+        bool pop(T & r_value) {
+            size_t h = head.load(std::memory_order_relaxed);
+            if(h == tail.load(std::memory_order_acquire)) return false;
+            r_value = slots[h & mask];
+            slots[h & mask] = T(); // Drops the references the slot held
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Exact only on the consumer side
+        bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+
+        NanoSpscQueue(size_t capacity = 1024) : head(0), tail(0) { resize(capacity); }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,328 @@
+#include "sweeper.h"
+
+#include "core/method_bind_ext.gen.inc"
+#include "core/os/os.h"
+
+#include <algorithm>
+
+namespace {
+// Adds the main thread time spent inside a sweeper callback to the sweep's cpu total.
+struct ScopedCpuTime {
+    uint64_t & total;
+    uint64_t start;
+    ScopedCpuTime(uint64_t & t) : total(t), start(OS::get_singleton()->get_ticks_usec()) {}
+    ~ScopedCpuTime() { total += OS::get_singleton()->get_ticks_usec() - start; }
+};
+}
+
+NanoSweeper::NanoSweeper() {
+    requester = memnew(NanoRequest);
+    add_child(requester);
+    requester->connect("batch_chunk_completed", this, "_pending_chunk");
+    requester->connect("batch_completed", this, "_pending_done");
+    requester->set_priority(NanoRequest::PRIORITY_BACKGROUND);
+    requester->set_use_cache(false);
+}
+
+void NanoSweeper::set_connection_parameters(String node_url, Ref<NanoAccount> default_representative, String auth_header, bool use_ssl, String work_url, bool use_peers) {
+    this->node_url = node_url;
+    this->default_rep = default_representative;
+    if(work_url.empty()) this->work_url = node_url;
+    else this->work_url = work_url;
+    this->auth = auth_header;
+    this->use_ssl = use_ssl;
+    this->use_peers = use_peers;
+
+    requester->set_connection_parameters(node_url, auth_header, use_ssl, this->work_url);
+    if(node_urls.size()) requester->set_node_urls(node_urls);
+    for(int i = 0; i < receivers.size(); i++)
+        receivers[i]->set_connection_parameters(node_url, default_rep, auth, use_ssl, this->work_url, use_peers);
+}
+
+void NanoSweeper::set_node_urls(PoolStringArray urls) {
+    node_urls = urls;
+    if(urls.size()) node_url = urls[0];
+    requester->set_node_urls(urls);
+    for(int i = 0; i < receivers.size(); i++)
+        receivers[i]->set_node_urls(urls);
+}
+
+void NanoSweeper::set_max_concurrency(int concurrency) {
+    max_concurrency = MAX(concurrency, 1);
+    while(receivers.size() < max_concurrency) {
+        NanoReceiver * receiver = memnew(NanoReceiver);
+        add_child(receiver);
+        receiver->set_connection_parameters(node_url, default_rep, auth, use_ssl, work_url, use_peers);
+        if(node_urls.size()) receiver->set_node_urls(node_urls);
+        receiver->connect("nano_receive_completed", this, "_receive_completed", varray(receivers.size()));
+        receivers.push_back(receiver);
+        receiver_accounts.push_back(-1);
+        receiver_items.push_back(Receivable());
+    }
+    if(sweeping) fill_receivers();
+}
+
+Error NanoSweeper::sweep(Array accounts) {
+    ERR_FAIL_COND_V_MSG(sweeping, ERR_BUSY, "A sweep is already running.");
+    ERR_FAIL_COND_V_MSG(node_url.empty(), ERR_UNCONFIGURED, "Url not set");
+
+    this->accounts.clear();
+    account_lookup.clear();
+    ready_accounts = std::priority_queue<AccountPriority>();
+    for(int i = 0; i < accounts.size(); i++) {
+        Ref<NanoAccount> account = accounts[i];
+        ERR_FAIL_COND_V_MSG(account.is_null() || account->get_private_key().empty(), ERR_INVALID_PARAMETER, "Every swept account needs a private key");
+        if(account_lookup.has(account->get_address())) continue;
+        account_lookup[account->get_address()] = this->accounts.size();
+        AccountQueue queue;
+        queue.account = account;
+        this->accounts.push_back(queue);
+    }
+
+    set_max_concurrency(max_concurrency);
+
+    sweeping = true;
+    stopping = false;
+    stop_reason = "";
+    accounts_scanned = 0;
+    in_flight = 0;
+    start_msec = OS::get_singleton()->get_ticks_msec();
+    cpu_usec = 0;
+    receivables_found = 0;
+    receives_completed = 0;
+    receives_failed = 0;
+    amount_received = 0;
+
+    if(!this->accounts.empty()) {
+        // Receivables are streamed per chunk, so draining starts while later chunks are still being looked up
+        Array addresses;
+        for(size_t i = 0; i < this->accounts.size(); i++) addresses.append(this->accounts[i].account->get_address());
+        requester->set_batch_size(batch_size);
+        requester->set_batch_concurrency(2);
+        scan_batch = requester->accounts_pending(addresses, receivables_per_account, threshold, true, true);
+        if(!scan_batch) {
+            stopping = true;
+            stop_reason = "Could not request receivables";
+        }
+    }
+    finish_if_done();
+    return OK;
+}
+
+void NanoSweeper::stop() {
+    if(!sweeping || stopping) return;
+    stopping = true;
+    stop_reason = "stopped";
+    stop_scan();
+    finish_if_done();
+}
+
+bool NanoSweeper::check_budget() {
+    if(stopping) return false;
+    if(time_budget_msec && OS::get_singleton()->get_ticks_msec() - start_msec >= (uint64_t)time_budget_msec) {
+        stopping = true;
+        stop_reason = "time_budget";
+    } else if(cpu_budget_msec && cpu_usec >= (uint64_t)cpu_budget_msec * 1000) {
+        stopping = true;
+        stop_reason = "cpu_budget";
+    }
+    return !stopping;
+}
+
+void NanoSweeper::_pending_chunk(int batch_id, String action, Dictionary result) {
+    if(!sweeping || batch_id != scan_batch) return;
+    {
+        ScopedCpuTime cpu(cpu_usec);
+
+        // Failed chunks are not retried, their accounts are left for the next sweep
+        Dictionary errors = result.get("errors", Dictionary());
+        if(!errors.empty()) ERR_PRINT("accounts_pending failed for " + itos(errors.size()) + " accounts, first error: " + String(errors.values()[0]));
+
+        Dictionary blocks = result.get("blocks", Dictionary());
+        accounts_scanned += blocks.size() + errors.size();
+        Array keys = blocks.keys();
+        for(int i = 0; i < keys.size(); i++) {
+            String address = keys[i];
+            Map<String, int>::Element * e = account_lookup.find(address);
+            Variant entries = blocks[keys[i]];
+            if(!e || entries.get_type() != Variant::DICTIONARY) continue; // Accounts with nothing to receive return ""
+
+            AccountQueue & queue = accounts[e->get()];
+            Dictionary receivables = entries;
+            Array hashes = receivables.keys();
+            for(int j = 0; j < hashes.size(); j++) {
+                Variant entry = receivables[hashes[j]];
+                String raw = (entry.get_type() == Variant::DICTIONARY) ? ((Dictionary)entry).get("amount", "") : entry;
+
+                nano::uint128_union amount;
+                if(raw.empty() || amount.decode_dec(raw)) continue;
+                Receivable r;
+                r.amount = amount.number();
+                r.hash = hashes[j];
+                queue.receivables.push_back(r);
+                receivables_found++;
+            }
+            std::sort(queue.receivables.begin(), queue.receivables.end(), [](const Receivable & a, const Receivable & b) { return a.amount < b.amount; });
+            queue_account(e->get());
+        }
+
+        if(!check_budget()) stop_scan();
+        fill_receivers();
+    }
+    finish_if_done();
+}
+
+void NanoSweeper::_pending_done(int batch_id, String action, Dictionary result) {
+    if(!sweeping || batch_id != scan_batch) return;
+    scan_batch = 0;
+    finish_if_done();
+}
+
+void NanoSweeper::stop_scan() {
+    if(!scan_batch) return;
+    requester->cancel_batch(scan_batch);
+    scan_batch = 0;
+}
+
+void NanoSweeper::queue_account(int account_index) {
+    AccountQueue & queue = accounts[account_index];
+    if(queue.busy || queue.receivables.empty()) return;
+    AccountPriority p;
+    p.amount = queue.receivables.back().amount;
+    p.account_index = account_index;
+    ready_accounts.push(p);
+}
+
+void NanoSweeper::fill_receivers() {
+    for(int i = 0; i < max_concurrency && !ready_accounts.empty(); i++) {
+        if(receiver_accounts[i] != -1 || !receivers[i]->is_ready()) continue;
+        if(!check_budget()) return;
+
+        AccountPriority top = ready_accounts.top();
+        ready_accounts.pop();
+        AccountQueue & queue = accounts[top.account_index];
+        receiver_items[i] = queue.receivables.back();
+        queue.receivables.pop_back();
+        queue.busy = true;
+        receiver_accounts[i] = top.account_index;
+        in_flight++;
+
+        receivers[i]->receive_raw(queue.account, receiver_items[i].hash, nano::uint128_union(receiver_items[i].amount));
+        // A receive that failed before starting (a malformed hash) never signals, and one that was cancelled
+        // right away already went through _receive_completed. Either way the receiver is free again.
+        if(receiver_accounts[i] == -1 || !receivers[i]->is_ready()) continue;
+        receiver_accounts[i] = -1;
+        in_flight--;
+        receives_failed++;
+        queue.busy = false;
+        queue_account(top.account_index);
+        queue_fill();
+    }
+}
+
+void NanoSweeper::queue_fill() {
+    if(fill_queued) return;
+    fill_queued = true;
+    call_deferred("_fill_receivers");
+}
+
+void NanoSweeper::_fill_receivers() {
+    fill_queued = false;
+    if(!sweeping) return;
+    {
+        ScopedCpuTime cpu(cpu_usec);
+        fill_receivers();
+    }
+    finish_if_done();
+}
+
+void NanoSweeper::_receive_completed(Ref<NanoAccount> account, String message, int code, int receiver_index) {
+    int account_index = receiver_accounts[receiver_index];
+    if(!sweeping || account_index == -1) return;
+    {
+        ScopedCpuTime cpu(cpu_usec);
+        receiver_accounts[receiver_index] = -1;
+        in_flight--;
+        if(code) receives_failed++;
+        else {
+            receives_completed++;
+            amount_received += receiver_items[receiver_index].amount;
+        }
+
+        // A failed receive doesn't stop the chain, the account's next receivable still gets a try
+        accounts[account_index].busy = false;
+        queue_account(account_index);
+        // Deferred, a receive that fails synchronously would otherwise nest one call per receivable
+        queue_fill();
+    }
+    emit_signal("nano_receive_completed", account, message, code);
+    finish_if_done();
+}
+
+void NanoSweeper::finish_if_done() {
+    if(!sweeping || scan_batch || in_flight) return;
+    if(!check_budget()) stop_scan();
+    if(!stopping && !ready_accounts.empty()) return;
+
+    sweeping = false;
+    if(stop_reason.empty()) stop_reason = "completed";
+    emit_signal("sweep_completed", get_stats());
+}
+
+Dictionary NanoSweeper::get_stats() {
+    int remaining = 0;
+    for(size_t i = 0; i < accounts.size(); i++) remaining += accounts[i].receivables.size();
+
+    uint64_t elapsed_msec = OS::get_singleton()->get_ticks_msec() - start_msec;
+    Dictionary stats;
+    stats["accounts"] = (int)accounts.size();
+    stats["accounts_scanned"] = accounts_scanned;
+    stats["receivables_found"] = receivables_found;
+    stats["receivables_remaining"] = remaining;
+    stats["receives_completed"] = receives_completed;
+    stats["receives_failed"] = receives_failed;
+    stats["in_flight"] = in_flight;
+    stats["amount_received"] = nano::uint128_union(amount_received).to_string_dec();
+    stats["elapsed_msec"] = elapsed_msec;
+    stats["cpu_msec"] = cpu_usec / 1000;
+    stats["receives_per_second"] = elapsed_msec ? receives_completed * 1000.0 / elapsed_msec : 0.0;
+    stats["stop_reason"] = stop_reason;
+    return stats;
+}
+
+void NanoSweeper::_bind_methods() {
+    ClassDB::bind_method(D_METHOD("set_node_urls", "urls"), &NanoSweeper::set_node_urls);
+    ClassDB::bind_method(D_METHOD("get_node_urls"), &NanoSweeper::get_node_urls);
+    ClassDB::bind_method(D_METHOD("set_connection_parameters", "node_url", "default_representative", "auth_header", "use_ssl", "work_url", "use_peers"), &NanoSweeper::set_connection_parameters, DEFVAL(""), DEFVAL(true), DEFVAL(""), DEFVAL(false));
+    ClassDB::bind_method(D_METHOD("sweep", "accounts"), &NanoSweeper::sweep);
+    ClassDB::bind_method(D_METHOD("stop"), &NanoSweeper::stop);
+    ClassDB::bind_method(D_METHOD("is_sweeping"), &NanoSweeper::is_sweeping);
+    ClassDB::bind_method(D_METHOD("get_stats"), &NanoSweeper::get_stats);
+
+    ClassDB::bind_method(D_METHOD("set_max_concurrency", "concurrency"), &NanoSweeper::set_max_concurrency);
+    ClassDB::bind_method(D_METHOD("get_max_concurrency"), &NanoSweeper::get_max_concurrency);
+    ClassDB::bind_method(D_METHOD("set_batch_size", "size"), &NanoSweeper::set_batch_size);
+    ClassDB::bind_method(D_METHOD("get_batch_size"), &NanoSweeper::get_batch_size);
+    ClassDB::bind_method(D_METHOD("set_receivables_per_account", "count"), &NanoSweeper::set_receivables_per_account);
+    ClassDB::bind_method(D_METHOD("get_receivables_per_account"), &NanoSweeper::get_receivables_per_account);
+    ClassDB::bind_method(D_METHOD("set_threshold", "raw_amount"), &NanoSweeper::set_threshold);
+    ClassDB::bind_method(D_METHOD("get_threshold"), &NanoSweeper::get_threshold);
+    ClassDB::bind_method(D_METHOD("set_time_budget_msec", "msec"), &NanoSweeper::set_time_budget_msec);
+    ClassDB::bind_method(D_METHOD("get_time_budget_msec"), &NanoSweeper::get_time_budget_msec);
+    ClassDB::bind_method(D_METHOD("set_cpu_budget_msec", "msec"), &NanoSweeper::set_cpu_budget_msec);
+    ClassDB::bind_method(D_METHOD("get_cpu_budget_msec"), &NanoSweeper::get_cpu_budget_msec);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "max_concurrency"), "set_max_concurrency", "get_max_concurrency");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "batch_size"), "set_batch_size", "get_batch_size");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "receivables_per_account"), "set_receivables_per_account", "get_receivables_per_account");
+    ADD_PROPERTY(PropertyInfo(Variant::STRING, "threshold"), "set_threshold", "get_threshold");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "time_budget_msec"), "set_time_budget_msec", "get_time_budget_msec");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "cpu_budget_msec"), "set_cpu_budget_msec", "get_cpu_budget_msec");
+
+    ClassDB::bind_method(D_METHOD("_pending_chunk", "batch_id", "action", "result"), &NanoSweeper::_pending_chunk);
+    ClassDB::bind_method(D_METHOD("_pending_done", "batch_id", "action", "result"), &NanoSweeper::_pending_done);
+    ClassDB::bind_method(D_METHOD("_receive_completed", "account", "message", "code", "receiver_index"), &NanoSweeper::_receive_completed);
+    ClassDB::bind_method(D_METHOD("_fill_receivers"), &NanoSweeper::_fill_receivers);
+
+    ADD_SIGNAL(MethodInfo("nano_receive_completed", PropertyInfo(Variant::OBJECT, "account"), PropertyInfo(Variant::STRING, "message"), PropertyInfo(Variant::INT, "response_code")));
+    ADD_SIGNAL(MethodInfo("sweep_completed", PropertyInfo(Variant::DICTIONARY, "stats")));
+}
\ No newline at end of file
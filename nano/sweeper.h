@@ -0,0 +1,116 @@
+#ifndef NANO_SWEEPER_H_
+#define NANO_SWEEPER_H_
+
+#include "account.h"
+#include "amount.h"
+#include "receiver.h"
+#include "requester.h"
+
+#include "scene/main/node.h"
+
+#include <queue>
+#include <vector>
+
+// Finds receivables for many accounts with batched accounts_pending calls, then drains them largest first.
+// Every account is its own chain (a receive needs the previous frontier), so at most one receive per account is in flight.
+class NanoSweeper : public Node {
+    GDCLASS(NanoSweeper, Node)
+
+    private:
+        struct Receivable {
+            nano::uint128_t amount;
+            String hash;
+        };
+
+        struct AccountQueue {
+            Ref<NanoAccount> account;
+            std::vector<Receivable> receivables; // Sorted ascending, so the largest is at the back
+            bool busy = false;
+        };
+
+        struct AccountPriority {
+            nano::uint128_t amount;
+            int account_index;
+            bool operator<(const AccountPriority & other) const { return amount < other.amount; }
+        };
+
+        NanoRequest * requester;
+        Vector<NanoReceiver *> receivers;
+        std::vector<int> receiver_accounts; // Account index each receiver is working on, -1 when idle
+        std::vector<Receivable> receiver_items;
+
+        std::vector<AccountQueue> accounts;
+        std::priority_queue<AccountPriority> ready_accounts; // Idle accounts keyed by their largest receivable
+        Map<String, int> account_lookup;
+
+        bool sweeping = false;
+        bool stopping = false;
+        int scan_batch = 0; // Batch id of the accounts_pending lookup, 0 once it is done
+        String stop_reason;
+        int accounts_scanned = 0;
+        int in_flight = 0;
+        bool fill_queued = false; // A deferred _fill_receivers is pending
+
+        uint64_t start_msec = 0;
+        uint64_t cpu_usec = 0;
+        int receivables_found = 0;
+        int receives_completed = 0;
+        int receives_failed = 0;
+        nano::uint128_t amount_received;
+
+        String node_url;
+        PoolStringArray node_urls;
+        Ref<NanoAccount> default_rep;
+        String work_url;
+        String auth;
+        bool use_ssl = true;
+        bool use_peers = false;
+
+        int max_concurrency = 4;
+        int batch_size = 100;
+        int receivables_per_account = 50;
+        String threshold;
+        int time_budget_msec = 0;
+        int cpu_budget_msec = 0;
+
+        void stop_scan();
+        void queue_account(int account_index);
+        void fill_receivers();
+        void queue_fill();
+        bool check_budget();
+        void finish_if_done();
+
+    protected:
+        static void _bind_methods();
+    public:
+        void set_node_urls(PoolStringArray urls);
+        PoolStringArray get_node_urls() { return node_urls; }
+        void set_connection_parameters(String node_url, Ref<NanoAccount> default_representative, String auth_header = "", bool use_ssl = true, String work_url = "", bool use_peers = false);
+
+        Error sweep(Array accounts);
+        void stop();
+        bool is_sweeping() { return sweeping; }
+        Dictionary get_stats();
+
+        void _pending_chunk(int batch_id, String action, Dictionary result);
+        void _pending_done(int batch_id, String action, Dictionary result);
+        void _receive_completed(Ref<NanoAccount> account, String message, int code, int receiver_index);
+        void _fill_receivers();
+
+        void set_max_concurrency(int concurrency);
+        int get_max_concurrency() { return max_concurrency; }
+        void set_batch_size(int size) { batch_size = MAX(size, 1); }
+        int get_batch_size() { return batch_size; }
+        void set_receivables_per_account(int count) { receivables_per_account = MAX(count, 1); }
+        int get_receivables_per_account() { return receivables_per_account; }
+        void set_threshold(String raw_amount) { threshold = raw_amount; }
+        String get_threshold() { return threshold; }
+        void set_time_budget_msec(int msec) { time_budget_msec = MAX(msec, 0); }
+        int get_time_budget_msec() { return time_budget_msec; }
+        void set_cpu_budget_msec(int msec) { cpu_budget_msec = MAX(msec, 0); }
+        int get_cpu_budget_msec() { return cpu_budget_msec; }
+
+        NanoSweeper();
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,282 @@
+#include "wallet.h"
+
+#include "job_pool.h"
+#include "../duthomhas/csprng.hpp"
+
+#include "core/io/file_access_encrypted.h"
+#include "core/message_queue.h"
+#include "core/os/file_access.h"
+
+namespace {
+const char wallet_magic[4] = { 'N', 'W', 'L', 'T' };
+const int keys_per_slice = 32; // A curve operation each
+
+struct DeriveRows {
+    const std::array<uint8_t, 32> * seed;
+    int first;
+    uint8_t * keys;
+};
+
+void derive_rows(void * p_data, int from, int to) {
+    DeriveRows * rows = static_cast<DeriveRows *>(p_data);
+    std::array<uint8_t, 32> private_key;
+    std::array<uint8_t, 32> public_key;
+    for(int i = from; i < to; i++) {
+        NanoAccount::derive_private_key(*rows->seed, rows->first + i, private_key);
+        NanoAccount::derive_public_key(private_key, public_key);
+        memcpy(rows->keys + i * 32, public_key.data(), 32);
+    }
+    private_key.fill(0);
+}
+
+void derive_keys(const std::array<uint8_t, 32> & seed, int first, int count, uint8_t * r_keys) {
+    DeriveRows rows = { &seed, first, r_keys };
+    NanoJobPool * pool = NanoJobPool::get_singleton();
+    if(pool) pool->parallel_for(count, keys_per_slice, derive_rows, &rows);
+    else derive_rows(&rows, 0, count);
+}
+
+class DeriveJob : public NanoJob {
+    private:
+        ObjectID wallet;
+        int generation;
+        std::array<uint8_t, 32> seed;
+        int first;
+        int count;
+
+    public:
+        void run() {
+            PoolByteArray keys;
+            keys.resize(count * 32);
+            derive_keys(seed, first, count, keys.write().ptr());
+            MessageQueue::get_singleton()->push_call(wallet, "_accounts_derived", generation, first, keys);
+        }
+
+        DeriveJob(ObjectID p_wallet, int p_generation, const std::array<uint8_t, 32> & p_seed, int p_first, int p_count) :
+            wallet(p_wallet), generation(p_generation), seed(p_seed), first(p_first), count(p_count) {}
+        ~DeriveJob() { seed.fill(0); }
+};
+}
+
+NanoWallet::NanoWallet() {
+    seed.fill(0);
+}
+
+NanoWallet::~NanoWallet() {
+    clear();
+}
+
+void NanoWallet::clear() {
+    seed.fill(0);
+    has_seed = false;
+    public_keys.clear();
+    key_index.clear();
+    generation++;
+    pending_count = 0;
+    derived.clear();
+}
+
+void NanoWallet::initialize_with_new_seed(int count) {
+    clear();
+    duthomhas::csprng rng;
+    rng(seed);
+    has_seed = true;
+    add_accounts(count);
+}
+
+Error NanoWallet::set_seed(String p_seed, int count) {
+    std::array<uint8_t, 32> new_seed;
+    ERR_FAIL_COND_V_MSG(p_seed.length() != 64 || !p_seed.is_valid_hex_number(false), ERR_INVALID_PARAMETER, "The seed must be 64 hex characters");
+    for(int i = 0; i < 64; i += 2)
+        new_seed[i / 2] = p_seed.substr(i, 2).hex_to_int(false);
+    clear();
+    seed = new_seed;
+    has_seed = true;
+    add_accounts(count);
+    return OK;
+}
+
+String NanoWallet::get_seed() const {
+    if(!has_seed) return String();
+    nano::uint256_union value;
+    value.bytes = seed;
+    return value.to_string();
+}
+
+int NanoWallet::add_accounts(int count) {
+    ERR_FAIL_COND_V_MSG(!has_seed, -1, "The wallet has no seed");
+    ERR_FAIL_COND_V_MSG(pending_count > 0, -1, "Accounts are still being derived by add_accounts_async");
+    int first = public_keys.size();
+    if(count <= 0) return first;
+    public_keys.resize(first + count);
+    derive_keys(seed, first, count, public_keys[first].data());
+    index_keys(first);
+    return first;
+}
+
+int NanoWallet::add_accounts_async(int count) {
+    ERR_FAIL_COND_V_MSG(!has_seed, -1, "The wallet has no seed");
+    ERR_FAIL_COND_V_MSG(count <= 0, -1, "count must be positive");
+    int first = public_keys.size() + pending_count;
+    pending_count += count;
+    NanoJobPool::get_singleton()->submit(memnew(DeriveJob(get_instance_id(), generation, seed, first, count)));
+    return first;
+}
+
+void NanoWallet::_accounts_derived(int p_generation, int first, const PoolByteArray & keys) {
+    // A clear, a new seed or a load in the meantime makes the keys belong to another wallet
+    if(p_generation != (int)generation) return;
+    derived[first] = keys;
+
+    // Jobs finish in any order, keys are appended in index order
+    Map<int, PoolByteArray>::Element * e;
+    while((e = derived.find(public_keys.size()))) {
+        int from = e->key();
+        int count = e->get().size() / 32;
+        public_keys.resize(from + count);
+        memcpy(public_keys[from].data(), e->get().read().ptr(), count * 32);
+        derived.erase(e);
+        pending_count -= count;
+        index_keys(from);
+        emit_signal("accounts_added", from, count);
+    }
+}
+
+void NanoWallet::index_keys(int from) {
+    if(key_index.empty()) return; // Built on the first lookup
+    for(size_t i = from; i < public_keys.size(); i++) {
+        nano::uint256_union key;
+        key.bytes = public_keys[i];
+        key_index[key] = i;
+    }
+}
+
+String NanoWallet::get_public_key(int index) const {
+    ERR_FAIL_INDEX_V(index, (int)public_keys.size(), String());
+    nano::uint256_union key;
+    key.bytes = public_keys[index];
+    return key.to_string();
+}
+
+String NanoWallet::get_address(int index) const {
+    ERR_FAIL_INDEX_V(index, (int)public_keys.size(), String());
+    return NanoAccount::encode_address(public_keys[index]);
+}
+
+PoolStringArray NanoWallet::get_addresses(int from, int count) const {
+    PoolStringArray addresses;
+    int end = count < 0 ? public_keys.size() : MIN(from + count, (int)public_keys.size());
+    for(int i = MAX(from, 0); i < end; i++)
+        addresses.push_back(NanoAccount::encode_address(public_keys[i]));
+    return addresses;
+}
+
+int NanoWallet::find_address(String address) const {
+    nano::uint256_union key;
+    if(NanoAccount::decode_address(address, key.bytes)) return -1;
+    if(key_index.empty()) {
+        for(size_t i = 0; i < public_keys.size(); i++) {
+            nano::uint256_union stored;
+            stored.bytes = public_keys[i];
+            key_index[stored] = i;
+        }
+    }
+    const Map<nano::uint256_union, int>::Element * e = key_index.find(key);
+    return e ? e->get() : -1;
+}
+
+Ref<NanoAccount> NanoWallet::get_account(int index) const {
+    ERR_FAIL_COND_V_MSG(!has_seed, Ref<NanoAccount>(), "The wallet has no seed");
+    ERR_FAIL_INDEX_V(index, (int)public_keys.size(), Ref<NanoAccount>());
+    Ref<NanoAccount> account(memnew(NanoAccount));
+    account->set_seed_index_and_public_key(seed, index, public_keys[index]);
+    return account;
+}
+
+Error NanoWallet::save(String path, String password) {
+    ERR_FAIL_COND_V_MSG(!has_seed, ERR_UNCONFIGURED, "The wallet has no seed");
+    ERR_FAIL_COND_V_MSG(password.empty(), ERR_INVALID_PARAMETER, "A password is required");
+    Error err;
+    FileAccess * f = FileAccess::open(path, FileAccess::WRITE, &err);
+    ERR_FAIL_COND_V_MSG(err != OK, err, "Could not open " + path);
+    FileAccessEncrypted * fae = memnew(FileAccessEncrypted);
+    err = fae->open_and_parse_password(f, password, FileAccessEncrypted::MODE_WRITE_AES256);
+    if(err != OK) {
+        memdelete(fae);
+        memdelete(f);
+        ERR_FAIL_V_MSG(err, "Could not encrypt " + path);
+    }
+
+    // magic, version, seed, count, then 32 bytes per public key
+    fae->store_buffer(reinterpret_cast<const uint8_t *>(wallet_magic), sizeof(wallet_magic));
+    fae->store_32(VERSION);
+    fae->store_buffer(seed.data(), seed.size());
+    fae->store_32(public_keys.size());
+    for(size_t i = 0; i < public_keys.size(); i++)
+        fae->store_buffer(public_keys[i].data(), public_keys[i].size());
+    fae->close(); // Also closes f
+    memdelete(fae);
+    return OK;
+}
+
+Error NanoWallet::load(String path, String password) {
+    Error err;
+    FileAccess * f = FileAccess::open(path, FileAccess::READ, &err);
+    ERR_FAIL_COND_V_MSG(err != OK, err, "Could not open " + path);
+    FileAccessEncrypted * fae = memnew(FileAccessEncrypted);
+    err = fae->open_and_parse_password(f, password, FileAccessEncrypted::MODE_READ);
+    if(err != OK) {
+        // Also what a wrong password gives
+        memdelete(fae);
+        memdelete(f);
+        return err;
+    }
+
+    char magic[4];
+    fae->get_buffer(reinterpret_cast<uint8_t *>(magic), sizeof(magic));
+    uint32_t version = fae->get_32();
+    std::array<uint8_t, 32> new_seed;
+    fae->get_buffer(new_seed.data(), new_seed.size());
+    uint32_t count = fae->get_32();
+    if(memcmp(magic, wallet_magic, sizeof(magic)) != 0 || version != VERSION || fae->get_len() != fae->get_position() + (uint64_t)count * 32) {
+        fae->close();
+        memdelete(fae);
+        new_seed.fill(0);
+        ERR_FAIL_V_MSG(ERR_FILE_CORRUPT, "Not a wallet file: " + path);
+    }
+
+    // One read of the whole table, no keys are derived
+    clear();
+    seed = new_seed;
+    new_seed.fill(0);
+    has_seed = true;
+    public_keys.resize(count);
+    if(count) fae->get_buffer(public_keys[0].data(), count * 32);
+    fae->close();
+    memdelete(fae);
+    return OK;
+}
+
+void NanoWallet::_bind_methods() {
+    ClassDB::bind_method(D_METHOD("initialize_with_new_seed", "count"), &NanoWallet::initialize_with_new_seed, DEFVAL(1));
+    ClassDB::bind_method(D_METHOD("set_seed", "seed", "count"), &NanoWallet::set_seed, DEFVAL(1));
+    ClassDB::bind_method(D_METHOD("get_seed"), &NanoWallet::get_seed);
+    ClassDB::bind_method(D_METHOD("is_initialized"), &NanoWallet::is_initialized);
+    ClassDB::bind_method(D_METHOD("add_accounts", "count"), &NanoWallet::add_accounts);
+    ClassDB::bind_method(D_METHOD("add_accounts_async", "count"), &NanoWallet::add_accounts_async);
+    ClassDB::bind_method(D_METHOD("get_pending_account_count"), &NanoWallet::get_pending_account_count);
+    ClassDB::bind_method(D_METHOD("_accounts_derived", "generation", "first", "keys"), &NanoWallet::_accounts_derived);
+    ClassDB::bind_method(D_METHOD("get_account_count"), &NanoWallet::get_account_count);
+
+    ClassDB::bind_method(D_METHOD("get_public_key", "index"), &NanoWallet::get_public_key);
+    ClassDB::bind_method(D_METHOD("get_address", "index"), &NanoWallet::get_address);
+    ClassDB::bind_method(D_METHOD("get_addresses", "from", "count"), &NanoWallet::get_addresses, DEFVAL(0), DEFVAL(-1));
+    ClassDB::bind_method(D_METHOD("find_address", "address"), &NanoWallet::find_address);
+    ClassDB::bind_method(D_METHOD("get_account", "index"), &NanoWallet::get_account);
+
+    ClassDB::bind_method(D_METHOD("save", "path", "password"), &NanoWallet::save);
+    ClassDB::bind_method(D_METHOD("load", "path", "password"), &NanoWallet::load);
+    ClassDB::bind_method(D_METHOD("clear"), &NanoWallet::clear);
+
+    ADD_SIGNAL(MethodInfo("accounts_added", PropertyInfo(Variant::INT, "first_index"), PropertyInfo(Variant::INT, "count")));
+}
\ No newline at end of file
@@ -0,0 +1,63 @@
+#ifndef NANO_WALLET_H_
+#define NANO_WALLET_H_
+
+#include "account.h"
+#include "numbers.h"
+
+#include "core/map.h"
+#include "core/reference.h"
+
+#include <array>
+#include <vector>
+
+// A seed and the public keys of its first accounts, kept in one encrypted file.
+// Deriving a public key is a curve multiplication, so it happens once per index when the account is added
+// and never on load. Private keys are only hashed from the seed when an account is handed out for signing.
+class NanoWallet : public Reference {
+    GDCLASS(NanoWallet, Reference);
+
+    private:
+        enum { VERSION = 1 };
+
+        std::array<uint8_t, 32> seed;
+        bool has_seed = false;
+        std::vector<std::array<uint8_t, 32> > public_keys; // By index
+        mutable Map<nano::uint256_union, int> key_index; // Built on the first lookup by address
+
+        uint32_t generation = 0; // Bumped by clear, so late async keys of the old seed are dropped
+        int pending_count = 0;
+        Map<int, PoolByteArray> derived; // Async results that arrived before the ones in front of them
+
+        void index_keys(int from);
+
+    protected:
+        static void _bind_methods();
+    public:
+        void initialize_with_new_seed(int count = 1);
+        Error set_seed(String seed, int count = 1);
+        String get_seed() const;
+        bool is_initialized() const { return has_seed; }
+
+        // Derives the public keys of the next count indices, returns the first new index
+        int add_accounts(int count);
+        // Same on NanoJobPool, emits accounts_added when the keys are in. Returns the first index they will get
+        int add_accounts_async(int count);
+        int get_pending_account_count() const { return pending_count; }
+        void _accounts_derived(int p_generation, int first, const PoolByteArray & keys);
+        int get_account_count() const { return public_keys.size(); }
+
+        String get_public_key(int index) const;
+        String get_address(int index) const;
+        PoolStringArray get_addresses(int from = 0, int count = -1) const;
+        int find_address(String address) const;
+        Ref<NanoAccount> get_account(int index) const;
+
+        Error save(String path, String password);
+        Error load(String path, String password);
+        void clear();
+
+        NanoWallet();
+        ~NanoWallet();
+};
+
+#endif
\ No newline at end of file
@@ -2,6 +2,9 @@
 
 #include "core/io/json.h"
 #include "core/method_bind_ext.gen.inc"
+#include "core/os/os.h"
+
+#include <iterator>
 
 Array accountsToAddresses(Array accounts) {
     Array addresses;
@@ -13,6 +16,8 @@ Array accountsToAddresses(Array accounts) {
 }
 
 NanoWatcher::NanoWatcher() {
+    network_exit = false;
+    network_running = false;
     set_process(true);
     Ref<WebSocketClient> client(WebSocketClient::create());
     _client = client;
@@ -36,6 +41,10 @@ NanoWatcher::NanoWatcher() {
     receiver->connect("nano_receive_completed", this, "_auto_receive_completed");
 }
 
+NanoWatcher::~NanoWatcher() {
+    stop_network_thread();
+}
+
 void NanoWatcher::_on_timeout() {
     Dictionary request;
     request["action"] = "ping";
@@ -58,6 +67,11 @@ Ref<NanoAccount> NanoWatcher::lookup_watched_account(String address) {
     return NULL;
 }
 
+void NanoWatcher::set_node_urls(PoolStringArray urls) {
+    if(urls.size()) node_url = urls[0];
+    receiver->set_node_urls(urls);
+}
+
 Error NanoWatcher::initialize_and_connect(String websocket_url, Ref<NanoAccount> default_representative, String node_url, String auth_header, bool use_ssl, String work_url, bool use_peers) {
     this->websocket_url = websocket_url;
     this->node_url = node_url;
@@ -73,12 +87,20 @@ Error NanoWatcher::initialize_and_connect(String websocket_url, Ref<NanoAccount>
     Vector<String> headers;
     if(!auth_header.empty())
         headers.push_back(auth_header);
-    
-    return _client->connect_to_url(websocket_url, Vector<String>(), false, headers);
+
+    // The client is only touched from one thread at a time
+    stop_network_thread();
+    Error err = _client->connect_to_url(websocket_url, Vector<String>(), false, headers);
+    if(err == OK && threaded_polling) start_network_thread();
+    return err;
 }
 
 void NanoWatcher::write_data(String data) {
+    if(!network_running) return send_packet(data);
+    ERR_FAIL_COND_MSG(!outgoing.push(data), "Websocket send queue is full, message dropped");
+}
 
+void NanoWatcher::send_packet(const String & data) {
     CharString charstr = data.utf8();
     PoolByteArray packet;
     size_t len = charstr.length();
@@ -93,6 +115,16 @@ void NanoWatcher::write_data(String data) {
 }
 
 void NanoWatcher::_connected(String proto) {
+    if(network_running) {
+        NetworkEvent event;
+        event.type = NetworkEvent::EVENT_CONNECTED;
+        return push_network_event(event);
+    }
+    handle_connected();
+}
+
+void NanoWatcher::handle_connected() {
+    connected = true;
     if(!watched_accounts.empty()){
         Dictionary request;
         request["topic"] = "confirmation";
@@ -107,7 +139,11 @@ void NanoWatcher::_connected(String proto) {
     }
 }
 
-bool NanoWatcher::is_websocket_connected() { return _client->get_connection_status() == WebSocketClient::CONNECTION_CONNECTED; }
+bool NanoWatcher::is_websocket_connected() {
+    // The network thread owns the client, its state is known from the events that were handled so far
+    if(network_running) return connected;
+    return _client->get_connection_status() == WebSocketClient::CONNECTION_CONNECTED;
+}
 
 void NanoWatcher::add_watched_account(Ref<NanoAccount> account) {
     Array add_accounts;
@@ -142,19 +178,81 @@ void NanoWatcher::update_watched_accounts(Array accounts_add, Array accounts_del
 }
 
 void NanoWatcher::_closed(bool was_clean) {
+    if(network_running) {
+        NetworkEvent event;
+        event.type = NetworkEvent::EVENT_CLOSED;
+        event.was_clean = was_clean;
+        return push_network_event(event);
+    }
+    handle_closed(was_clean);
+}
+
+void NanoWatcher::handle_closed(bool was_clean) {
+    connected = false;
     emit_signal("disconnected", was_clean);
 }
 
 void NanoWatcher::process_next_receive() {
     if(pending_receives.empty()) return;
-    Dictionary b = pending_receives.pop_front();
-    receiver->receive(b.get("account", memnew(NanoAccount)), b.get("hash", ""), b.get("amount", memnew(NanoAmount)));
+    std::multiset<PendingReceive>::iterator next = std::prev(pending_receives.end());
+    PendingReceive r = *next;
+    pending_receives.erase(next);
+
+    receiver->receive_raw(r.account, r.hash, nano::uint128_union(r.amount));
 }
 
-void NanoWatcher::_on_data() {
+void NanoWatcher::drop_receive(Ref<NanoAccount> account, String hash, nano::uint128_t amount, String reason) {
+    dropped_receives++;
+    emit_signal("receive_dropped", account, hash, nano::uint128_union(amount).to_string_dec(), reason);
+}
+
+void NanoWatcher::queue_receive(Ref<NanoAccount> account, String hash, String raw_amount) {
+    PendingReceive r;
+    nano::uint128_union amount;
+    ERR_FAIL_COND_MSG(amount.decode_dec(raw_amount), "Invalid amount on confirmed send " + hash);
+    r.amount = amount.number();
+    r.sequence = receive_sequence++;
+    r.account = account;
+    r.hash = hash;
+
+    if((int)pending_receives.size() >= max_pending_receives) {
+        std::multiset<PendingReceive>::iterator smallest = pending_receives.begin();
+        if(overflow_policy == OVERFLOW_DROP_NEWEST || !(*smallest < r)) return drop_receive(account, hash, r.amount, "backlog_full");
+        PendingReceive evicted = *smallest;
+        pending_receives.erase(smallest);
+        drop_receive(evicted.account, evicted.hash, evicted.amount, "backlog_full");
+    }
+    pending_receives.insert(r);
+}
+
+int NanoWatcher::set_receive_threshold(String raw_amount) {
+    if(raw_amount.empty()) raw_amount = "0";
+    nano::uint128_union amount;
+    ERR_FAIL_COND_V_MSG(amount.decode_dec(raw_amount), 1, "Invalid receive threshold");
+    receive_threshold = amount.number();
+    return 0;
+}
+
+String NanoWatcher::get_receive_threshold() { return nano::uint128_union(receive_threshold).to_string_dec(); }
+
+void NanoWatcher::set_max_pending_receives(int max) {
+    max_pending_receives = MAX(max, 1);
+    while((int)pending_receives.size() > max_pending_receives) {
+        PendingReceive evicted = *pending_receives.begin();
+        pending_receives.erase(pending_receives.begin());
+        drop_receive(evicted.account, evicted.hash, evicted.amount, "backlog_full");
+    }
+}
+
+void NanoWatcher::set_ledger(Ref<NanoLedger> p_ledger) {
+    ledger = p_ledger;
+    receiver->set_ledger(p_ledger); // Auto receives land in the ledger as soon as they are processed
+}
+
+bool NanoWatcher::read_message(Dictionary & r_json) {
     const uint8_t * data;
     int buffer_size;
-    _client->get_peer(1)->get_packet(&data, buffer_size);
+    if(_client->get_peer(1)->get_packet(&data, buffer_size) != OK) return false;
 
     String packet;
     packet.parse_utf8(reinterpret_cast<const char *>(data), buffer_size);
@@ -163,37 +261,142 @@ void NanoWatcher::_on_data() {
     String err_string;
     int err_line;
     Error json_error = JSON::parse(packet, json_result, err_string, err_line);
-    ERR_FAIL_COND_MSG(json_error, "JSON Parsing failed at line " + itos(err_line) + " with message: " + err_string);
-    Dictionary json = json_result;
-    String ack = json.get("ack", "");
-    if(!ack.empty()) return; // This is just a keepalive response
+    ERR_FAIL_COND_V_MSG(json_error, false, "JSON Parsing failed at line " + itos(err_line) + " with message: " + err_string);
+    r_json = json_result;
+    String ack = r_json.get("ack", "");
+    return ack.empty(); // An ack is just a keepalive response
+}
 
+void NanoWatcher::_on_data() {
+    // Everything that arrived is read now, a burst doesn't wait for one callback per packet
+    Ref<WebSocketPeer> peer = _client->get_peer(1);
+    while(peer->get_available_packet_count() > 0) {
+        Dictionary json;
+        if(!read_message(json)) continue;
+        if(network_running) {
+            NetworkEvent event;
+            event.type = NetworkEvent::EVENT_MESSAGE;
+            event.json = json;
+            push_network_event(event);
+        } else {
+            handle_confirmation(json);
+        }
+    }
+}
+
+void NanoWatcher::deliver_confirmation(const Dictionary & json) {
+    if(batch_confirmations) confirmation_batch.push_back(json);
+    else emit_signal("confirmation_received", json);
+}
+
+void NanoWatcher::flush_confirmations() {
+    if(confirmation_batch.empty()) return;
+    Array batch = confirmation_batch;
+    confirmation_batch = Array(); // Arrays are shared, the one handed to scripts is left alone
+    emit_signal("confirmations_received", batch);
+}
+
+void NanoWatcher::handle_confirmation(const Dictionary & json) {
     Dictionary message = json.get("message", Dictionary());
     Ref<NanoAccount> account = lookup_watched_account(message.get("account", ""));
     Dictionary block = message.get("block", "");
-    Ref<NanoAccount> link = lookup_watched_account(block.get("link_as_account", ""));
+    // The block is read into its binary form, the link's account is then decoded locally
+    Ref<NanoBlock> confirmed(memnew(NanoBlock));
+    bool parsed = confirmed->from_json(block) == OK;
+    String link_address = parsed ? confirmed->get_link_as_account() : String(block.get("link_as_account", ""));
+    // Cached balances and histories of both sides are out of date now
+    NanoResponseCache::get_singleton()->invalidate_account(message.get("account", ""));
+    NanoResponseCache::get_singleton()->invalidate_account(link_address);
+    Ref<NanoAccount> link = lookup_watched_account(link_address);
     ERR_FAIL_COND_MSG(account == NULL && link == NULL, "Received notification for non-watched account");
+    if(parsed && account != NULL && ledger.is_valid()) ledger->apply_block(confirmed);
     String subtype = block.get("subtype", "");
     if(auto_receive && subtype == "send" && link != NULL && !link->get_private_key().empty()) {
-        Ref<NanoAmount> amount(memnew(NanoAmount));
-        amount->set_amount(message.get("amount", ""));
-
-        Dictionary info;
-        info["account"] = link;
-        info["hash"] = message.get("hash", "");
-        info["amount"] = amount;
-        pending_receives.append(info);
-        if(receiver->is_ready() && pending_receives.size() == 1){
+        String raw_amount = message.get("amount", "");
+        nano::uint128_union amount;
+        if(!amount.decode_dec(raw_amount) && amount.number() < receive_threshold) {
+            // Dust is not worth the work of a receive block, the confirmation is passed on like any other
+            drop_receive(link, message.get("hash", ""), amount.number(), "below_threshold");
+            deliver_confirmation(json);
+            return;
+        }
+
+        queue_receive(link, message.get("hash", ""), raw_amount);
+        if(receiver->is_ready()){
             process_next_receive();
         }
     } else {
-        emit_signal("confirmation_received", json);
+        deliver_confirmation(json);
     }
 }
 
 void NanoWatcher::_notification(int what) {
     if(what == NOTIFICATION_PROCESS){
-        _client->poll();
+        if(!network_running) _client->poll();
+        drain_network_events();
+        flush_confirmations();
+    }
+}
+
+void NanoWatcher::set_batch_confirmations(bool enabled) {
+    if(!enabled) flush_confirmations(); // Nothing collected so far is lost
+    batch_confirmations = enabled;
+}
+
+void NanoWatcher::set_threaded_polling(bool enabled) {
+    threaded_polling = enabled;
+    if(!enabled) return stop_network_thread();
+    // The network thread owns the client while it runs, it can't be asked for its status from here
+    if(network_running) return;
+    if(_client->get_connection_status() != WebSocketClient::CONNECTION_DISCONNECTED) start_network_thread();
+}
+
+void NanoWatcher::start_network_thread() {
+    if(network_running) return;
+    connected = _client->get_connection_status() == WebSocketClient::CONNECTION_CONNECTED;
+    network_exit = false;
+    network_running = true; // Set first, the client's callbacks on the new thread check it
+    network_thread.start(network_thread_func, this);
+}
+
+void NanoWatcher::stop_network_thread() {
+    if(!network_running) return;
+    network_exit = true;
+    network_thread.wait_to_finish();
+    network_running = false;
+
+    // Whatever was queued for the network thread goes out from here, events already parsed are still handled
+    String data;
+    while(outgoing.pop(data)) send_packet(data);
+}
+
+void NanoWatcher::network_thread_func(void * p_userdata) {
+    NanoWatcher * self = static_cast<NanoWatcher *>(p_userdata);
+    while(!self->network_exit) {
+        self->_client->poll(); // The client's signals fire here, their handlers queue events
+        String data;
+        while(self->outgoing.pop(data)) self->send_packet(data);
+        OS::get_singleton()->delay_usec(1000);
+    }
+}
+
+void NanoWatcher::push_network_event(const NetworkEvent & event) {
+    // A full queue holds back the network thread instead of losing confirmations, the socket buffers meanwhile
+    while(!network_events.push(event)) {
+        if(network_exit) return;
+        OS::get_singleton()->delay_usec(1000);
+    }
+}
+
+void NanoWatcher::drain_network_events() {
+    NetworkEvent event;
+    for(int handled = 0; max_events_per_frame == 0 || handled < max_events_per_frame; handled++) {
+        if(!network_events.pop(event)) return;
+        switch(event.type) {
+            case NetworkEvent::EVENT_CONNECTED: handle_connected(); break;
+            case NetworkEvent::EVENT_CLOSED: handle_closed(event.was_clean); break;
+            case NetworkEvent::EVENT_MESSAGE: handle_confirmation(event.json); break;
+        }
     }
 }
 
@@ -205,6 +408,8 @@ void NanoWatcher::_bind_methods() {
     ClassDB::bind_method(D_METHOD("_connected", "proto"), &NanoWatcher::_connected);
     ClassDB::bind_method(D_METHOD("_auto_receive_completed", "account", "message", "code"), &NanoWatcher::_auto_receive_completed);
 
+    ClassDB::bind_method(D_METHOD("set_node_urls", "urls"), &NanoWatcher::set_node_urls);
+    ClassDB::bind_method(D_METHOD("get_node_urls"), &NanoWatcher::get_node_urls);
     ClassDB::bind_method(D_METHOD("initialize_and_connect", "websocket_url", "default_representative", "node_url", "auth_header", "use_ssl", "work_url", "use_peers"),
         &NanoWatcher::initialize_and_connect, DEFVAL(false), DEFVAL(""), DEFVAL(true), DEFVAL(""));
     ClassDB::bind_method(D_METHOD("add_watched_account", "account"), &NanoWatcher::add_watched_account);
@@ -214,9 +419,40 @@ void NanoWatcher::_bind_methods() {
     ClassDB::bind_method(D_METHOD("get_auto_receive"), &NanoWatcher::get_auto_receive);
     ADD_PROPERTY(PropertyInfo(Variant::BOOL, "auto_receive", PROPERTY_HINT_PROPERTY_OF_BASE_TYPE, ""), "set_auto_receive", "get_auto_receive");
 
+    ClassDB::bind_method(D_METHOD("set_receive_threshold", "raw_amount"), &NanoWatcher::set_receive_threshold);
+    ClassDB::bind_method(D_METHOD("get_receive_threshold"), &NanoWatcher::get_receive_threshold);
+    ADD_PROPERTY(PropertyInfo(Variant::STRING, "receive_threshold"), "set_receive_threshold", "get_receive_threshold");
+    ClassDB::bind_method(D_METHOD("set_max_pending_receives", "max"), &NanoWatcher::set_max_pending_receives);
+    ClassDB::bind_method(D_METHOD("get_max_pending_receives"), &NanoWatcher::get_max_pending_receives);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "max_pending_receives"), "set_max_pending_receives", "get_max_pending_receives");
+    ClassDB::bind_method(D_METHOD("set_overflow_policy", "policy"), &NanoWatcher::set_overflow_policy);
+    ClassDB::bind_method(D_METHOD("get_overflow_policy"), &NanoWatcher::get_overflow_policy);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "overflow_policy", PROPERTY_HINT_ENUM, "Drop Smallest,Drop Newest"), "set_overflow_policy", "get_overflow_policy");
+    ClassDB::bind_method(D_METHOD("get_pending_receive_count"), &NanoWatcher::get_pending_receive_count);
+    ClassDB::bind_method(D_METHOD("get_dropped_receive_count"), &NanoWatcher::get_dropped_receive_count);
+
     ClassDB::bind_method(D_METHOD("is_websocket_connected"), &NanoWatcher::is_websocket_connected);
 
+    ClassDB::bind_method(D_METHOD("set_threaded_polling", "enabled"), &NanoWatcher::set_threaded_polling);
+    ClassDB::bind_method(D_METHOD("get_threaded_polling"), &NanoWatcher::get_threaded_polling);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "threaded_polling"), "set_threaded_polling", "get_threaded_polling");
+    ClassDB::bind_method(D_METHOD("set_batch_confirmations", "enabled"), &NanoWatcher::set_batch_confirmations);
+    ClassDB::bind_method(D_METHOD("get_batch_confirmations"), &NanoWatcher::get_batch_confirmations);
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "batch_confirmations"), "set_batch_confirmations", "get_batch_confirmations");
+    ClassDB::bind_method(D_METHOD("set_max_events_per_frame", "max"), &NanoWatcher::set_max_events_per_frame);
+    ClassDB::bind_method(D_METHOD("get_max_events_per_frame"), &NanoWatcher::get_max_events_per_frame);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "max_events_per_frame"), "set_max_events_per_frame", "get_max_events_per_frame");
+
+    ClassDB::bind_method(D_METHOD("set_ledger", "ledger"), &NanoWatcher::set_ledger);
+    ClassDB::bind_method(D_METHOD("get_ledger"), &NanoWatcher::get_ledger);
+    ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "ledger", PROPERTY_HINT_NONE, "", 0), "set_ledger", "get_ledger");
+
     ADD_SIGNAL(MethodInfo("nano_receive_completed", PropertyInfo(Variant::OBJECT, "account"), PropertyInfo(Variant::STRING, "message"), PropertyInfo(Variant::INT, "response_code")));
     ADD_SIGNAL(MethodInfo("confirmation_received", PropertyInfo(Variant::DICTIONARY, "json")));
+    ADD_SIGNAL(MethodInfo("confirmations_received", PropertyInfo(Variant::ARRAY, "confirmations")));
     ADD_SIGNAL(MethodInfo("disconnected", PropertyInfo(Variant::BOOL, "was_clean")));
+    ADD_SIGNAL(MethodInfo("receive_dropped", PropertyInfo(Variant::OBJECT, "account"), PropertyInfo(Variant::STRING, "hash"), PropertyInfo(Variant::STRING, "amount"), PropertyInfo(Variant::STRING, "reason")));
+
+    BIND_ENUM_CONSTANT(OVERFLOW_DROP_SMALLEST);
+    BIND_ENUM_CONSTANT(OVERFLOW_DROP_NEWEST);
 }
\ No newline at end of file
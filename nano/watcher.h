@@ -3,15 +3,38 @@
 
 #include "account.h"
 #include "receiver.h"
+#include "spsc_queue.h"
 
 #include "core/list.h"
+#include "core/os/thread.h"
 #include "scene/main/node.h"
 #include "modules/websocket/websocket_client.h"
 
+#include <atomic>
+#include <set>
+
 class NanoWatcher : public Node {
     GDCLASS(NanoWatcher, Node);
 
+    public:
+        enum OverflowPolicy {
+            OVERFLOW_DROP_SMALLEST,
+            OVERFLOW_DROP_NEWEST
+        };
+
     private:
+        struct PendingReceive {
+            nano::uint128_t amount;
+            uint64_t sequence;
+            Ref<NanoAccount> account;
+            String hash;
+            // Largest amount first, and the oldest of equal amounts, so a dust flood can't push a deposit back
+            bool operator<(const PendingReceive & other) const {
+                if(amount != other.amount) return amount < other.amount;
+                return sequence > other.sequence;
+            }
+        };
+
         Ref<WebSocketClient> _client;
 
         Array watched_accounts;
@@ -22,6 +45,7 @@ class NanoWatcher : public Node {
         String websocket_url;
         String node_url;
         Ref<NanoAccount> default_rep;
+        Ref<NanoLedger> ledger; // Confirmed blocks of watched accounts are appended here
         String auth_header;
         bool use_ssl;
         String work_url;
@@ -32,10 +56,57 @@ class NanoWatcher : public Node {
         void _on_data();
 
         void write_data(String data);
+        void send_packet(const String & data);
+        bool read_message(Dictionary & r_json); // False for keepalive answers and unparsable packets
+        void handle_connected();
+        void handle_closed(bool was_clean);
+        void handle_confirmation(const Dictionary & json);
+
+        // With batch_confirmations, a frame's confirmations go out as one confirmations_received
+        bool batch_confirmations = false;
+        Array confirmation_batch;
+        void deliver_confirmation(const Dictionary & json);
+        void flush_confirmations();
+
+        // With threaded_polling, network_thread polls the client and parses messages, so confirmations keep
+        // arriving at a low frame rate. It only touches _client and the two queues, the events are handled
+        // on the main thread at most max_events_per_frame per frame.
+        struct NetworkEvent {
+            enum Type {
+                EVENT_CONNECTED,
+                EVENT_CLOSED,
+                EVENT_MESSAGE
+            };
+            Type type = EVENT_MESSAGE;
+            bool was_clean = false;
+            Dictionary json;
+        };
+        bool threaded_polling = false;
+        int max_events_per_frame = 0;
+        bool connected = false; // As last seen by the main thread
+        Thread network_thread;
+        std::atomic<bool> network_running;
+        std::atomic<bool> network_exit;
+        NanoSpscQueue<NetworkEvent> network_events; // Network thread to main thread
+        NanoSpscQueue<String> outgoing; // Main thread to network thread
+
+        static void network_thread_func(void * p_userdata);
+        void start_network_thread();
+        void stop_network_thread();
+        void push_network_event(const NetworkEvent & event);
+        void drain_network_events();
+
+        std::multiset<PendingReceive> pending_receives; // Highest priority at the back
+        uint64_t receive_sequence = 0;
+        nano::uint128_t receive_threshold;
+        int max_pending_receives = 1000;
+        OverflowPolicy overflow_policy = OVERFLOW_DROP_SMALLEST;
+        int dropped_receives = 0;
 
-        Array pending_receives;
         NanoReceiver * receiver;
         void process_next_receive();
+        void queue_receive(Ref<NanoAccount> account, String hash, String raw_amount);
+        void drop_receive(Ref<NanoAccount> account, String hash, nano::uint128_t amount, String reason);
 
         Ref<NanoAccount> lookup_watched_account(String address);
 
@@ -43,6 +114,8 @@ class NanoWatcher : public Node {
         static void _bind_methods();
     public:
         Error initialize_and_connect(String websocket_url, Ref<NanoAccount> default_representative, String node_url = "", String auth_header = "", bool use_ssl = true, String work_url = "", bool use_peers = false);
+        void set_node_urls(PoolStringArray urls);
+        PoolStringArray get_node_urls() { return receiver->get_node_urls(); }
         void add_watched_account(Ref<NanoAccount> account);
         void update_watched_accounts(Array accounts_add, Array accounts_del = Array());
 
@@ -53,9 +126,31 @@ class NanoWatcher : public Node {
         void set_auto_receive(bool receive) { this->auto_receive = receive; }
         bool get_auto_receive() { return auto_receive; }
 
+        int set_receive_threshold(String raw_amount);
+        String get_receive_threshold();
+        void set_max_pending_receives(int max);
+        int get_max_pending_receives() { return max_pending_receives; }
+        void set_overflow_policy(OverflowPolicy policy) { overflow_policy = policy; }
+        OverflowPolicy get_overflow_policy() { return overflow_policy; }
+        int get_pending_receive_count() { return pending_receives.size(); }
+        int get_dropped_receive_count() { return dropped_receives; }
+
         bool is_websocket_connected();
 
+        void set_batch_confirmations(bool enabled);
+        bool get_batch_confirmations() { return batch_confirmations; }
+        void set_threaded_polling(bool enabled);
+        bool get_threaded_polling() { return threaded_polling; }
+        void set_max_events_per_frame(int max) { max_events_per_frame = MAX(max, 0); }
+        int get_max_events_per_frame() { return max_events_per_frame; }
+
+        void set_ledger(Ref<NanoLedger> p_ledger);
+        Ref<NanoLedger> get_ledger() { return ledger; }
+
         NanoWatcher();
+        ~NanoWatcher();
 };
 
+VARIANT_ENUM_CAST(NanoWatcher::OverflowPolicy);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,405 @@
+#include "work.h"
+
+#include "job_pool.h"
+#include "node_stats.h"
+#include "../blake2/blake2.h"
+#include "../duthomhas/csprng.hpp"
+
+#include "core/io/json.h"
+#include "core/message_queue.h"
+#include "core/method_bind_ext.gen.inc"
+#include "core/os/os.h"
+
+#include <algorithm>
+#include <vector>
+
+bool nano_work_parse_root(const String & hex, std::array<uint8_t, 32> & r_root) {
+    if(hex.length() != 64 || !hex.is_valid_hex_number(false)) return false;
+    for(int i = 0; i < 64; i += 2)
+        r_root[i/2] = hex.substr(i, 2).hex_to_int(false);
+    return true;
+}
+
+bool nano_work_parse_u64(const String & hex, uint64_t & r_value) {
+    if(hex.empty() || hex.length() > 16 || !hex.is_valid_hex_number(false)) return false;
+    r_value = 0;
+    for(int i = 0; i < hex.length(); i++)
+        r_value = (r_value << 4) | (uint64_t)hex.substr(i, 1).hex_to_int(false);
+    return true;
+}
+
+String nano_work_to_hex(uint64_t work) {
+    static const char digits[17] = "0123456789abcdef";
+    char hex[17];
+    for(int i = 15; i >= 0; i--, work >>= 4)
+        hex[i] = digits[work & 0xf];
+    hex[16] = '\0';
+    return String(hex);
+}
+
+uint64_t nano_work_value(const std::array<uint8_t, 32> & root, uint64_t work) {
+    uint8_t nonce[8];
+    for(int i = 0; i < 8; i++)
+        nonce[i] = (work >> (8 * i)) & 0xff;
+
+    uint8_t out[8];
+    blake2b_state hash;
+    blake2b_init(&hash, sizeof(out));
+    blake2b_update(&hash, nonce, sizeof(nonce));
+    blake2b_update(&hash, root.data(), root.size());
+    blake2b_final(&hash, out, sizeof(out));
+
+    uint64_t value = 0;
+    for(int i = 7; i >= 0; i--)
+        value = (value << 8) | out[i];
+    return value;
+}
+
+bool nano_work_validate(const String & root, const String & work, const String & difficulty) {
+    std::array<uint8_t, 32> root_bytes;
+    uint64_t work_value, difficulty_value;
+    if(!nano_work_parse_root(root, root_bytes) || !nano_work_parse_u64(work, work_value) || !nano_work_parse_u64(difficulty, difficulty_value)) return false;
+    return nano_work_value(root_bytes, work_value) >= difficulty_value;
+}
+
+namespace {
+const int local_work_rounds_per_slice = 16; // 64k nonces, tens of milliseconds on a phone
+
+// Proof of work runs in bounded slices that queue the next one, so short jobs get a worker in between
+class LocalWorkJob : public NanoJob {
+    private:
+        ObjectID dispatcher;
+        int job_id;
+        std::shared_ptr<NanoLocalWork> state;
+
+    public:
+        void run() {
+            // Cancellation is checked between rounds, so a lost race stops within a few milliseconds
+            NanoJobPool * pool = NanoJobPool::get_singleton();
+            for(int round = 0; round < local_work_rounds_per_slice; round++) {
+                if(state->cancel || pool->is_exiting()) return;
+                for(int i = 0; i < 4096; i++, state->nonce++) {
+                    if(nano_work_value(state->root, state->nonce) >= state->difficulty) {
+                        // Dropped by the queue if the dispatcher is gone by then
+                        MessageQueue::get_singleton()->push_call(dispatcher, "_local_work_completed", job_id, nano_work_to_hex(state->nonce));
+                        return;
+                    }
+                }
+            }
+            if(!state->cancel && !pool->is_exiting()) pool->submit(memnew(LocalWorkJob(dispatcher, job_id, state)));
+        }
+
+        LocalWorkJob(ObjectID p_dispatcher, int p_job_id, const std::shared_ptr<NanoLocalWork> & p_state) :
+            dispatcher(p_dispatcher), job_id(p_job_id), state(p_state) {}
+};
+}
+
+NanoWorkDispatcher::NanoWorkDispatcher() {
+    add_source(0, "");
+}
+
+NanoWorkDispatcher::~NanoWorkDispatcher() {
+    for(Map<int, std::shared_ptr<NanoLocalWork> >::Element * e = local_jobs.front(); e; e = e->next())
+        e->get()->cancel = true;
+}
+
+void NanoWorkDispatcher::add_source(int index, const String & url) {
+    Source source;
+    source.name = url;
+    if(url.begins_with("ws://") || url.begins_with("wss://")) {
+        source.socket = memnew(NanoWorkSocket);
+        add_child(source.socket);
+        source.socket->connect("work_completed", this, "_socket_completed", varray(index));
+        source.socket->connect("work_failed", this, "_socket_failed", varray(index));
+        source.socket->connect_to_server(url, auth);
+        source.key = "work_socket:" + url;
+    } else {
+        source.requester = memnew(NanoRequest);
+        add_child(source.requester);
+        source.requester->connect("rpc_completed", this, "_rpc_completed", varray(index));
+        if(!url.empty()) {
+            source.requester->set_connection_parameters(url, auth, use_ssl, url);
+            source.key = (index == 0 ? "work_node:" : "work_server:") + url;
+        }
+    }
+    sources.push_back(source);
+}
+
+void NanoWorkDispatcher::remove_source() {
+    const Source & source = sources[sources.size() - 1];
+    if(source.requester) source.requester->queue_delete();
+    if(source.socket) {
+        source.socket->disconnect_from_server();
+        source.socket->queue_delete();
+    }
+    sources.resize(sources.size() - 1);
+}
+
+void NanoWorkDispatcher::set_connection_parameters(String node_url, String auth_header, bool use_ssl) {
+    ERR_FAIL_COND_MSG(!jobs.empty(), "Connection parameters can't change while work is being generated.");
+    this->auth = auth_header;
+    this->use_ssl = use_ssl;
+
+    // Every source is rebuilt, the work servers share the auth header
+    while(sources.size()) remove_source();
+    add_source(0, node_url);
+    for(int i = 0; i < work_urls.size(); i++)
+        add_source(i + 1, work_urls[i]);
+}
+
+void NanoWorkDispatcher::set_work_urls(PoolStringArray urls) {
+    ERR_FAIL_COND_MSG(!jobs.empty(), "Work urls can't change while work is being generated.");
+
+    work_urls = urls;
+    while(sources.size() > 1) remove_source();
+    for(int i = 0; i < urls.size(); i++)
+        add_source(i + 1, urls[i]);
+}
+
+Vector<int> NanoWorkDispatcher::pick_sources() {
+    NanoNodeStats * stats = NanoNodeStats::get_singleton();
+    struct Candidate {
+        int source;
+        bool healthy;
+        double score;
+        bool operator<(const Candidate & other) const { return healthy != other.healthy ? healthy : score < other.score; }
+    };
+    std::vector<Candidate> candidates;
+    if(local_work) candidates.push_back({ SOURCE_LOCAL, stats->is_healthy("work_local"), stats->get_score("work_local") });
+    for(int i = 0; i < sources.size(); i++) {
+        if(sources[i].key.empty()) continue;
+        candidates.push_back({ i, stats->is_healthy(sources[i].key), stats->get_score(sources[i].key) });
+    }
+    // Fastest healthy sources first, unhealthy ones only make the cut when there aren't enough healthy ones
+    std::stable_sort(candidates.begin(), candidates.end());
+
+    Vector<int> picked;
+    int count = max_sources ? MIN(max_sources, (int)candidates.size()) : candidates.size();
+    for(int i = 0; i < count; i++) {
+        if(!candidates[i].healthy && !picked.empty()) break;
+        picked.push_back(candidates[i].source);
+    }
+    return picked;
+}
+
+int NanoWorkDispatcher::generate(String hash, String difficulty) {
+    Job job;
+    ERR_FAIL_COND_V_MSG(!nano_work_parse_root(hash, job.root), 0, "Invalid hash: " + hash);
+    ERR_FAIL_COND_V_MSG(!nano_work_parse_u64(difficulty, job.difficulty_value), 0, "Invalid difficulty: " + difficulty);
+    job.hash = hash;
+    job.difficulty = difficulty;
+
+    Vector<int> picked = pick_sources();
+    ERR_FAIL_COND_V_MSG(picked.empty(), 0, "No work sources configured");
+
+    int job_id = next_job_id++;
+    for(int i = 0; i < picked.size(); i++) {
+        Attempt attempt;
+        attempt.source = picked[i];
+        attempt.start_usec = OS::get_singleton()->get_ticks_usec();
+        if(attempt.source != SOURCE_LOCAL) {
+            const Source & source = sources[attempt.source];
+            if(source.socket) attempt.request_id = source.socket->work_generate(hash, difficulty);
+            else if(source.requester->work_generate(hash, attempt.source == 0, difficulty) == OK) attempt.request_id = source.requester->get_last_request_id();
+            if(!attempt.request_id) {
+                NanoNodeStats::get_singleton()->record_failure(source.key);
+                continue;
+            }
+        }
+        job.attempts.push_back(attempt);
+    }
+    ERR_FAIL_COND_V_MSG(job.attempts.empty(), 0, "No work source could be reached");
+
+    jobs[job_id] = job;
+    for(int i = 0; i < job.attempts.size(); i++) {
+        if(job.attempts[i].source == SOURCE_LOCAL) start_local(job_id, job);
+    }
+    return job_id;
+}
+
+void NanoWorkDispatcher::cancel(int job_id) {
+    if(jobs.has(job_id)) finish_job(job_id, -1, "");
+}
+
+void NanoWorkDispatcher::finish_job(int job_id, int winner, const String & work) {
+    Job job = jobs[job_id];
+    jobs.erase(job_id);
+
+    // The losers are told to stop, a work server would otherwise keep burning time on a solved root.
+    // They were at least as slow as the winner, without a sample a source that always loses would rank first.
+    uint64_t now = OS::get_singleton()->get_ticks_usec();
+    for(int i = 0; i < job.attempts.size(); i++) {
+        if(i == winner) continue;
+        const Attempt & attempt = job.attempts[i];
+        if(winner >= 0) NanoNodeStats::get_singleton()->record_lower_bound(attempt.source == SOURCE_LOCAL ? String("work_local") : sources[attempt.source].key, now - attempt.start_usec);
+        if(attempt.source == SOURCE_LOCAL) {
+            cancel_local(job_id);
+            continue;
+        }
+        const Source & source = sources[attempt.source];
+        if(source.socket) {
+            source.socket->work_cancel(attempt.request_id);
+            continue;
+        }
+        NanoRequest * requester = source.requester;
+        requester->cancel_rpc(attempt.request_id);
+        Dictionary data;
+        data["action"] = "work_cancel";
+        data["hash"] = job.hash;
+        requester->request_rpc(data, true);
+    }
+
+    if(winner < 0) return;
+    int source = job.attempts[winner].source;
+    emit_signal("work_completed", job_id, job.hash, work, source == SOURCE_LOCAL ? String("local") : sources[source].name);
+}
+
+void NanoWorkDispatcher::attempt_finished(int job_id, int attempt_index, bool valid, uint64_t work) {
+    Job & job = jobs[job_id];
+    const Attempt & attempt = job.attempts[attempt_index];
+    String key = attempt.source == SOURCE_LOCAL ? String("work_local") : sources[attempt.source].key;
+    if(valid) {
+        NanoNodeStats::get_singleton()->record_success(key, OS::get_singleton()->get_ticks_usec() - attempt.start_usec);
+        finish_job(job_id, attempt_index, nano_work_to_hex(work));
+        return;
+    }
+
+    NanoNodeStats::get_singleton()->record_failure(key);
+    job.attempts.remove(attempt_index);
+    if(!job.attempts.empty()) return;
+
+    String hash = job.hash;
+    jobs.erase(job_id);
+    emit_signal("work_failed", job_id, hash, "Every work source failed");
+}
+
+void NanoWorkDispatcher::_rpc_completed(int request_id, String action, int p_status, int p_code, const PoolByteArray & p_data, int source) {
+    if(action != "work_generate") return;
+
+    for(Map<int, Job>::Element * e = jobs.front(); e; e = e->next()) {
+        const Vector<Attempt> & attempts = e->get().attempts;
+        for(int i = 0; i < attempts.size(); i++) {
+            if(attempts[i].source != source || attempts[i].request_id != request_id) continue;
+
+            // Results are never trusted, a wrong nonce from a server counts as a failure
+            uint64_t work = 0;
+            bool valid = false;
+            if(p_status == HTTPRequest::RESULT_SUCCESS && p_code == 200) {
+                String json_string;
+                json_string.parse_utf8((const char *)p_data.read().ptr(), p_data.size());
+                Variant json;
+                String error_string;
+                int error_line;
+                if(JSON::parse(json_string, json, error_string, error_line) == OK && json.get_type() == Variant::DICTIONARY) {
+                    Dictionary result = json;
+                    valid = result.has("work") && nano_work_parse_u64(result["work"], work) && nano_work_value(e->get().root, work) >= e->get().difficulty_value;
+                }
+            }
+            attempt_finished(e->key(), i, valid, work);
+            return;
+        }
+    }
+}
+
+void NanoWorkDispatcher::_socket_completed(int request_id, String hash, String work, int source) {
+    // NanoWorkSocket has already validated the work against the difficulty it was asked for
+    uint64_t work_value = 0;
+    nano_work_parse_u64(work, work_value);
+    for(Map<int, Job>::Element * e = jobs.front(); e; e = e->next()) {
+        const Vector<Attempt> & attempts = e->get().attempts;
+        for(int i = 0; i < attempts.size(); i++) {
+            if(attempts[i].source == source && attempts[i].request_id == request_id) {
+                attempt_finished(e->key(), i, true, work_value);
+                return;
+            }
+        }
+    }
+}
+
+void NanoWorkDispatcher::_socket_failed(int request_id, String hash, String message, int source) {
+    for(Map<int, Job>::Element * e = jobs.front(); e; e = e->next()) {
+        const Vector<Attempt> & attempts = e->get().attempts;
+        for(int i = 0; i < attempts.size(); i++) {
+            if(attempts[i].source == source && attempts[i].request_id == request_id) {
+                attempt_finished(e->key(), i, false, 0);
+                return;
+            }
+        }
+    }
+}
+
+void NanoWorkDispatcher::start_local(int job_id, const Job & job) {
+    std::shared_ptr<NanoLocalWork> state = std::make_shared<NanoLocalWork>();
+    state->root = job.root;
+    state->difficulty = job.difficulty_value;
+    state->cancel = false;
+    duthomhas::csprng rng;
+    rng(&state->nonce, 1);
+    local_jobs[job_id] = state;
+    NanoJobPool::get_singleton()->submit(memnew(LocalWorkJob(get_instance_id(), job_id, state)));
+}
+
+void NanoWorkDispatcher::cancel_local(int job_id) {
+    Map<int, std::shared_ptr<NanoLocalWork> >::Element * e = local_jobs.find(job_id);
+    if(!e) return;
+    e->get()->cancel = true;
+    local_jobs.erase(e);
+}
+
+void NanoWorkDispatcher::_local_work_completed(int job_id, String work) {
+    if(!local_jobs.has(job_id)) return; // Cancelled after the nonce was found
+    local_jobs.erase(job_id);
+
+    Map<int, Job>::Element * e = jobs.find(job_id);
+    if(!e) return;
+    uint64_t work_value = 0;
+    nano_work_parse_u64(work, work_value);
+    for(int i = 0; i < e->get().attempts.size(); i++) {
+        if(e->get().attempts[i].source == SOURCE_LOCAL) {
+            attempt_finished(e->key(), i, true, work_value);
+            return;
+        }
+    }
+}
+
+Array NanoWorkDispatcher::get_source_stats() {
+    Array stats;
+    NanoNodeStats * node_stats = NanoNodeStats::get_singleton();
+    if(local_work) {
+        Dictionary d = node_stats->get_stats("work_local");
+        d["source"] = "local";
+        stats.append(d);
+    }
+    for(int i = 0; i < sources.size(); i++) {
+        if(sources[i].key.empty()) continue;
+        Dictionary d = node_stats->get_stats(sources[i].key);
+        d["source"] = sources[i].name;
+        stats.append(d);
+    }
+    return stats;
+}
+
+void NanoWorkDispatcher::_bind_methods() {
+    ClassDB::bind_method(D_METHOD("set_connection_parameters", "node_url", "auth_header", "use_ssl"), &NanoWorkDispatcher::set_connection_parameters, DEFVAL(""), DEFVAL(true));
+    ClassDB::bind_method(D_METHOD("set_work_urls", "urls"), &NanoWorkDispatcher::set_work_urls);
+    ClassDB::bind_method(D_METHOD("get_work_urls"), &NanoWorkDispatcher::get_work_urls);
+    ClassDB::bind_method(D_METHOD("generate", "hash", "difficulty"), &NanoWorkDispatcher::generate, DEFVAL("fffffff800000000"));
+    ClassDB::bind_method(D_METHOD("cancel", "job_id"), &NanoWorkDispatcher::cancel);
+    ClassDB::bind_method(D_METHOD("get_jobs_in_flight"), &NanoWorkDispatcher::get_jobs_in_flight);
+    ClassDB::bind_method(D_METHOD("get_source_stats"), &NanoWorkDispatcher::get_source_stats);
+    ClassDB::bind_method(D_METHOD("_rpc_completed", "request_id", "action", "p_status", "p_code", "p_data", "source"), &NanoWorkDispatcher::_rpc_completed);
+    ClassDB::bind_method(D_METHOD("_socket_completed", "request_id", "hash", "work", "source"), &NanoWorkDispatcher::_socket_completed);
+    ClassDB::bind_method(D_METHOD("_socket_failed", "request_id", "hash", "message", "source"), &NanoWorkDispatcher::_socket_failed);
+    ClassDB::bind_method(D_METHOD("_local_work_completed", "job_id", "work"), &NanoWorkDispatcher::_local_work_completed);
+
+    ClassDB::bind_method(D_METHOD("set_local_work", "enabled"), &NanoWorkDispatcher::set_local_work);
+    ClassDB::bind_method(D_METHOD("get_local_work"), &NanoWorkDispatcher::get_local_work);
+    ClassDB::bind_method(D_METHOD("set_max_sources", "count"), &NanoWorkDispatcher::set_max_sources);
+    ClassDB::bind_method(D_METHOD("get_max_sources"), &NanoWorkDispatcher::get_max_sources);
+    ADD_PROPERTY(PropertyInfo(Variant::POOL_STRING_ARRAY, "work_urls"), "set_work_urls", "get_work_urls");
+    ADD_PROPERTY(PropertyInfo(Variant::BOOL, "local_work"), "set_local_work", "get_local_work");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "max_sources"), "set_max_sources", "get_max_sources");
+
+    ADD_SIGNAL(MethodInfo("work_completed", PropertyInfo(Variant::INT, "job_id"), PropertyInfo(Variant::STRING, "hash"), PropertyInfo(Variant::STRING, "work"), PropertyInfo(Variant::STRING, "source")));
+    ADD_SIGNAL(MethodInfo("work_failed", PropertyInfo(Variant::INT, "job_id"), PropertyInfo(Variant::STRING, "hash"), PropertyInfo(Variant::STRING, "message")));
+}
\ No newline at end of file
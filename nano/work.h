@@ -0,0 +1,107 @@
+#ifndef NANO_WORK_H_
+#define NANO_WORK_H_
+
+#include "requester.h"
+#include "work_socket.h"
+
+#include "scene/main/node.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+
+// Proof of work helpers. A work value is blake2b-64 of the nonce (little endian) followed by the 32 byte root,
+// the work is valid when that value is at least the difficulty.
+bool nano_work_parse_root(const String & hex, std::array<uint8_t, 32> & r_root);
+bool nano_work_parse_u64(const String & hex, uint64_t & r_value);
+String nano_work_to_hex(uint64_t work);
+uint64_t nano_work_value(const std::array<uint8_t, 32> & root, uint64_t work);
+bool nano_work_validate(const String & root, const String & work, const String & difficulty);
+
+// A local proof of work running on NanoJobPool, shared between the job and its dispatcher
+struct NanoLocalWork {
+    std::array<uint8_t, 32> root;
+    uint64_t difficulty;
+    uint64_t nonce; // Next one to try, only touched by the slice that is running
+    std::atomic<bool> cancel;
+};
+
+// Races work generation across the local CPU, remote work servers and the node (with use_peers).
+// Work servers given as ws:// or wss:// urls are kept on a persistent NanoWorkSocket instead of HTTP.
+// The first result that validates locally wins, the other sources get work_cancel.
+// Latency and failures per source go to NanoNodeStats, which picks the sources for the next job.
+class NanoWorkDispatcher : public Node {
+    GDCLASS(NanoWorkDispatcher, Node)
+
+    private:
+        enum { SOURCE_LOCAL = -1 };
+
+        struct Attempt {
+            int source; // SOURCE_LOCAL, or an index into sources
+            int request_id = 0;
+            uint64_t start_usec;
+        };
+
+        struct Job {
+            String hash;
+            String difficulty;
+            std::array<uint8_t, 32> root;
+            uint64_t difficulty_value;
+            Vector<Attempt> attempts;
+        };
+        Map<int, Job> jobs;
+        int next_job_id = 1;
+
+        // sources[0] is the node, the rest are the work servers
+        struct Source {
+            String key; // NanoNodeStats key, empty when the source is not configured
+            String name;
+            NanoRequest * requester = NULL;
+            NanoWorkSocket * socket = NULL;
+        };
+        Vector<Source> sources;
+        PoolStringArray work_urls;
+        String auth;
+        bool use_ssl = true;
+
+        bool local_work = true;
+        int max_sources = 0;
+
+        Map<int, std::shared_ptr<NanoLocalWork> > local_jobs; // Shared with the NanoJobPool job so it can be stopped
+
+        void start_local(int job_id, const Job & job);
+        void cancel_local(int job_id);
+
+        void add_source(int index, const String & url);
+        void remove_source();
+        Vector<int> pick_sources();
+        void attempt_finished(int job_id, int attempt_index, bool valid, uint64_t work);
+        void finish_job(int job_id, int winner, const String & work);
+
+    protected:
+        static void _bind_methods();
+    public:
+        void set_connection_parameters(String node_url, String auth_header = "", bool use_ssl = true);
+        void set_work_urls(PoolStringArray urls);
+        PoolStringArray get_work_urls() { return work_urls; }
+
+        int generate(String hash, String difficulty = "fffffff800000000");
+        void cancel(int job_id);
+        int get_jobs_in_flight() { return jobs.size(); }
+        Array get_source_stats();
+
+        void _rpc_completed(int request_id, String action, int p_status, int p_code, const PoolByteArray & p_data, int source);
+        void _socket_completed(int request_id, String hash, String work, int source);
+        void _socket_failed(int request_id, String hash, String message, int source);
+        void _local_work_completed(int job_id, String work);
+
+        void set_local_work(bool enabled) { local_work = enabled; }
+        bool get_local_work() { return local_work; }
+        void set_max_sources(int count) { max_sources = MAX(count, 0); }
+        int get_max_sources() { return max_sources; }
+
+        NanoWorkDispatcher();
+        ~NanoWorkDispatcher();
+};
+
+#endif
\ No newline at end of file
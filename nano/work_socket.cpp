@@ -0,0 +1,188 @@
+#include "work_socket.h"
+
+#include "work.h"
+
+#include "core/io/json.h"
+#include "core/os/os.h"
+
+NanoWorkSocket::NanoWorkSocket() {
+    Ref<WebSocketClient> client(WebSocketClient::create());
+    _client = client;
+    ERR_FAIL_COND_MSG(_client.is_null(), "Client was null, connection not established");
+
+    _client->connect("connection_closed", this, "_closed");
+    _client->connect("connection_error", this, "_closed");
+    _client->connect("connection_established", this, "_connected");
+    _client->connect("data_received", this, "_on_data");
+}
+
+Error NanoWorkSocket::connect_to_server(String url, String auth_header) {
+    this->url = url;
+    this->auth_header = auth_header;
+    wants_connection = true;
+    if(connected) _client->disconnect_from_host();
+    connected = false;
+    return open();
+}
+
+Error NanoWorkSocket::open() {
+    Vector<String> headers;
+    if(!auth_header.empty())
+        headers.push_back(auth_header);
+
+    set_process_internal(true);
+    reconnect_at_msec = 0;
+    Error r = _client->connect_to_url(url, Vector<String>(), false, headers);
+    // No _closed follows a connection that could not even start, so the retry is scheduled here
+    if(r != OK && wants_connection) reconnect_at_msec = OS::get_singleton()->get_ticks_msec() + reconnect_delay_msec;
+    return r;
+}
+
+void NanoWorkSocket::disconnect_from_server() {
+    wants_connection = false;
+    connected = false;
+    _client->disconnect_from_host();
+    requests.clear();
+    set_process_internal(false);
+}
+
+Error NanoWorkSocket::send_message(const Dictionary & message) {
+    CharString data = JSON::print(message).utf8();
+    _client->get_peer(1)->set_write_mode(WebSocketPeer::WRITE_MODE_TEXT);
+    return _client->get_peer(1)->put_packet(reinterpret_cast<const uint8_t *>(data.get_data()), data.length());
+}
+
+void NanoWorkSocket::send_request(int id, Request & request) {
+    Dictionary message;
+    message["id"] = id;
+    message["action"] = "work_generate";
+    message["hash"] = request.hash;
+    message["difficulty"] = request.difficulty;
+    request.sent = send_message(message) == OK;
+}
+
+int NanoWorkSocket::work_generate(String hash, String difficulty) {
+    ERR_FAIL_COND_V_MSG(!wants_connection, 0, "Not connected, use connect_to_server first");
+
+    int id = next_request_id++;
+    Request & request = requests[id];
+    request.hash = hash;
+    request.difficulty = difficulty;
+    if(request_timeout_msec) request.deadline_msec = OS::get_singleton()->get_ticks_msec() + request_timeout_msec;
+    // Requests made while (re)connecting go out once the socket is up
+    if(connected) send_request(id, request);
+    return id;
+}
+
+void NanoWorkSocket::work_cancel(int request_id) {
+    Map<int, Request>::Element * e = requests.find(request_id);
+    if(!e) return;
+    if(connected && e->get().sent) {
+        Dictionary message;
+        message["id"] = next_request_id++;
+        message["action"] = "work_cancel";
+        message["hash"] = e->get().hash;
+        send_message(message);
+    }
+    requests.erase(e);
+}
+
+void NanoWorkSocket::_connected(String proto) {
+    connected = true;
+    for(Map<int, Request>::Element * e = requests.front(); e; e = e->next()) {
+        if(!e->get().sent) send_request(e->key(), e->get());
+    }
+    emit_signal("connected");
+}
+
+void NanoWorkSocket::_closed(bool was_clean) {
+    bool was_connected = connected;
+    connected = false;
+    // A server that went away keeps no state, everything unanswered is sent again on the next connection
+    for(Map<int, Request>::Element * e = requests.front(); e; e = e->next())
+        e->get().sent = false;
+    if(wants_connection) reconnect_at_msec = OS::get_singleton()->get_ticks_msec() + reconnect_delay_msec;
+    if(was_connected) emit_signal("disconnected", was_clean);
+}
+
+void NanoWorkSocket::_on_data() {
+    const uint8_t * data;
+    int buffer_size;
+    _client->get_peer(1)->get_packet(&data, buffer_size);
+
+    String packet;
+    packet.parse_utf8(reinterpret_cast<const char *>(data), buffer_size);
+
+    Variant json_result;
+    String err_string;
+    int err_line;
+    Error json_error = JSON::parse(packet, json_result, err_string, err_line);
+    ERR_FAIL_COND_MSG(json_error, "JSON Parsing failed at line " + itos(err_line) + " with message: " + err_string);
+    Dictionary json = json_result;
+
+    int id = json.get("id", 0);
+    Map<int, Request>::Element * e = requests.find(id);
+    if(!e) return; // Answer to a cancel, or to a request that was cancelled in the meantime
+    Request request = e->get();
+    requests.erase(e);
+
+    String work = json.get("work", "");
+    if(work.empty()) {
+        emit_signal("work_failed", id, request.hash, json.get("error", "No work in response"));
+    } else if(!nano_work_validate(request.hash, work, request.difficulty)) {
+        emit_signal("work_failed", id, request.hash, "Invalid work: " + work);
+    } else {
+        emit_signal("work_completed", id, request.hash, work);
+    }
+}
+
+void NanoWorkSocket::_notification(int what) {
+    if(what != NOTIFICATION_INTERNAL_PROCESS) return;
+
+    if(reconnect_at_msec && OS::get_singleton()->get_ticks_msec() >= reconnect_at_msec) open();
+    _client->poll();
+    expire_requests();
+}
+
+void NanoWorkSocket::expire_requests() {
+    // Requests waiting on a server that doesn't come back still end, so whoever asked can move on
+    uint64_t now = OS::get_singleton()->get_ticks_msec();
+    Vector<int> expired;
+    for(Map<int, Request>::Element * e = requests.front(); e; e = e->next()) {
+        if(e->get().deadline_msec && now >= e->get().deadline_msec) expired.push_back(e->key());
+    }
+    for(int i = 0; i < expired.size(); i++) {
+        // A handler of an earlier signal may have cancelled it already
+        Map<int, Request>::Element * e = requests.find(expired[i]);
+        if(!e) continue;
+        String hash = e->get().hash;
+        work_cancel(expired[i]);
+        emit_signal("work_failed", expired[i], hash, "Timed out");
+    }
+}
+
+void NanoWorkSocket::_bind_methods() {
+    ClassDB::bind_method(D_METHOD("_closed", "was_clean"), &NanoWorkSocket::_closed);
+    ClassDB::bind_method(D_METHOD("_on_data"), &NanoWorkSocket::_on_data);
+    ClassDB::bind_method(D_METHOD("_connected", "proto"), &NanoWorkSocket::_connected);
+
+    ClassDB::bind_method(D_METHOD("connect_to_server", "url", "auth_header"), &NanoWorkSocket::connect_to_server, DEFVAL(""));
+    ClassDB::bind_method(D_METHOD("disconnect_from_server"), &NanoWorkSocket::disconnect_from_server);
+    ClassDB::bind_method(D_METHOD("is_connected_to_server"), &NanoWorkSocket::is_connected_to_server);
+    ClassDB::bind_method(D_METHOD("work_generate", "hash", "difficulty"), &NanoWorkSocket::work_generate, DEFVAL("fffffff800000000"));
+    ClassDB::bind_method(D_METHOD("work_cancel", "request_id"), &NanoWorkSocket::work_cancel);
+    ClassDB::bind_method(D_METHOD("get_requests_in_flight"), &NanoWorkSocket::get_requests_in_flight);
+    ClassDB::bind_method(D_METHOD("get_url"), &NanoWorkSocket::get_url);
+
+    ClassDB::bind_method(D_METHOD("set_reconnect_delay_msec", "msec"), &NanoWorkSocket::set_reconnect_delay_msec);
+    ClassDB::bind_method(D_METHOD("get_reconnect_delay_msec"), &NanoWorkSocket::get_reconnect_delay_msec);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "reconnect_delay_msec"), "set_reconnect_delay_msec", "get_reconnect_delay_msec");
+    ClassDB::bind_method(D_METHOD("set_request_timeout_msec", "msec"), &NanoWorkSocket::set_request_timeout_msec);
+    ClassDB::bind_method(D_METHOD("get_request_timeout_msec"), &NanoWorkSocket::get_request_timeout_msec);
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "request_timeout_msec"), "set_request_timeout_msec", "get_request_timeout_msec");
+
+    ADD_SIGNAL(MethodInfo("connected"));
+    ADD_SIGNAL(MethodInfo("disconnected", PropertyInfo(Variant::BOOL, "was_clean")));
+    ADD_SIGNAL(MethodInfo("work_completed", PropertyInfo(Variant::INT, "request_id"), PropertyInfo(Variant::STRING, "hash"), PropertyInfo(Variant::STRING, "work")));
+    ADD_SIGNAL(MethodInfo("work_failed", PropertyInfo(Variant::INT, "request_id"), PropertyInfo(Variant::STRING, "hash"), PropertyInfo(Variant::STRING, "message")));
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef NANO_WORK_SOCKET_H_
+#define NANO_WORK_SOCKET_H_
+
+#include "core/map.h"
+#include "scene/main/node.h"
+#include "modules/websocket/websocket_client.h"
+
+// Work server client over one persistent websocket, so a block doesn't pay connection setup for its work.
+// Requests and cancellations are JSON text frames tagged with an id, the server answers with the same id:
+//   {"id": 7, "action": "work_generate", "hash": "...", "difficulty": "..."} -> {"id": 7, "work": "..."} or {"id": 7, "error": "..."}
+//   {"id": 8, "action": "work_cancel", "hash": "..."}
+// Any number of requests share the socket. Requests that were not answered are sent again after a reconnect.
+class NanoWorkSocket : public Node {
+    GDCLASS(NanoWorkSocket, Node)
+
+    private:
+        struct Request {
+            String hash;
+            String difficulty;
+            bool sent = false;
+            uint64_t deadline_msec = 0; // 0 waits forever
+        };
+
+        Ref<WebSocketClient> _client;
+        Map<int, Request> requests;
+        int next_request_id = 1;
+
+        String url;
+        String auth_header;
+        bool connected = false;
+        bool wants_connection = false;
+        int reconnect_delay_msec = 1000;
+        uint64_t reconnect_at_msec = 0;
+        int request_timeout_msec = 60000;
+
+        Error open();
+        Error send_message(const Dictionary & message);
+        void expire_requests();
+        void send_request(int id, Request & request);
+
+    protected:
+        static void _bind_methods();
+        void _notification(int what);
+    public:
+        Error connect_to_server(String url, String auth_header = "");
+        void disconnect_from_server();
+        bool is_connected_to_server() { return connected; }
+
+        int work_generate(String hash, String difficulty = "fffffff800000000");
+        void work_cancel(int request_id);
+        int get_requests_in_flight() { return requests.size(); }
+        String get_url() { return url; }
+
+        void _closed(bool was_clean = false);
+        void _connected(String proto = "");
+        void _on_data();
+
+        void set_reconnect_delay_msec(int msec) { reconnect_delay_msec = MAX(msec, 0); }
+        int get_reconnect_delay_msec() { return reconnect_delay_msec; }
+        void set_request_timeout_msec(int msec) { request_timeout_msec = MAX(msec, 0); }
+        int get_request_timeout_msec() { return request_timeout_msec; }
+
+        NanoWorkSocket();
+};
+
+#endif
\ No newline at end of file
@@ -3,19 +3,66 @@
 
 #include "core/class_db.h"
 #include "nano/account.h"
+#include "nano/address_cache.h"
 #include "nano/amount.h"
+#include "nano/block.h"
+#include "nano/connection_pool.h"
+#include "nano/job_pool.h"
+#include "nano/ledger.h"
+#include "nano/node_stats.h"
 #include "nano/requester.h"
+#include "nano/response_cache.h"
+#include "nano/scheduler.h"
 #include "nano/sender.h"
 #include "nano/receiver.h"
+#include "nano/sweeper.h"
+#include "nano/wallet.h"
 #include "nano/watcher.h"
+#include "nano/work.h"
+#include "nano/work_socket.h"
+
+#ifdef NANO_BENCH_ENABLED
+#include "bench/benchmark.h"
+#endif
+
+static NanoAddressCache * address_cache = NULL;
+static NanoConnectionPool * connection_pool = NULL;
+static NanoJobPool * job_pool = NULL;
+static NanoNodeStats * node_stats = NULL;
+static NanoResponseCache * response_cache = NULL;
+static NanoScheduler * scheduler = NULL;
 
 void register_nano_types() {
+    address_cache = memnew(NanoAddressCache);
+    connection_pool = memnew(NanoConnectionPool);
+    job_pool = memnew(NanoJobPool);
+    node_stats = memnew(NanoNodeStats);
+    response_cache = memnew(NanoResponseCache);
+    scheduler = memnew(NanoScheduler);
+
     ClassDB::register_class<NanoAccount>();
     ClassDB::register_class<NanoAmount>();
+    ClassDB::register_class<NanoBlock>();
+    ClassDB::register_class<NanoLedger>();
     ClassDB::register_class<NanoRequest>();
     ClassDB::register_class<NanoSender>();
     ClassDB::register_class<NanoReceiver>();
     ClassDB::register_class<NanoWatcher>();
+    ClassDB::register_class<NanoSweeper>();
+    ClassDB::register_class<NanoWallet>();
+    ClassDB::register_class<NanoWorkDispatcher>();
+    ClassDB::register_class<NanoWorkSocket>();
+#ifdef NANO_BENCH_ENABLED
+    ClassDB::register_class<NanoBenchmark>();
+#endif
 }
 
-void unregister_nano_types() {}
\ No newline at end of file
+void unregister_nano_types() {
+    // Workers first, a job still running may use the others
+    if(job_pool) memdelete(job_pool);
+    if(scheduler) memdelete(scheduler);
+    if(response_cache) memdelete(response_cache);
+    if(node_stats) memdelete(node_stats);
+    if(connection_pool) memdelete(connection_pool);
+    if(address_cache) memdelete(address_cache);
+}
\ No newline at end of file